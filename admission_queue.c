@@ -0,0 +1,612 @@
+/*
+ * admission_queue.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Queue of the requests waiting for an idle process of their project.
+    A request gets an idle process immediately only if nobody of its project
+    is waiting. Else it is queued. A process getting idle is handed directly
+    to the next waiter of its project, the waiter is notified and finds the
+    process in its entry. Only the waiter getting the process wakes up. If
+    the queue is full the request is rejected at once, if it waits longer
+    than the maximum wait time it is rejected afterwards.
+    The next waiter is the one with the shortest expected service time, so
+    short requests do not wait behind long running ones. A request waiting
+    longer than the maximum delay is served before all others in the order
+    of arrival, so long requests are not starved. With a maximum delay of 0
+    the queue is first in first out.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "admission_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "database.h"
+#include "logger.h"
+#include "qgis_config.h"
+#include "qgis_shutdown_queue.h"
+#include "routing_table.h"
+#include "statistic.h"
+#include "timer.h"
+
+
+/* the configuration of a project. It is read before the admission lock is
+ * taken, the lock does not wait for the configuration.
+ */
+struct admission_config_s
+{
+    const char *catch_all;	// from the routing table, or NULL
+    int max_queue;
+    int max_queue_wait;
+    int max_queue_delay;
+    int catch_all_overflow;
+};
+
+
+/* the queue of one project. The entries are kept until the program ends,
+ * there are only a few projects.
+ * The configuration is the one of the last request of the project.
+ */
+struct admission_project_s
+{
+    LIST_ENTRY(admission_project_s) entries;
+    char *projname;
+    TAILQ_HEAD(admission_waiter_list_s, admission_waiter_s) waiters;
+    int len;
+    struct admission_config_s config;
+};
+
+
+static LIST_HEAD(admission_project_list_s, admission_project_s) projectlist = LIST_HEAD_INITIALIZER(projectlist);
+static pthread_mutex_t admission_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_condattr_t admission_condattr;	/* of the conditions of the blocking waiters */
+static const char *catch_all;			/* name of the catch all project, or NULL */
+
+
+static void admission_queue_lock(void)
+{
+    int retval = pthread_mutex_lock(&admission_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void admission_queue_unlock(void)
+{
+    int retval = pthread_mutex_unlock(&admission_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+void admission_queue_init(void)
+{
+    /* the wait timeout is measured with the clock of the timer module */
+    int retval = pthread_condattr_init(&admission_condattr);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: pthread_condattr_init");
+	qexit(EXIT_FAILURE);
+    }
+    retval = pthread_condattr_setclock(&admission_condattr, get_valid_clock_id());
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: pthread_condattr_setclock() id %d", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+void admission_queue_delete(void)
+{
+    admission_queue_lock();
+
+    struct admission_project_s *project;
+    while ((project = LIST_FIRST(&projectlist)) != NULL)
+    {
+	assert(TAILQ_EMPTY(&project->waiters));
+	LIST_REMOVE(project, entries);
+	free(project->projname);
+	free(project);
+    }
+
+    admission_queue_unlock();
+
+    pthread_condattr_destroy(&admission_condattr);
+}
+
+
+/* read the configuration of the project, without the admission lock */
+static void admission_queue_get_config(struct admission_config_s *config, const char *projname)
+{
+    config->catch_all = routing_table_get_catch_all();
+    config->max_queue = config_get_max_queue(projname);
+    config->max_queue_wait = config_get_max_queue_wait(projname);
+    config->max_queue_delay = config_get_max_queue_delay(projname);
+    config->catch_all_overflow = config_get_catch_all_overflow(projname);
+}
+
+
+/* returns the queue of the project or NULL */
+static struct admission_project_s *admission_queue_nolock__find_project(const char *projname)
+{
+    struct admission_project_s *project;
+    LIST_FOREACH(project, &projectlist, entries)
+    {
+	if (0 == strcmp(project->projname, projname))
+	    return project;
+    }
+
+    return NULL;
+}
+
+
+/* returns the queue of the project, it is created if there is none.
+ * The configuration of the project and the catch all project are updated.
+ */
+static struct admission_project_s *admission_queue_nolock__get_project(const char *projname, const struct admission_config_s *config)
+{
+    catch_all = config->catch_all;
+
+    struct admission_project_s *project = admission_queue_nolock__find_project(projname);
+    if (project)
+    {
+	project->config = *config;
+	return project;
+    }
+
+    project = calloc(1, sizeof(*project));
+    assert(project);
+    if ( !project )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    project->projname = strdup(projname);
+    assert(project->projname);
+    if ( !project->projname )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    TAILQ_INIT(&project->waiters);
+    project->config = *config;
+    LIST_INSERT_HEAD(&projectlist, project, entries);
+
+    return project;
+}
+
+
+static long long int admission_queue_get_wait_usec(const struct admission_waiter_s *waiter)
+{
+    struct timespec ts = waiter->arrival;
+    int retval = qgis_timer_stop(&ts);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+
+    return (long long int)ts.tv_sec*1000*1000 + ts.tv_nsec/1000;
+}
+
+
+/* returns the waiter which may take the next idle process: the first waiter
+ * if it waits longer than the maximum delay, else the waiter with the
+ * shortest expected service time. The waiters are kept in the order of
+ * arrival, the earlier one wins if the estimates are equal.
+ */
+static struct admission_waiter_s *admission_queue_nolock__get_next(struct admission_project_s *project)
+{
+    struct admission_waiter_s *first = TAILQ_FIRST(&project->waiters);
+    if ( !first )
+	return NULL;
+
+    long long int max_delay = (long long int)project->config.max_queue_delay*1000;
+    if (0 >= max_delay || admission_queue_get_wait_usec(first) >= max_delay)
+	return first;
+
+    struct admission_waiter_s *next = first;
+    struct admission_waiter_s *waiter;
+    TAILQ_FOREACH(waiter, &project->waiters, entries)
+    {
+	if (waiter->expected_usec < next->expected_usec)
+	    next = waiter;
+    }
+
+    return next;
+}
+
+
+/* returns 1 if another waiter of the project expects a shorter service time */
+static int admission_queue_nolock__has_shorter(const struct admission_waiter_s *waiter)
+{
+    const struct admission_waiter_s *other;
+    TAILQ_FOREACH(other, &waiter->project->waiters, entries)
+    {
+	if (other->expected_usec < waiter->expected_usec)
+	    return 1;
+    }
+
+    return 0;
+}
+
+
+static void admission_queue_nolock__remove(struct admission_waiter_s *waiter)
+{
+    /* the waiter got a process and has already left the queue */
+    if (0 >= waiter->pid)
+    {
+	TAILQ_REMOVE(&waiter->project->waiters, waiter, entries);
+	waiter->project->len--;
+    }
+    waiter->is_queued = 0;
+}
+
+
+/* take an idle process of the catch all project for a request of another
+ * project, unless requests of the catch all project wait for it.
+ * returns the pid of the process which has been set to busy or -1
+ */
+static pid_t admission_queue_nolock__borrow_process(struct admission_project_s *project)
+{
+    if ( !catch_all || 0 == strcmp(catch_all, project->projname) )
+	return -1;
+    if ( !project->config.catch_all_overflow )
+	return -1;
+
+    struct admission_project_s *catchall_project = admission_queue_nolock__find_project(catch_all);
+    if (catchall_project && catchall_project->len)
+	return -1;
+
+    pid_t ret = db_try_get_next_idle_process_for_busy_work(catch_all);
+    if (0 < ret)
+    {
+	debug(1, "project '%s' borrowed process %d of catch all project '%s'", project->projname, ret, catch_all);
+	statistic_add_catch_all(1);
+    }
+
+    return ret;
+}
+
+
+/* returns an idle process of the project for the waiter, or of the catch
+ * all project if the project may borrow one. The process has been set to
+ * busy. Returns -1 if there is none.
+ */
+static pid_t admission_queue_nolock__get_idle_process(struct admission_project_s *project, struct admission_waiter_s *waiter)
+{
+    pid_t ret = db_try_get_affine_idle_process_for_busy_work(project->projname, waiter->affinity_key, &waiter->is_affinity_hit);
+    if (0 >= ret)
+	ret = admission_queue_nolock__borrow_process(project);
+
+    return ret;
+}
+
+
+/* hand the idle processes of the project to its next waiters, as long as
+ * there are both. The waiter leaves the queue, gets the process in
+ * waiter->pid and is notified.
+ */
+static void admission_queue_nolock__handoff(struct admission_project_s *project)
+{
+    struct admission_waiter_s *next;
+    while ((next = admission_queue_nolock__get_next(project)) != NULL)
+    {
+	pid_t pid = admission_queue_nolock__get_idle_process(project, next);
+	if (0 >= pid)
+	    break;
+
+	struct admission_waiter_s *first = TAILQ_FIRST(&project->waiters);
+	if (first != next)
+	    statistic_add_dispatch(1, 0);
+	else if (admission_queue_nolock__has_shorter(next))
+	    statistic_add_dispatch(0, 1);
+
+	TAILQ_REMOVE(&project->waiters, next, entries);
+	project->len--;
+	next->pid = pid;
+	debug(1, "handed process %d to the next waiter of project '%s'", pid, project->projname);
+
+	assert(next->notify);
+	next->notify(next->arg);
+    }
+}
+
+
+/* returns the process handed to the queued waiter, ADMISSION_QUEUE_TIMEOUT
+ * if the waiter waited too long or ADMISSION_QUEUE_WAIT.
+ */
+static pid_t admission_queue_nolock__check_waiter(struct admission_waiter_s *waiter)
+{
+    pid_t ret = ADMISSION_QUEUE_WAIT;
+    if (0 < waiter->pid)
+	ret = waiter->pid;
+    else if (0 == admission_queue_get_remaining_time(waiter))
+	ret = ADMISSION_QUEUE_TIMEOUT;
+
+    if (ADMISSION_QUEUE_WAIT != ret)
+    {
+	enum statistic_admission_e result = (0 < ret) ? STATISTIC_ADMISSION_QUEUED : STATISTIC_ADMISSION_TIMEOUT;
+	long long int wait_usec = admission_queue_get_wait_usec(waiter);
+	statistic_add_admission(result, wait_usec, waiter->queue_len);
+	if (waiter->is_cold_start)
+	    statistic_add_cold_start(0 < ret, wait_usec);
+	admission_queue_nolock__remove(waiter);
+    }
+
+    return ret;
+}
+
+
+static pid_t admission_queue_nolock__try_acquire(struct admission_waiter_s *waiter, const char *projname, const struct admission_config_s *config)
+{
+    pid_t ret;
+
+    if ( !waiter->is_queued )
+    {
+	struct admission_project_s *project = admission_queue_nolock__get_project(projname, config);
+
+	ret = -1;
+	if (0 == project->len)
+	    ret = admission_queue_nolock__get_idle_process(project, waiter);
+	else if (project->len >= config->max_queue)
+	    ret = admission_queue_nolock__borrow_process(project);
+
+	if (0 < ret)
+	{
+	    statistic_add_admission(STATISTIC_ADMISSION_IMMEDIATE, 0, 0);
+	    if (waiter->is_cold_start)
+		statistic_add_cold_start(1, 0);
+	}
+	else if (project->len >= config->max_queue)
+	{
+	    debug(1, "admission queue of project '%s' is full with %d requests", projname, project->len);
+	    statistic_add_admission(STATISTIC_ADMISSION_FULL, 0, project->len);
+	    if (waiter->is_cold_start)
+		statistic_add_cold_start(0, 0);
+	    ret = ADMISSION_QUEUE_FULL;
+	}
+	else
+	{
+	    int maxwait = config->max_queue_wait;
+	    struct timespec timeradd = { tv_sec: maxwait/1000, tv_nsec: (maxwait%1000)*1000*1000 };
+	    int retval = qgis_timer_start(&waiter->arrival);
+	    if (-1 == retval)
+	    {
+		logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+		qexit(EXIT_FAILURE);
+	    }
+	    waiter->timeout = waiter->arrival;
+	    qgis_timer_add(&waiter->timeout, &timeradd);
+	    waiter->project = project;
+	    waiter->queue_len = project->len;
+	    waiter->is_queued = 1;
+	    waiter->pid = 0;
+	    TAILQ_INSERT_TAIL(&project->waiters, waiter, entries);
+	    project->len++;
+
+	    /* a process may have got idle since the last handoff, before the
+	     * waiters of the project took their processes */
+	    admission_queue_nolock__handoff(project);
+	    ret = admission_queue_nolock__check_waiter(waiter);
+	}
+    }
+    else
+    {
+	ret = admission_queue_nolock__check_waiter(waiter);
+    }
+
+    return ret;
+}
+
+
+/* try to get an idle process of the project for the request.
+ * returns the pid of the process which has been set to busy, or one of
+ * ADMISSION_QUEUE_WAIT, ADMISSION_QUEUE_FULL or ADMISSION_QUEUE_TIMEOUT.
+ * With ADMISSION_QUEUE_WAIT the waiter stays in the queue, call this again
+ * after the notification or after the remaining time to get the process or
+ * the timeout. The waiter must be zeroed before the first call.
+ */
+pid_t admission_queue_try_acquire(struct admission_waiter_s *waiter, const char *projname)
+{
+    assert(waiter);
+    assert(projname);
+
+    /* the configuration is needed when the request enters the queue */
+    struct admission_config_s config;
+    memset(&config, 0, sizeof(config));
+    if ( !waiter->is_queued )
+	admission_queue_get_config(&config, projname);
+
+    admission_queue_lock();
+    pid_t ret = admission_queue_nolock__try_acquire(waiter, projname, &config);
+    admission_queue_unlock();
+
+    return ret;
+}
+
+
+/* notification of the blocking waiters */
+static void admission_queue_signal(void *arg)
+{
+    pthread_cond_t *condition = arg;
+
+    int retval = pthread_cond_signal(condition);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: pthread_cond_signal");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* blocking variant of admission_queue_try_acquire().
+ * returns the pid of the process which has been set to busy, or one of
+ * ADMISSION_QUEUE_FULL or ADMISSION_QUEUE_TIMEOUT.
+ * Set is_cold_start if the request waits for the first process of the project
+ * to start, the wait time is counted separately in the statistics.
+ * expected_usec is the expected service time of the request, shorter requests
+ * are served first.
+ * affinity_key is the affinity key of the request or 0, is_affinity_hit is set
+ * if the process is the one of the key.
+ */
+pid_t admission_queue_acquire(const char *projname, int is_cold_start, long long int expected_usec, unsigned int affinity_key, int *is_affinity_hit)
+{
+    assert(projname);
+
+    /* each waiter has its own condition, only the one getting a process
+     * is woken */
+    pthread_cond_t condition;
+    int retval = pthread_cond_init(&condition, &admission_condattr);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: pthread_cond_init");
+	qexit(EXIT_FAILURE);
+    }
+
+    struct admission_waiter_s waiter;
+    memset(&waiter, 0, sizeof(waiter));
+    waiter.is_cold_start = is_cold_start;
+    waiter.expected_usec = expected_usec;
+    waiter.affinity_key = affinity_key;
+    waiter.notify = admission_queue_signal;
+    waiter.arg = &condition;
+
+    struct admission_config_s config;
+    admission_queue_get_config(&config, projname);
+
+    admission_queue_lock();
+
+    pid_t ret = admission_queue_nolock__try_acquire(&waiter, projname, &config);
+    while (ADMISSION_QUEUE_WAIT == ret)
+    {
+	retval = pthread_cond_timedwait(&condition, &admission_lock, &waiter.timeout);
+	if (retval && ETIMEDOUT != retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: can not wait on condition");
+	    qexit(EXIT_FAILURE);
+	}
+	ret = admission_queue_nolock__try_acquire(&waiter, projname, &config);
+    }
+
+    admission_queue_unlock();
+
+    pthread_cond_destroy(&condition);
+
+    if (is_affinity_hit)
+	*is_affinity_hit = waiter.is_affinity_hit;
+
+    return ret;
+}
+
+
+/* remove the waiter from the queue, the request is gone */
+void admission_queue_cancel(struct admission_waiter_s *waiter)
+{
+    assert(waiter);
+
+    pid_t pid = 0;
+
+    admission_queue_lock();
+    if (waiter->is_queued)
+    {
+	pid = waiter->pid;
+	admission_queue_nolock__remove(waiter);
+    }
+    admission_queue_unlock();
+
+    /* the process has been handed to the waiter but is not taken, give it
+     * to the next one */
+    if (0 < pid)
+	db_process_set_state_idle(pid);
+}
+
+
+/* returns the milliseconds until the waiter times out, 0 if the time is over */
+int admission_queue_get_remaining_time(const struct admission_waiter_s *waiter)
+{
+    struct timespec now;
+    int retval = qgis_timer_start(&now);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    if ( !qgis_timer_isgreaterthan(&waiter->timeout, &now) )
+	return 0;
+
+    long long int remaining = (long long int)(waiter->timeout.tv_sec - now.tv_sec)*1000 + (waiter->timeout.tv_nsec - now.tv_nsec)/(1000*1000);
+
+    return (int)max(remaining, 1LL);
+}
+
+
+/* a process of the project became idle. Hand it to the next waiter of the
+ * project. A process of the catch all project nobody of its own waits for is
+ * handed to the waiters of the projects which may borrow it.
+ */
+void admission_queue_notify(const char *projname)
+{
+    assert(projname);
+
+    struct admission_config_s config;
+    admission_queue_get_config(&config, projname);
+
+    admission_queue_lock();
+
+    struct admission_project_s *project = admission_queue_nolock__get_project(projname, &config);
+    admission_queue_nolock__handoff(project);
+
+    if (0 == project->len && catch_all && 0 == strcmp(catch_all, projname))
+    {
+	struct admission_project_s *other;
+	LIST_FOREACH(other, &projectlist, entries)
+	{
+	    if (other != project && other->len)
+		admission_queue_nolock__handoff(other);
+	}
+    }
+
+    admission_queue_unlock();
+}
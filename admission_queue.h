@@ -0,0 +1,82 @@
+/*
+ * admission_queue.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Queue of the requests waiting for an idle process of their project.
+    The request with the shortest expected service time is served first.
+    A request waiting longer than the maximum delay is served before all
+    others in the order of arrival.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ADMISSION_QUEUE_H_
+#define ADMISSION_QUEUE_H_
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <time.h>
+
+
+/* return values of admission_queue_try_acquire() besides a process id */
+#define ADMISSION_QUEUE_WAIT	(-1)	// queued, wait for the notification
+#define ADMISSION_QUEUE_FULL	(-2)	// rejected, the queue is full
+#define ADMISSION_QUEUE_TIMEOUT	(-3)	// rejected, waited too long
+
+struct admission_project_s;
+
+/* A request waiting in the queue. The memory belongs to the caller.
+ * notify is called with arg as soon as a process has been handed to the
+ * waiter, the caller gets it with the next call of
+ * admission_queue_try_acquire(). Note: notify is called from any thread with
+ * the queue locked, it must not call back into the queue.
+ */
+struct admission_waiter_s
+{
+    TAILQ_ENTRY(admission_waiter_s) entries;
+    struct admission_project_s *project;
+    struct timespec arrival;
+    struct timespec timeout;
+    int queue_len;			// length of the queue at arrival
+    int is_queued;
+    int is_cold_start;			// set by the caller, waits for a process to start
+    long long int expected_usec;	// set by the caller, expected service time
+    unsigned int affinity_key;		// set by the caller, affinity key or 0
+    int is_affinity_hit;		// the process is the one of the affinity key
+    pid_t pid;				// process handed to the waiter
+    void (*notify)(void *arg);
+    void *arg;
+};
+
+
+void admission_queue_init(void);
+void admission_queue_delete(void);
+pid_t admission_queue_try_acquire(struct admission_waiter_s *waiter, const char *projname);
+pid_t admission_queue_acquire(const char *projname, int is_cold_start, long long int expected_usec, unsigned int affinity_key, int *is_affinity_hit);
+void admission_queue_cancel(struct admission_waiter_s *waiter);
+int admission_queue_get_remaining_time(const struct admission_waiter_s *waiter);
+void admission_queue_notify(const char *projname);
+
+
+#endif /* ADMISSION_QUEUE_H_ */
@@ -0,0 +1,229 @@
+/*
+ * affinity.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Affinity key of the map requests.
+    qgis_mapserv keeps layer and render caches per process. Requests for the
+    same layers of nearby regions in the same CRS get the same key, so the
+    scheduler can send them to the same process while it is idle.
+    The region is the grid cell of the BBOX: the BBOX width is rounded up to
+    a power of two, the cell is AFFINITY_CELL_TILES of these wide. All tiles
+    of one zoom level within a cell share the key. WMTS requests use the
+    tile matrix and the tile row and column divided by AFFINITY_CELL_TILES.
+    Requests without layers or without extent have no key.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "affinity.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "fcgi_state.h"
+
+
+#define AFFINITY_QUERY_STRING	"QUERY_STRING"
+#define AFFINITY_CELL_TILES	4	/* tiles per grid cell in each direction */
+#define AFFINITY_MAX_COORD	1e15	/* larger cell numbers are not hashed */
+
+
+struct affinity_param_s
+{
+    const char *value;
+    int len;
+};
+
+
+static uint32_t affinity_hash(uint32_t hash, const void *data, int len)
+{
+    const unsigned char *c = data;
+    int i;
+    for (i=0; i<len; i++)
+    {
+	hash ^= c[i];
+	hash *= 16777619u;
+    }
+    hash ^= ':';
+    hash *= 16777619u;
+
+    return hash;
+}
+
+
+static uint32_t affinity_hash_param(uint32_t hash, const struct affinity_param_s *param)
+{
+    return affinity_hash(hash, param->value ? param->value : "", param->len);
+}
+
+
+static uint32_t affinity_hash_int(uint32_t hash, long long int value)
+{
+    return affinity_hash(hash, &value, sizeof(value));
+}
+
+
+/* returns the number of the grid cell, the coordinate given in cells */
+static long long int affinity_get_cell(double cell)
+{
+    long long int ret = (long long int)cell;
+    if (cell < ret)
+	ret--;
+
+    return ret;
+}
+
+
+/* hashes the grid cell of the BBOX "minx,miny,maxx,maxy". Returns 0 if the
+ * BBOX can not be read.
+ */
+static int affinity_hash_bbox(uint32_t *hash, const struct affinity_param_s *bbox)
+{
+    char buffer[128];
+    if ( !bbox->value || bbox->len >= (int)sizeof(buffer) )
+	return 0;
+    memcpy(buffer, bbox->value, bbox->len);
+    buffer[bbox->len] = '\0';
+
+    /* accept "," and its url encoding "%2C" between the numbers */
+    double coord[4];
+    char *str = buffer;
+    int i;
+    for (i=0; i<4; i++)
+    {
+	char *end;
+	coord[i] = strtod(str, &end);
+	if (end == str)
+	    return 0;
+	str = end;
+	if (i < 3)
+	{
+	    if (',' == *str)
+		str++;
+	    else if (0 == strncasecmp(str, "%2C", 3))
+		str += 3;
+	    else
+		return 0;
+	}
+    }
+
+    double width = coord[2] - coord[0];
+    if ( !(width > 0) || !(width < AFFINITY_MAX_COORD) )
+	return 0;
+
+    /* round the width up to a power of two, the zoom level */
+    int level = 0;
+    double size = 1;
+    while (size < width && level < 1100)
+    {
+	size *= 2;
+	level++;
+    }
+    while (size / 2 >= width && level > -1100)
+    {
+	size /= 2;
+	level--;
+    }
+
+    double cellsize = size * AFFINITY_CELL_TILES;
+    double x = (coord[0] + coord[2]) / 2 / cellsize;
+    double y = (coord[1] + coord[3]) / 2 / cellsize;
+    if ( !(x > -AFFINITY_MAX_COORD && x < AFFINITY_MAX_COORD && y > -AFFINITY_MAX_COORD && y < AFFINITY_MAX_COORD) )
+	return 0;
+
+    *hash = affinity_hash_int(*hash, level);
+    *hash = affinity_hash_int(*hash, affinity_get_cell(x));
+    *hash = affinity_hash_int(*hash, affinity_get_cell(y));
+
+    return 1;
+}
+
+
+/* returns the affinity key of the request: the hash of the LAYERS, the CRS
+ * and the grid cell of the extent. Returns 0 if the request has no key.
+ */
+unsigned int affinity_get_key(const struct fcgi_session_s *fcgi_session)
+{
+    struct affinity_param_s layers = {0};
+    struct affinity_param_s crs = {0};
+    struct affinity_param_s bbox = {0};
+    struct affinity_param_s tilematrix = {0};
+    struct affinity_param_s tilematrixset = {0};
+    long long int tilerow = -1;
+    long long int tilecol = -1;
+
+    const char *query = fcgi_session ? fcgi_session_get_param(fcgi_session, AFFINITY_QUERY_STRING) : NULL;
+    while (query && *query)
+    {
+	const char *end = strchr(query, '&');
+	int querylen = end ? end - query : (int)strlen(query);
+	const char *eq = memchr(query, '=', querylen);
+	if (eq)
+	{
+	    int namelen = eq - query;
+	    struct affinity_param_s value = { eq + 1, querylen - namelen - 1 };
+	    if ((6 == namelen && 0 == strncasecmp(query, "LAYERS", namelen))
+		    || (5 == namelen && 0 == strncasecmp(query, "LAYER", namelen)))
+		layers = value;
+	    else if ((3 == namelen && 0 == strncasecmp(query, "CRS", namelen))
+		    || (3 == namelen && 0 == strncasecmp(query, "SRS", namelen)))
+		crs = value;
+	    else if (4 == namelen && 0 == strncasecmp(query, "BBOX", namelen))
+		bbox = value;
+	    else if (10 == namelen && 0 == strncasecmp(query, "TILEMATRIX", namelen))
+		tilematrix = value;
+	    else if (13 == namelen && 0 == strncasecmp(query, "TILEMATRIXSET", namelen))
+		tilematrixset = value;
+	    else if (7 == namelen && 0 == strncasecmp(query, "TILEROW", namelen))
+		tilerow = atoll(value.value);
+	    else if (7 == namelen && 0 == strncasecmp(query, "TILECOL", namelen))
+		tilecol = atoll(value.value);
+	}
+	query = end ? end + 1 : NULL;
+    }
+
+    if ( !layers.value )
+	return 0;
+
+    uint32_t hash = 2166136261u;
+    hash = affinity_hash_param(hash, &layers);
+    if (tilematrix.value && 0 <= tilerow && 0 <= tilecol)
+    {
+	hash = affinity_hash_param(hash, &tilematrixset);
+	hash = affinity_hash_param(hash, &tilematrix);
+	hash = affinity_hash_int(hash, tilerow / AFFINITY_CELL_TILES);
+	hash = affinity_hash_int(hash, tilecol / AFFINITY_CELL_TILES);
+    }
+    else
+    {
+	hash = affinity_hash_param(hash, &crs);
+	if ( !affinity_hash_bbox(&hash, &bbox) )
+	    return 0;
+    }
+
+    /* 0 means no key */
+    return hash ? hash : 1;
+}
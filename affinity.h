@@ -0,0 +1,40 @@
+/*
+ * affinity.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Affinity key of the map requests.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+struct fcgi_session_s;
+
+
+unsigned int affinity_get_key(const struct fcgi_session_s *fcgi_session);
+
+
+#endif /* AFFINITY_H_ */
@@ -0,0 +1,277 @@
+/*
+ * connection_acceptor.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Acceptor threads for the network connections.
+    Each thread owns one listening socket. All sockets are bound to the same
+    address with SO_REUSEPORT, so the kernel spreads the incoming connections
+    over the threads. On each wakeup a thread accepts all pending
+    connections before it waits again.
+    The main thread only handles the signals, so a slow reload of the
+    configuration does not delay new connections.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "connection_acceptor.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "common.h"
+#include "logger.h"
+#include "qgis_config.h"
+#include "qgis_shutdown_queue.h"
+#include "statistic.h"
+#include "connection_manager.h"
+
+
+#define ACCEPT_ERROR_BACKOFF	100	/* msec to wait if we run out of file descriptors */
+
+
+struct connection_acceptor_s
+{
+    pthread_t thread;
+    int num;
+    int listenfd;
+    const char *projname;	/* project of the listener or NULL */
+    int eventfd;	/* wakes the thread to shut down */
+};
+
+
+static struct connection_acceptor_s *acceptors = NULL;
+static int num_acceptors = 0;
+
+
+/* accept all pending connections of the listener.
+ * returns 0 if the backlog is empty, -1 if we should wait a while before
+ * accepting again.
+ */
+static int connection_acceptor_accept(struct connection_acceptor_s *acceptor)
+{
+    int accepted = 0;
+    int ret = 0;
+
+    while ( !get_program_shutdown() )
+    {
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
+	int netfd = accept4(acceptor->listenfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+	if (-1 == netfd)
+	{
+	    int is_done = 0;
+	    switch (errno)
+	    {
+	    case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+	    case EWOULDBLOCK:
+#endif
+		/* backlog is empty */
+		is_done = 1;
+		break;
+
+	    case EINTR:
+	    case ECONNABORTED:
+	    case EPROTO:
+		/* the client has gone before we accepted, take the next one */
+		break;
+
+	    case EMFILE:
+	    case ENFILE:
+	    case ENOBUFS:
+	    case ENOMEM:
+		logerror("ERROR: acceptor %d calling accept", acceptor->num);
+		is_done = 1;
+		ret = -1;
+		break;
+
+	    default:
+		logerror("ERROR: acceptor %d calling accept", acceptor->num);
+		qexit(EXIT_FAILURE);
+		// no break needed
+	    }
+
+	    if (is_done)
+		break;
+	}
+	else
+	{
+	    connection_manager_handle_connection_request(netfd, (struct sockaddr *)&addr, addrlen, acceptor->projname);
+	    accepted++;
+	}
+    }
+
+    if (accepted)
+    {
+	debug(1, "acceptor %d accepted %d connections", acceptor->num, accepted);
+	statistic_add_accept(accepted);
+    }
+
+    return ret;
+}
+
+
+static void *connection_acceptor_thread(void *arg)
+{
+    struct connection_acceptor_s *acceptor = arg;
+
+    enum {
+	listenfd_slot = 0,
+	eventfd_slot = 1,
+	num_poll_slots
+    };
+    struct pollfd pfd[num_poll_slots];
+    pfd[listenfd_slot].fd = acceptor->listenfd;
+    pfd[eventfd_slot].fd = acceptor->eventfd;
+    pfd[eventfd_slot].events = POLLIN;
+
+    int timeout = -1;
+    int has_finished = 0;
+    while ( !has_finished )
+    {
+	/* do not listen while shutting down or waiting for free resources */
+	if (get_program_shutdown() || timeout >= 0)
+	    pfd[listenfd_slot].events = 0;
+	else
+	    pfd[listenfd_slot].events = POLLIN;
+
+	int retval = poll(pfd, num_poll_slots, timeout);
+	if (-1 == retval)
+	{
+	    if (EINTR == errno)
+		continue;
+	    logerror("ERROR: acceptor %d calling poll", acceptor->num);
+	    qexit(EXIT_FAILURE);
+	}
+	timeout = -1;
+
+	if (POLLIN & pfd[eventfd_slot].revents)
+	{
+	    has_finished = 1;
+	}
+	else if (POLLIN & pfd[listenfd_slot].revents)
+	{
+	    retval = connection_acceptor_accept(acceptor);
+	    if (-1 == retval)
+		timeout = ACCEPT_ERROR_BACKOFF;
+	}
+    }
+
+    return NULL;
+}
+
+
+/* start one acceptor thread for each listening socket.
+ * The connections of a socket with a project name in projnames are routed to
+ * that project. The names must stay valid until the connection manager is
+ * deleted.
+ * The acceptors own the sockets from now on and close them on delete.
+ */
+void connection_acceptor_init(const int *listenfds, const char **projnames, int num)
+{
+    assert(listenfds);
+    assert(projnames);
+    assert(num > 0);
+    assert( !acceptors );
+
+    acceptors = calloc(num, sizeof(*acceptors));
+    assert(acceptors);
+    if ( !acceptors )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    num_acceptors = num;
+
+    int i;
+    for (i=0; i<num; i++)
+    {
+	struct connection_acceptor_s *acceptor = &acceptors[i];
+	acceptor->num = i;
+	acceptor->listenfd = listenfds[i];
+	acceptor->projname = projnames[i];
+
+	acceptor->eventfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (-1 == acceptor->eventfd)
+	{
+	    logerror("ERROR: can not create event fd");
+	    qexit(EXIT_FAILURE);
+	}
+
+	int retval = pthread_create(&acceptor->thread, NULL, connection_acceptor_thread, acceptor);
+	if (retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: creating thread");
+	    qexit(EXIT_FAILURE);
+	}
+    }
+}
+
+
+/* stop the acceptor threads and close the listening sockets */
+void connection_acceptor_delete(void)
+{
+    int i;
+    for (i=0; i<num_acceptors; i++)
+    {
+	struct connection_acceptor_s *acceptor = &acceptors[i];
+	uint64_t value = 1;
+	int retval = write(acceptor->eventfd, &value, sizeof(value));
+	if (-1 == retval)
+	{
+	    logerror("ERROR: writing to event fd %d", acceptor->eventfd);
+	    qexit(EXIT_FAILURE);
+	}
+    }
+
+    for (i=0; i<num_acceptors; i++)
+    {
+	struct connection_acceptor_s *acceptor = &acceptors[i];
+	int retval = pthread_join(acceptor->thread, NULL);
+	if (retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: joining acceptor thread");
+	    qexit(EXIT_FAILURE);
+	}
+	close(acceptor->eventfd);
+
+	retval = close(acceptor->listenfd);
+	debug(1, "closed network socket fd %d, retval %d, errno %d", acceptor->listenfd, retval, errno);
+    }
+
+    free(acceptors);
+    acceptors = NULL;
+    num_acceptors = 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * connection_acceptor.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Acceptor threads for the network connections.
+    Each thread owns one listening socket and hands the accepted connections
+    over to the connection manager.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef CONNECTION_ACCEPTOR_H_
+#define CONNECTION_ACCEPTOR_H_
+
+
+void connection_acceptor_init(const int *listenfds, const char **projnames, int num);
+void connection_acceptor_delete(void);
+
+
+#endif /* CONNECTION_ACCEPTOR_H_ */
@@ -38,15 +38,21 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
 #include <fastcgi.h>
-#include <regex.h>
 #include <pthread.h>
+#include <string.h>
+#include <stdio.h>
 
 #include "common.h"
+#include "admission_queue.h"
+#include "affinity.h"
+#include "service_time.h"
 #include "database.h"
 #include "logger.h"
 #include "timer.h"
@@ -56,23 +62,34 @@
 #include "statistic.h"
 #include "process_manager.h"
 #include "qgis_shutdown_queue.h"
+#include "connection_worker.h"
+#include "routing_table.h"
 
 
-#define MAX_CHILD_SOCKET_CONNECTION_RETRY	5	/* := 5 seconds */
+#define MAX_CHILD_SOCKET_CONNECTION_RETRY	5	/* then try the next process */
+#define MIN_CONNECT_BACKOFF	1	/* msec */
+#define MAX_CONNECT_BACKOFF	64	/* msec */
+#define MAX_CONNECT_WAIT	1000	/* msec */
 #define MAX_CHILD_COMMUNICATION_RETRY	3	/* if the current child exits
 						 * during work then retry with
 						 * another child process */
 
+#define CONNECTION_MODEL_EVENT	"event"
+#define CONNECTION_MODEL_THREAD	"thread"
+
 
 struct thread_connection_handler_args
 {
     int new_accepted_inet_fd;
     char *hostname;
+    const char *projname;	/* project of the listener or NULL */
 };
 
 
-static const int default_max_transfer_buffer_size = 4*1024; //INT_MAX;
-static const int max_wait_for_idle_process = 5;
+static const int default_transfer_buffer_size = 4*1024;
+static int use_connection_workers = 0;	/* set if the event workers handle the connections */
+static int network_socket_buffer_size = 4*1024;	/* kernel buffer size of the listener */
+static int child_socket_buffer_size = 0;	/* kernel buffer size of the child sockets, 0 if not yet known */
 
 static int change_file_mode_block(int fd, int is_blocking)
 {
@@ -194,6 +211,63 @@ static int send_fcgi_abort_to_web_client(int inetsocketfd, int requestId)
 
 
 
+/* find the project name for the request parameters of this fcgi session.
+ * The projects are tested in order of the configuration. Returns the name of
+ * the first project whose regular expression matches or NULL.
+ */
+const char *connection_manager_get_project(const struct fcgi_session_s *fcgi_session)
+{
+    return routing_table_get_project(fcgi_session);
+}
+
+
+/* returns 1 if the project of the request can be found before all request
+ * parameters have arrived, 0 if we have to wait for the rest.
+ */
+int connection_manager_can_get_project(const struct fcgi_session_s *fcgi_session)
+{
+    return routing_table_has_params(fcgi_session);
+}
+
+
+/* get the number of new started processes which then become idle
+ * processes.
+ * Then we can estimate how much new processes need to be started.
+ * Returns 1 if the project has no initialized process at all, i.e. the
+ * request has to wait for a process to start (cold start), 0 otherwise.
+ */
+int connection_manager_check_idle_processes(const char *projname)
+{
+    assert(projname);
+
+    int min_free_processes = config_get_min_idle_processes(projname);
+    int proc_avail = db_get_num_start_init_idle_process(projname);
+    int is_cold_start = 0;
+
+    if (0 >= min_free_processes)
+    {
+	/* min_proc=0: the project idles without processes. Start one for
+	 * this request if there is none free.
+	 */
+	min_free_processes = 1;
+	is_cold_start = (0 == db_get_num_process_by_status(projname, PROC_STATE_IDLE)
+		&& 0 == db_get_num_active_process(projname));
+    }
+
+    int missing_processes = min_free_processes - proc_avail;
+    if (missing_processes > 0)
+    {
+	/* not enough free processes, start new ones and add them to the existing processes */
+	// start one process a time, else we flood the system with processes (fork bomb!)
+	missing_processes = 1;
+	debug(1, "not enough processes for project %s, start %d new process", projname, missing_processes);
+	process_manager_start_new_process_detached(missing_processes, projname, 0);
+    }
+
+    return is_cold_start;
+}
+
+
 static void *thread_handle_connection(void *arg)
 {
     /* the main thread has been notified about data on the server network fd.
@@ -256,24 +330,15 @@ static void *thread_handle_connection(void *arg)
 
     /* here we do point 1, 2, 3, 4 */
     const char *request_project_name = NULL;
+    char signature[SERVICE_TIME_SIGNATURE_LEN] = "";
+    unsigned int affinity_key = 0;
+    int is_affinity_hit = 0;
 
     {
 
 	/* get the maximum read write socket buffer size */
-	int maxbufsize = default_max_transfer_buffer_size;
-	{
-	    int sockbufsize = 0;
-	    socklen_t size = sizeof(sockbufsize);
-	    retval = getsockopt(inetsocketfd, SOL_SOCKET, SO_RCVBUF, &sockbufsize, &size);
-	    if (-1 == retval)
-	    {
-		logerror("ERROR: getsockopt");
-		qexit(EXIT_FAILURE);
-	    }
-	    maxbufsize = min(sockbufsize, maxbufsize);
-
-	    debug(1, "set maximum transfer buffer to %d", maxbufsize);
-	}
+	int maxbufsize = min(network_socket_buffer_size, config_get_max_transfer_buffer());
+	debug(1, "set maximum transfer buffer to %d", maxbufsize);
 
 	char *buffer = malloc(maxbufsize);
 	assert(buffer);
@@ -321,91 +386,41 @@ static void *thread_handle_connection(void *arg)
 		    fcgi_session_parse(fcgi_session, buffer, readbytes);
 
 		    enum fcgi_session_state_e session_state = fcgi_session_get_state(fcgi_session);
+		    if (tinfo->projname && 0 < fcgi_session_get_requestid(fcgi_session))
+		    {
+			/* the listener belongs to the project, the parameters
+			 * are passed to the child process unseen */
+			request_project_name = tinfo->projname;
+			debug(1, "found project '%s' by the listener", request_project_name);
+			statistic_add_route_listener();
+			break;
+		    }
+
 		    switch (session_state)
 		    {
+		    case FCGI_SESSION_STATE_RUNNING:
+			/* the parameters needed to find the project have
+			 * arrived. The rest of the request is passed to the
+			 * child process after we connected to it.
+			 */
+			if (0 < fcgi_session_get_requestid(fcgi_session) && connection_manager_can_get_project(fcgi_session))
+			{
+			    request_project_name = connection_manager_get_project(fcgi_session);
+			    debug(1, "found project '%s' in query string before the end of the parameters", request_project_name);
+			    statistic_add_route(1);
+			    has_finished = 1;
+			}
+			break;
+
 		    case FCGI_SESSION_STATE_PARAMS_DONE:	// fall through
 		    case FCGI_SESSION_STATE_END:
 			/* we have the parameters complete.
 			 * TODO: now look for the URL and assign a process list
 			 */
 		    {
-			int num_proj = config_get_num_projects();
-			int i;
-			for (i=0; i<num_proj; i++)
-			{
-			    const char *proj_name = config_get_name_project(i);
-			    if (proj_name)
-			    {
-				const char *key = config_get_scan_parameter_key(proj_name);
-				if ( key )
-				{
-				    const char *scanregex = config_get_scan_parameter_regex(proj_name);
-				    debug(1, "use regex %s", scanregex);
-				    if (scanregex)
-				    {
-					regex_t regex;
-					/* Compile regular expression */
-					retval = regcomp(&regex, scanregex, REG_EXTENDED);
-					if( retval )
-					{
-					    size_t len = regerror(retval, &regex, NULL, 0);
-					    char *buffer = malloc(len);
-					    assert(buffer);
-					    if ( !buffer )
-					    {
-						logerror("ERROR: could not allocate memory");
-						qexit(EXIT_FAILURE);
-					    }
-					    (void) regerror (retval, &regex, buffer, len);
-
-					    debug(1, "Could not compile regular expression: %s", buffer);
-					    free(buffer);
-					    qexit(EXIT_FAILURE);
-					}
-
-					/* Execute regular expression */
-					const char *param = fcgi_session_get_param(fcgi_session, key);
-					if (param)
-					{
-					    retval = regexec(&regex, param, 0, NULL, 0);
-					    if( !retval )
-					    {
-						// Match
-						regfree(&regex);
-						request_project_name = proj_name;
-						break;
-					    }
-					    else if( retval == REG_NOMATCH )
-					    {
-						// No match, go on with next project
-					    }
-					    else
-					    {
-						size_t len = regerror(retval, &regex, NULL, 0);
-						char *buffer = malloc(len);
-						assert(buffer);
-						if ( !buffer )
-						{
-						    logerror("ERROR: could not allocate memory");
-						    qexit(EXIT_FAILURE);
-						}
-						(void) regerror (retval, &regex, buffer, len);
-
-						debug(1, "Could not match regular expression: %s", buffer);
-						free(buffer);
-						qexit(EXIT_FAILURE);
-					    }
-					}
-					regfree(&regex);
-				    }
-				}
-			    }
-			    else
-			    {
-				debug(1, "ERROR: no name for project number %d in configuration found", i);
-			    }
-			}
+			request_project_name = connection_manager_get_project(fcgi_session);
 			debug(1, "found project '%s' in query string", request_project_name);
+			statistic_add_route(0);
 			has_finished = 1;
 
 			break;
@@ -422,6 +437,9 @@ static void *thread_handle_connection(void *arg)
 
 	if (request_project_name)
 	{
+	    service_time_get_signature(fcgi_session, signature, sizeof(signature));
+	    if (config_get_affinity(request_project_name))
+		affinity_key = affinity_get_key(fcgi_session);
 	    requestId = fcgi_session_get_requestid(fcgi_session);
 	    role = fcgi_session_get_role(fcgi_session);
 	    /* filter messages not being FCGI_RESPONDER
@@ -489,6 +507,11 @@ static void *thread_handle_connection(void *arg)
     } while(0)
 
     int child_connect_retries = 0;
+    pid_t failed_pid = -1;	// did not accept in time, given back after the next acquire
+    int connect_retries = 0;
+    int connect_failovers = 0;
+    int has_connect_started = 0;
+    struct timespec connect_start;
     retry_new_child_connect:
     while (MAX_CHILD_COMMUNICATION_RETRY > child_connect_retries++)
     {
@@ -496,33 +519,27 @@ static void *thread_handle_connection(void *arg)
     if (request_project_name)
     {
 
-	/* get the number of new started processes which then become idle
-	 * processes.
-	 * Then we can estimate how much new processes need to be started.
-	 */
-	const char *projname = request_project_name;
-	int min_free_processes = config_get_min_idle_processes(projname);
-	int proc_avail = db_get_num_start_init_idle_process(projname);
-
-	int missing_processes = min_free_processes - proc_avail;
-	if (missing_processes > 0)
-	{
-	    /* not enough free processes, start new ones and add them to the existing processes */
-	    // start one process a time, else we flood the system with processes (fork bomb!)
-	    missing_processes = 1;
-	    debug(1, "not enough processes for project %s, start %d new process", projname, missing_processes);
-	    process_manager_start_new_process_detached(missing_processes, projname, 0);
-	}
+	int is_cold_start = connection_manager_check_idle_processes(request_project_name);
 
 	/* find the next idling process, set its state to BUSY and attach a thread to it.
-	 * try at most 5 seconds long to find an idle process */
-	mypid = db_get_next_idle_process_for_busy_work(request_project_name, max_wait_for_idle_process);
+	 * wait in the admission queue of the project at most max_queue_wait
+	 * milliseconds to find an idle process */
+	mypid = admission_queue_acquire(request_project_name, is_cold_start, service_time_get_estimate(request_project_name, signature), affinity_key, &is_affinity_hit);
     }
     else
     {
 	printlog("[%lu] Found no project for request from %s", thread_id, tinfo->hostname);
     }
 
+    /* the process which did not accept the connection is not taken twice.
+     * Give it back now, it may accept the next time.
+     */
+    if (0 < failed_pid)
+    {
+	db_process_set_state_idle(failed_pid);
+	failed_pid = -1;
+    }
+
     if ( mypid<0 )
     {
 	/* Found no idle processes.
@@ -644,24 +661,64 @@ static void *thread_handle_connection(void *arg)
 	}
 
 	childunixsocketfd = retval;	// refers to the socket this program connects to the child process
-	// try to connect 5 times == 5 seconds. exit with error if it does not work
+
+	/* the time to connect includes the retries and the failovers */
+	if ( !has_connect_started )
+	{
+	    retval = qgis_timer_start(&connect_start);
+	    if (-1 == retval)
+	    {
+		logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+		qexit(EXIT_FAILURE);
+	    }
+	    has_connect_started = 1;
+	}
+
+	/* try to connect 5 times with a backoff of some milliseconds. If the
+	 * process does not accept, try a different child process.
+	 */
 	{
+	    int backoff = MIN_CONNECT_BACKOFF;
 	    int i;
 	    for (i=0; i<MAX_CHILD_SOCKET_CONNECTION_RETRY; i++)
 	    {
 		retval = connect(childunixsocketfd, (struct sockaddr *)&sockaddr, sizeof(sockaddr));
+		if (-1 == retval && EINPROGRESS == errno)
+		{
+		    /* wait for the completion of the connect */
+		    struct pollfd cfd = { fd: childunixsocketfd, events: POLLOUT, revents: 0 };
+		    retval = poll(&cfd, 1, MAX_CONNECT_WAIT);
+		    if (0 == retval)
+		    {
+			errno = ETIMEDOUT;
+			retval = -1;
+		    }
+		    else if (0 < retval)
+		    {
+			int error = 0;
+			socklen_t len = sizeof(error);
+			retval = getsockopt(childunixsocketfd, SOL_SOCKET, SO_ERROR, &error, &len);
+			if ( !retval && error )
+			{
+			    errno = error;
+			    retval = -1;
+			}
+		    }
+		}
 		if (-1 == retval)
 		{
 		    if (EAGAIN == errno)
 		    {
-			// programm has been too fast between socket() and connect() ?
-			logerror("WARNING: can not connect to child process, %d. try", i+1);
-			int mretval = msleep(1000, 1);
+			/* the child process has not yet accept()ed the last connection */
+			connect_retries++;
+			debug(1, "can not connect to child process %d, %d. try, wait %d msec", mypid, i+1, backoff);
+			int mretval = msleep(backoff, 1);
 			if (-1 == mretval)
 			{
 			    logerror("ERROR: calling nanosleep");
 			    qexit(EXIT_FAILURE);
 			}
+			backoff = min(2*backoff, MAX_CONNECT_BACKOFF);
 			continue;
 		    }
 		    logerror("ERROR: can not connect to child process");
@@ -671,58 +728,45 @@ static void *thread_handle_connection(void *arg)
 		}
 		break; // connected successfully, go on
 	    }
-	    /* if still not connected after 5 tests, try a different child process or exit with error */
+	    /* if still not connected after 5 tests, try a different child process */
 	    if (-1 == retval)
 	    {
-		logerror("ERROR: can not connect to child process");
-		process_manager_restart_process(mypid);
+		printlog("[%lu] WARNING: child process %d does not accept connections, try the next process", thread_id, mypid);
 		close(childunixsocketfd);
+		failed_pid = mypid;
+		connect_failovers++;
 		FAULTY_CHILD_RETRY;
 	    }
 	}
 
-	char *buffer = NULL;
-	/* get the maximum read write socket buffer size */
-	int maxbufsize = default_max_transfer_buffer_size;
 	{
-	    int sockbufsize = 0;
-	    socklen_t size = sizeof(sockbufsize);
-	    retval = getsockopt(childunixsocketfd, SOL_SOCKET, SO_SNDBUF, &sockbufsize, &size);
-	    if (-1 == retval)
-	    {
-		logerror("ERROR: getsockopt");
-		process_manager_restart_process(mypid);
-		close(childunixsocketfd);
-		FAULTY_CHILD_RETRY;
-	    }
-	    maxbufsize = min(sockbufsize, maxbufsize);
-
-	    size = sizeof(sockbufsize);
-	    retval = getsockopt(childunixsocketfd, SOL_SOCKET, SO_RCVBUF, &sockbufsize, &size);
-	    if (-1 == retval)
-	    {
-		logerror("ERROR: getsockopt");
-		process_manager_restart_process(mypid);
-		close(childunixsocketfd);
-		FAULTY_CHILD_RETRY;
-	    }
-	    maxbufsize = min(sockbufsize, maxbufsize);
-
-	    size = sizeof(sockbufsize);
-	    retval = getsockopt(inetsocketfd, SOL_SOCKET, SO_SNDBUF, &sockbufsize, &size);
+	    struct timespec ts = connect_start;
+	    retval = qgis_timer_stop(&ts);
 	    if (-1 == retval)
 	    {
-		logerror("ERROR: getsockopt");
-		goto close_child_socket__end_session;
+		logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+		qexit(EXIT_FAILURE);
 	    }
-	    maxbufsize = min(sockbufsize, maxbufsize);
+	    statistic_add_child_connect((long long int)ts.tv_sec*1000*1000 + ts.tv_nsec/1000, connect_retries, connect_failovers);
+	}
 
-	    size = sizeof(sockbufsize);
-	    retval = getsockopt(inetsocketfd, SOL_SOCKET, SO_RCVBUF, &sockbufsize, &size);
-	    if (-1 == retval)
+	char *buffer = NULL;
+	/* get the maximum read write socket buffer size.
+	 * The sizes of the sockets are read once, not with every request.
+	 */
+	int maxbufsize = min(network_socket_buffer_size, config_get_max_transfer_buffer());
+	{
+	    int sockbufsize = child_socket_buffer_size;
+	    if ( !sockbufsize )
 	    {
-		logerror("ERROR: getsockopt");
-		goto close_child_socket__end_session;
+		sockbufsize = connection_manager_get_socket_buffer_size(childunixsocketfd);
+		if (-1 == sockbufsize)
+		{
+		    process_manager_restart_process(mypid);
+		    close(childunixsocketfd);
+		    FAULTY_CHILD_RETRY;
+		}
+		child_socket_buffer_size = sockbufsize;
 	    }
 	    maxbufsize = min(sockbufsize, maxbufsize);
 
@@ -758,6 +802,22 @@ static void *thread_handle_connection(void *arg)
 	int can_read_unixsock = 0;
 	int can_write_unixsock = 0;
 
+	/* start with small reads from the child process and double the size
+	 * as long as the response fills the buffer.
+	 */
+	int readsize = min(default_transfer_buffer_size, maxbufsize);
+	long long int relay_bytes = 0;
+	long long int relay_syscalls = 0;
+	int has_child_data = 0;
+	int is_child_done = 0;
+	struct timespec relay_start;
+	retval = qgis_timer_start(&relay_start);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	    qexit(EXIT_FAILURE);
+	}
+
 	int has_finished = 0;
 	while ( !has_finished )
 	{
@@ -839,6 +899,7 @@ static void *thread_handle_connection(void *arg)
 //		    retval = write(debugfd, data, datalen);
 		    int writebytes = write(childunixsocketfd, data, datalen);
 		    debug(1, "wrote %d", writebytes);
+		    relay_syscalls++;
 		    if (-1 == writebytes)
 		    {
 			if (ECONNRESET == errno)
@@ -867,6 +928,7 @@ static void *thread_handle_connection(void *arg)
 		    debug(1, "read data from network socket: ");
 		    int readbytes = read(inetsocketfd, buffer, maxbufsize);
 		    debug(1, "read %d, ", readbytes);
+		    relay_syscalls++;
 		    if (-1 == readbytes)
 		    {
 			if (ECONNRESET == errno)
@@ -886,7 +948,9 @@ static void *thread_handle_connection(void *arg)
 		    }
 		    else if (0 == readbytes)
 		    {
-			/* end of file received. exit this thread */
+			/* end of file received. The web server closes the
+			 * connection after the answer. exit this thread */
+			is_child_done = has_child_data;
 			break;
 		    }
 #ifdef PRINT_NETWORK_DATA
@@ -894,8 +958,10 @@ static void *thread_handle_connection(void *arg)
 		    fwrite(buffer, 1, readbytes, stderr);
 #endif
 
+		    relay_bytes += readbytes;
 		    int writebytes = write(childunixsocketfd, buffer, readbytes);
 		    debug(1, "wrote %d", writebytes);
+		    relay_syscalls++;
 		    if (-1 == writebytes)
 		    {
 			if (ECONNRESET == errno)
@@ -921,8 +987,9 @@ static void *thread_handle_connection(void *arg)
 	    if (can_read_unixsock && can_write_networksock)
 	    {
 		debug(1, "read data from unix socket: ");
-		int readbytes = read(childunixsocketfd, buffer, maxbufsize);
+		int readbytes = read(childunixsocketfd, buffer, readsize);
 		debug(1, "read %d, ", readbytes);
+		relay_syscalls++;
 		if (-1 == readbytes)
 		{
 		    if (ECONNRESET == errno)
@@ -943,14 +1010,21 @@ static void *thread_handle_connection(void *arg)
 		else if (0 == readbytes)
 		{
 		    /* end of file received. exit this thread */
+		    is_child_done = 1;
 		    break;
 		}
 #ifdef PRINT_SOCKET_DATA
 		debug(1, "fcgi data:");
 		fwrite(buffer, 1, readbytes, stderr);
 #endif
+		relay_bytes += readbytes;
+		has_child_data = 1;
+		if (readbytes == readsize)
+		    readsize = min(2*readsize, maxbufsize);
+
 		int writebytes = write(inetsocketfd, buffer, readbytes);
 		debug(1, "wrote %d", writebytes);
+		relay_syscalls++;
 		if (-1 == writebytes)
 		{
 		    if (ECONNRESET == errno)
@@ -974,7 +1048,24 @@ static void *thread_handle_connection(void *arg)
 	    }
 
 	}
-	close_child_socket__end_session:
+	statistic_add_relay(relay_bytes, 0, relay_syscalls);
+
+	/* the child process or the web server closed the connection after the
+	 * answer, learn the time the request needed */
+	if (is_child_done)
+	{
+	    retval = qgis_timer_stop(&relay_start);
+	    if (-1 == retval)
+	    {
+		logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+		qexit(EXIT_FAILURE);
+	    }
+	    long long int service_usec = (long long int)relay_start.tv_sec*1000*1000 + relay_start.tv_nsec/1000;
+	    service_time_add(request_project_name, signature, service_usec);
+	    if (affinity_key)
+		statistic_add_affinity(is_affinity_hit, service_usec);
+	}
+
 	retval = close (childunixsocketfd);
 	debug(1, "closed child socket fd %d, retval %d, errno %d", childunixsocketfd, retval, errno);
 	free(buffer);
@@ -984,6 +1075,8 @@ static void *thread_handle_connection(void *arg)
     }
     break;	// successful communication until this line, continue as usual
     }
+    if (0 < failed_pid)
+	db_process_set_state_idle(failed_pid);
 //    close(debugfd);
 
 
@@ -1008,8 +1101,176 @@ static void *thread_handle_connection(void *arg)
 }
 
 
-void connection_manager_handle_connection_request(int netfd, const struct sockaddr *addr, unsigned int length)
+void connection_manager_init(void)
+{
+    const char *model = config_get_connection_model();
+    if (model && 0 == strcmp(model, CONNECTION_MODEL_THREAD))
+    {
+	use_connection_workers = 0;
+	printlog("Handle each network connection in its own thread");
+    }
+    else
+    {
+	if (model && 0 != strcmp(model, CONNECTION_MODEL_EVENT))
+	    printlog("WARNING: unknown connection model '%s', use '%s'", model, CONNECTION_MODEL_EVENT);
+
+	int num = config_get_connection_workers();
+	if (num <= 0)
+	{
+	    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	    num = (cores > 0) ? cores : 1;
+	}
+	connection_worker_init(num);
+	use_connection_workers = 1;
+	printlog("Handle network connections in %d event workers", num);
+    }
+}
+
+
+void connection_manager_delete(void)
+{
+    if (use_connection_workers)
+    {
+	connection_worker_delete();
+	use_connection_workers = 0;
+    }
+}
+
+
+/* returns the smaller of the kernel send and receive buffer sizes of the
+ * socket, or -1 on error.
+ */
+int connection_manager_get_socket_buffer_size(int fd)
+{
+    int sndbufsize = 0;
+    int rcvbufsize = 0;
+    socklen_t size = sizeof(sndbufsize);
+    int retval = getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbufsize, &size);
+    if (-1 == retval)
+    {
+	logerror("ERROR: getsockopt");
+	return -1;
+    }
+
+    size = sizeof(rcvbufsize);
+    retval = getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbufsize, &size);
+    if (-1 == retval)
+    {
+	logerror("ERROR: getsockopt");
+	return -1;
+    }
+
+    return min(sndbufsize, rcvbufsize);
+}
+
+
+/* the accepted network connections inherit the buffer sizes of the
+ * listening socket. Read them once here.
+ */
+void connection_manager_set_listener(int listenfd)
+{
+    int retval = connection_manager_get_socket_buffer_size(listenfd);
+    if (-1 == retval)
+    {
+	logerror("ERROR: can not get buffer size of socket %d", listenfd);
+	qexit(EXIT_FAILURE);
+    }
+    network_socket_buffer_size = retval;
+    debug(1, "network socket buffer size %d", network_socket_buffer_size);
+}
+
+
+int connection_manager_get_network_buffer_size(void)
+{
+    return network_socket_buffer_size;
+}
+
+
+/* returns the number of requests the scheduler can answer at the same time,
+ * the sum of the maximum processes of all projects.
+ */
+int connection_manager_get_capacity(void)
+{
+    int capacity = 0;
+    int num = config_get_num_projects();
+    int i;
+    for (i=0; i<num; i++)
+    {
+	const char *projname = config_get_name_project(i);
+	if (projname)
+	    capacity += config_get_max_idle_processes(projname);
+    }
+
+    return capacity;
+}
+
+
+/* open the fcgi connection to the process before it gets idle, so the first
+ * request does not need to connect. Only the event workers reuse the
+ * connection to the child processes.
+ */
+void connection_manager_prepare_process_connection(pid_t pid)
+{
+    if (use_connection_workers)
+	connection_worker_prepare_process_connection(pid);
+}
+
+
+/* get the numeric host address and port of the peer.
+ * The peer of a unix domain socket has no address, it is named after the
+ * socket type.
+ * returns 0 on success, the error of getnameinfo() otherwise
+ */
+static int connection_manager_get_peer_name(const struct sockaddr *addr, unsigned int length, char *host, int hostlen, char *serv, int servlen)
+{
+    if (AF_UNIX == addr->sa_family)
+    {
+	snprintf(host, hostlen, "unix");
+	snprintf(serv, servlen, "-");
+	return 0;
+    }
+
+    return getnameinfo(addr, length, host, hostlen, serv, servlen, NI_NUMERICHOST | NI_NUMERICSERV);
+}
+
+
+/* hand the accepted connection over to a worker or a new thread.
+ * If the connection arrived on the listener of a project, projname is the
+ * name of the project. The request is routed there without looking at the
+ * parameters.
+ */
+void connection_manager_handle_connection_request(int netfd, const struct sockaddr *addr, unsigned int length, const char *projname)
 {
+    if (use_connection_workers)
+    {
+	/* the workers keep the connection open for the next request if the
+	 * web server wants to. Send the small records of the answer
+	 * immediately instead of waiting for the acknowledge of the last one.
+	 */
+	if (AF_INET == addr->sa_family || AF_INET6 == addr->sa_family)
+	{
+	    int flag = 1;
+	    int retval = setsockopt(netfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	    if (-1 == retval)
+		logerror("WARNING: setsockopt(%d, TCP_NODELAY)", netfd);
+	}
+
+	char hbuf[80], sbuf[10];
+	int ret = connection_manager_get_peer_name(addr, length, hbuf, sizeof(hbuf), sbuf, sizeof(sbuf));
+	if (ret < 0)
+	{
+	    printlog("ERROR: can not convert host address: %s", gai_strerror(ret));
+	    connection_worker_add_connection(netfd, NULL, projname);
+	}
+	else
+	{
+	    int worker = connection_worker_add_connection(netfd, hbuf, projname);
+	    printlog("Accepted connection from host %s, port %s. Handle connection in worker %d", hbuf, sbuf, worker);
+	}
+
+	return;
+    }
+
     /* NOTE: aside from the general rule
      * "malloc() and free() within the same function"
      * we transfer the responsibility for this memory
@@ -1023,11 +1284,11 @@ void connection_manager_handle_connection_request(int netfd, const struct sockad
 	qexit(EXIT_FAILURE);
     }
     targs->new_accepted_inet_fd = netfd;
+    targs->projname = projname;
 
 
     char hbuf[80], sbuf[10];
-    int ret = getnameinfo(addr, length, hbuf, sizeof(hbuf), sbuf,
-	    sizeof(sbuf), NI_NUMERICHOST | NI_NUMERICSERV);
+    int ret = connection_manager_get_peer_name(addr, length, hbuf, sizeof(hbuf), sbuf, sizeof(sbuf));
     if (ret < 0)
     {
 	printlog("ERROR: can not convert host address: %s", gai_strerror(ret));
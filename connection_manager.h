@@ -33,8 +33,23 @@
 #ifndef CONNECTION_MANAGER_H_
 #define CONNECTION_MANAGER_H_
 
+#include <sys/types.h>
+
 struct sockaddr;
-void connection_manager_handle_connection_request(int netfd, const struct sockaddr *addr, unsigned int length);
+struct fcgi_session_s;
+
+void connection_manager_init(void);
+void connection_manager_delete(void);
+void connection_manager_handle_connection_request(int netfd, const struct sockaddr *addr, unsigned int length, const char *projname);
+
+const char *connection_manager_get_project(const struct fcgi_session_s *fcgi_session);
+int connection_manager_can_get_project(const struct fcgi_session_s *fcgi_session);
+int connection_manager_check_idle_processes(const char *projname);
+void connection_manager_prepare_process_connection(pid_t pid);
+int connection_manager_get_socket_buffer_size(int fd);
+void connection_manager_set_listener(int listenfd);
+int connection_manager_get_network_buffer_size(void);
+int connection_manager_get_capacity(void);
 
 
 #endif /* CONNECTION_MANAGER_H_ */
@@ -0,0 +1,2667 @@
+/*
+ * connection_worker.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Event driven worker pool for the network connections.
+    Each worker runs an epoll event loop and handles the complete request of
+    many connections without blocking: read the parameters, find the project,
+    get an idle child process, connect to it and relay the data.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+/* defines _GNU_SOURCE for splice() before the first system header */
+#include "config.h"
+
+#include "connection_worker.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/queue.h>
+#include <fastcgi.h>
+
+#include "common.h"
+#include "logger.h"
+#include "timer.h"
+#include "database.h"
+#include "fcgi_data.h"
+#include "fcgi_state.h"
+#include "qgis_config.h"
+#include "statistic.h"
+#include "process_manager.h"
+#include "connection_manager.h"
+#include "admission_queue.h"
+#include "affinity.h"
+#include "service_time.h"
+#include "qgis_shutdown_queue.h"
+
+
+#define MAX_EPOLL_EVENTS	64
+#define DEFAULT_BUFFER_SIZE	(4*1024)
+#define MAX_POOL_BUFFERS	64	/* unused buffers kept by each worker */
+#define MAX_CHILD_SOCKET_CONNECTION_RETRY	5	/* then try the next process */
+#define MIN_CONNECT_BACKOFF	1	/* msec */
+#define MAX_CONNECT_BACKOFF	64	/* msec */
+#define MAX_CHILD_COMMUNICATION_RETRY	3
+#define MIN_SPLICE_SIZE		1024	/* smaller record content is copied */
+#define MAX_SPLICE_SIZE		(64*1024)
+
+#define CONNECTION_RELAY_SPLICE	"splice"
+#define CONNECTION_RELAY_COPY	"copy"
+
+
+/* The life cycle of a connection in the worker.
+ * All states except CONNECTION_STATE_DONE may wait for socket events or for
+ * the connection timer.
+ */
+enum connection_state_e
+{
+    CONNECTION_STATE_READ_PARAMS = 0,	// read the fcgi parameters from the web server
+    CONNECTION_STATE_ACQUIRE,		// find an idle child process
+    CONNECTION_STATE_CONNECT,		// connect to the child process
+    CONNECTION_STATE_CONNECTING,	// wait for the child process to accept
+    CONNECTION_STATE_RELAY,		// transfer the data between web server and child process
+    CONNECTION_STATE_FLUSH,		// write the remaining data to the web server, then close
+    CONNECTION_STATE_MUX,		// multiplexed web connection, pass the records to the requests
+    CONNECTION_STATE_DONE		// connection closed, waiting to be deleted
+};
+
+struct connection_s;
+struct connection_worker_s;
+
+/* The web endpoint of a request on a multiplexed web connection is virtual.
+ * It has no file descriptor, the data is exchanged with the multiplexed
+ * connection.
+ */
+struct connection_endpoint_s
+{
+    struct connection_s *conn;
+    int fd;
+    int is_virtual;
+    int is_registered;
+    int can_read;
+    int can_write;
+};
+
+/* the memory of unused buffers, kept for the next connections of the
+ * worker.
+ */
+struct connection_pool_entry_s
+{
+    char *data;
+    int size;
+};
+
+struct connection_pool_s
+{
+    int num;
+    struct connection_pool_entry_s entries[MAX_POOL_BUFFERS];
+};
+
+/* data is stored between start and end. The data between start and ready
+ * is complete and can be send, the data behind ready is an incomplete fcgi
+ * record header. The data between start and complete are complete records,
+ * only this data may be passed to a multiplexed connection.
+ * The size of a read starts with DEFAULT_BUFFER_SIZE and doubles up to
+ * maxsize each time a read fills the requested size.
+ */
+struct connection_buffer_s
+{
+    struct connection_pool_s *pool;
+    char *data;
+    int size;
+    int start;
+    int complete;
+    int ready;
+    int end;
+    int readsize;
+    int maxsize;
+};
+
+/* a pipe to move the record content from socket to socket with splice().
+ * The data never enters the user space.
+ */
+struct connection_pipe_s
+{
+    int fd[2];
+    int len;		// bytes in the pipe
+};
+
+/* tracks the fcgi records passing through a buffer */
+struct connection_framer_s
+{
+    int type;		// type of the current record
+    int remaining;	// content and padding bytes of the current record not yet passed
+    int held;		// length of a record not passed on, kept behind ready until complete
+    int has_end_of_stdin;	// the empty FCGI_STDIN record has been passed
+};
+
+struct connection_s
+{
+    TAILQ_ENTRY(connection_s) entries;		/* new, active or closed connections */
+    TAILQ_ENTRY(connection_s) timer_entries;	/* connections waiting for the timer */
+    TAILQ_ENTRY(connection_s) run_entries;	/* connections to run again */
+    struct connection_worker_s *worker;
+    int is_scheduled;
+    enum connection_state_e state;
+    struct connection_endpoint_s web;
+    struct connection_endpoint_s child;
+    char *hostname;
+    struct timespec starttime;
+
+    int has_timer;
+    struct timespec timer;
+
+    /* request parsing */
+    struct connection_buffer_s inbuf;
+    struct fcgi_session_s *session;
+    struct fcgi_data_list_s *datalist;
+    int has_begin_request;
+    int requestId;
+    int keep_conn;			// the web server keeps the connection for the next request
+    int num_requests;			// finished requests on this connection
+    const char *projname;
+    const char *listen_projname;	// project of the listener, routes without the parameters
+    char signature[SERVICE_TIME_SIGNATURE_LEN];	// request type and size for the service time
+    unsigned int affinity_key;		// layers and extent of the request, 0 for none
+    struct timespec relay_start;
+
+    /* child process */
+    pid_t pid;
+    int has_acquire_started;
+    struct admission_waiter_s waiter;
+    TAILQ_ENTRY(connection_s) wait_entries;	/* connections waiting in the admission queue */
+    int is_waiting;
+    int is_admission_notified;		/* set by other threads */
+    int connect_retries;		// with the current process
+    int connect_backoff;
+    int has_connect_started;
+    struct timespec connect_start;
+    int connect_failovers;
+    int connect_retries_total;
+    pid_t failed_pid;			// did not accept in time, given back after the next acquire
+    int child_retries;
+    int is_child_kept;			// the connection to the child process is the one kept from the last request
+
+    /* relay */
+    int child_requestId;
+    int has_relay_input;		// input of the web server relayed behind the stored request
+    int has_relay_answer;		// data of the child process read
+    struct connection_framer_s tochild_framer;
+    struct connection_framer_s toweb_framer;
+    struct connection_buffer_s tochild;
+    struct connection_buffer_s toweb;
+    struct connection_pipe_s tochild_pipe;
+    struct connection_pipe_s toweb_pipe;
+    struct connection_buffer_s toweb_answers;	// answers of the scheduler, wait for a record boundary of toweb
+    int child_bufsize;			// kernel buffer size of the child socket
+    int use_splice;
+    long long copied_bytes;
+    long long spliced_bytes;
+    long long syscalls;
+
+    /* multiplexed web connection */
+    struct connection_s *mux;		// the web connection of a multiplexed request
+    TAILQ_ENTRY(connection_s) mux_entries;
+    TAILQ_HEAD(connection_mux_list_s, connection_s) muxlist;	// the requests of the web connection
+    int num_mux;			// requests in muxlist
+    int is_mux_full;			// a request has no space for its next record, the web connection is not read
+    struct connection_buffer_s muxin;	// records of the request not yet read
+};
+
+TAILQ_HEAD(connection_list_s, connection_s);
+
+struct connection_worker_s
+{
+    int num;
+    pthread_t thread;
+    int epollfd;
+    int eventfd;
+    pthread_mutex_t lock;		/* protects newlist and is_shutdown */
+    struct connection_list_s newlist;	/* connections handed over by the main thread */
+    int is_shutdown;
+    struct connection_list_s activelist;
+    struct connection_list_s closedlist;
+    struct connection_list_s timerlist;
+    struct connection_list_s runlist;
+    struct connection_list_s waitlist;
+    struct connection_pool_s pool;
+};
+
+
+static struct connection_worker_s *workers = NULL;
+static int num_workers = 0;
+static unsigned int next_worker = 0;
+static unsigned int next_child_requestid = 0;
+static int use_splice = 0;
+static int use_multiplex = 0;
+static int max_buffer_size = DEFAULT_BUFFER_SIZE;
+
+
+static void connection_worker_lock(struct connection_worker_s *worker)
+{
+    int retval = pthread_mutex_lock(&worker->lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void connection_worker_unlock(struct connection_worker_s *worker)
+{
+    int retval = pthread_mutex_unlock(&worker->lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void connection_worker_wakeup(struct connection_worker_s *worker)
+{
+    uint64_t value = 1;
+    int retval = write(worker->eventfd, &value, sizeof(value));
+    if (-1 == retval && EAGAIN != errno)
+    {
+	logerror("ERROR: writing to event fd %d", worker->eventfd);
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* returns the memory of an unused buffer with at least len bytes, or of
+ * the largest unused buffer. Returns NULL if the pool is empty.
+ */
+static char *connection_pool_get(struct connection_pool_s *pool, int len, int *size)
+{
+    if (0 == pool->num)
+	return NULL;
+
+    int found = 0;
+    int i;
+    for (i=1; i<pool->num; i++)
+    {
+	int size_i = pool->entries[i].size;
+	int size_found = pool->entries[found].size;
+	int is_better;
+	if (size_found < len)
+	    is_better = size_i > size_found;	// less to grow
+	else
+	    is_better = size_i >= len && size_i < size_found;	// smallest fitting
+	if (is_better)
+	    found = i;
+    }
+
+    char *data = pool->entries[found].data;
+    *size = pool->entries[found].size;
+    pool->entries[found] = pool->entries[--pool->num];
+
+    return data;
+}
+
+
+static void connection_pool_put(struct connection_pool_s *pool, char *data, int size)
+{
+    if (pool->num < MAX_POOL_BUFFERS)
+    {
+	pool->entries[pool->num].data = data;
+	pool->entries[pool->num].size = size;
+	pool->num++;
+    }
+    else
+    {
+	free(data);
+    }
+}
+
+
+static void connection_pool_delete(struct connection_pool_s *pool)
+{
+    while (pool->num > 0)
+	free(pool->entries[--pool->num].data);
+}
+
+
+static void connection_buffer_reserve(struct connection_buffer_s *buffer, int len)
+{
+    assert(buffer);
+
+    if ( !buffer->data && buffer->pool )
+	buffer->data = connection_pool_get(buffer->pool, len, &buffer->size);
+
+    if (buffer->start > 0 && buffer->start == buffer->end)
+	buffer->start = buffer->complete = buffer->ready = buffer->end = 0;
+
+    if (buffer->size - buffer->end >= len)
+	return;
+
+    /* move the data to the beginning, then grow if still needed */
+    if (buffer->start > 0)
+    {
+	memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+	buffer->complete -= buffer->start;
+	buffer->ready -= buffer->start;
+	buffer->end -= buffer->start;
+	buffer->start = 0;
+    }
+
+    if (buffer->size - buffer->end < len)
+    {
+	int newsize = max(buffer->size, DEFAULT_BUFFER_SIZE);
+	while (newsize - buffer->end < len)
+	    newsize *= 2;
+
+	char *data = realloc(buffer->data, newsize);
+	assert(data);
+	if ( !data )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	buffer->data = data;
+	buffer->size = newsize;
+    }
+}
+
+
+/* give the memory back to the pool of the worker. The buffer can be used
+ * again afterwards.
+ */
+static void connection_buffer_free(struct connection_buffer_s *buffer)
+{
+    struct connection_pool_s *pool = buffer->pool;
+    int maxsize = buffer->maxsize;
+
+    if (buffer->data)
+    {
+	if (pool)
+	    connection_pool_put(pool, buffer->data, buffer->size);
+	else
+	    free(buffer->data);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->pool = pool;
+    buffer->maxsize = maxsize;
+}
+
+
+static int connection_buffer_is_empty(const struct connection_buffer_s *buffer)
+{
+    return buffer->start == buffer->end;
+}
+
+
+/* append a complete FCGI_END_REQUEST record to the buffer */
+static void connection_buffer_append_endrequest(struct connection_buffer_s *buffer, int requestId, unsigned char protocolStatus)
+{
+    struct fcgi_message_s *message = fcgi_message_new_endrequest(requestId, 0, protocolStatus);
+    connection_buffer_reserve(buffer, sizeof(FCGI_EndRequestRecord));
+    int retval = fcgi_message_write(buffer->data + buffer->end, sizeof(FCGI_EndRequestRecord), message);
+    if (1 > retval)
+    {
+	printlog("ERROR: could not write fcgi message to buffer");
+	qexit(EXIT_FAILURE);
+    }
+    buffer->end += retval;
+    buffer->complete = buffer->ready = buffer->end;
+    fcgi_message_delete(message);
+}
+
+
+/* answer a management record of the web server. The scheduler knows the
+ * values of FCGI_GET_VALUES better than the child processes, every other
+ * type is unknown.
+ */
+static void connection_answer_management_record(struct connection_buffer_s *buffer, const char *record, int recordlen)
+{
+    int type;
+    fcgi_record_get_header(record, recordlen, &type, NULL, NULL);
+
+    /* the answer of FCGI_GET_VALUES is small, three variables at most */
+    connection_buffer_reserve(buffer, 256);
+    int retval;
+    if (FCGI_GET_VALUES == type)
+    {
+	int capacity = connection_manager_get_capacity();
+	retval = fcgi_record_write_get_values_result(buffer->data + buffer->end, buffer->size - buffer->end, record, recordlen, capacity, capacity, use_multiplex);
+	debug(1, "answer FCGI_GET_VALUES, capacity %d, multiplex %d", capacity, use_multiplex);
+    }
+    else
+    {
+	retval = fcgi_record_write_unknown_type(buffer->data + buffer->end, buffer->size - buffer->end, type);
+	debug(1, "answer unknown management record type %d", type);
+    }
+
+    if (retval > 0)
+    {
+	buffer->end += retval;
+	buffer->complete = buffer->ready = buffer->end;
+    }
+}
+
+
+/* answer a record of the web server which is not part of the request of the
+ * connection: a management record, or the begin request of a second request
+ * on a not multiplexed connection. Other records of foreign request ids are
+ * dropped.
+ */
+static void connection_answer_foreign_record(struct connection_buffer_s *buffer, const char *record, int recordlen)
+{
+    int type, requestId;
+    fcgi_record_get_header(record, recordlen, &type, &requestId, NULL);
+
+    if (0 == requestId)
+    {
+	connection_answer_management_record(buffer, record, recordlen);
+    }
+    else if (FCGI_BEGIN_REQUEST == type)
+    {
+	debug(1, "reject request id %d, connection is not multiplexed", requestId);
+	connection_buffer_append_endrequest(buffer, requestId, FCGI_CANT_MPX_CONN);
+    }
+    else
+    {
+	debug(1, "ignore record type %d of request id %d", type, requestId);
+    }
+}
+
+
+/* walk over the fcgi records between ready and end of the buffer. Each
+ * complete record header gets the request id exchanged, the record content
+ * passes unchanged. Management records (request id 0) are not changed.
+ * An incomplete record header stays behind ready until the rest is read.
+ * If web_conn is set, the records come from the web server. Management
+ * records and records of other request ids are not passed to the child
+ * process: they stay behind ready until complete, are answered into the
+ * answers of web_conn and taken out of the buffer.
+ * returns 1 if an FCGI_END_REQUEST record has been completed. In this case
+ * data behind this record is dropped.
+ */
+static int connection_buffer_frame(struct connection_buffer_s *buffer, struct connection_framer_s *framer, int requestId, struct connection_s *web_conn)
+{
+    while (buffer->ready < buffer->end)
+    {
+	if (framer->remaining > 0)
+	{
+	    int len = min(framer->remaining, buffer->end - buffer->ready);
+	    buffer->ready += len;
+	    framer->remaining -= len;
+	}
+	else
+	{
+	    char *record = buffer->data + buffer->ready;
+	    int len = buffer->end - buffer->ready;
+	    int type, recordId, contentLength;
+	    int recordlen = fcgi_record_get_header(record, len, &type, &recordId, &contentLength);
+	    if (0 == recordlen)
+		break;	// wait for the complete header
+
+	    if (web_conn && (0 == recordId || web_conn->requestId != recordId))
+	    {
+		framer->held = recordlen;
+		if (recordlen > len)
+		    break;	// wait for the complete record
+
+		connection_answer_foreign_record(&web_conn->toweb_answers, record, recordlen);
+		memmove(record, record + recordlen, len - recordlen);
+		buffer->end -= recordlen;
+		framer->held = 0;
+		continue;
+	    }
+
+	    if (0 != recordId)
+		fcgi_record_set_requestid(record, recordlen, requestId);
+	    if (FCGI_STDIN == type && 0 == contentLength)
+		framer->has_end_of_stdin = 1;
+	    framer->type = type;
+	    framer->remaining = recordlen - sizeof(FCGI_Header);
+	    buffer->ready += sizeof(FCGI_Header);
+	}
+
+	if (0 == framer->remaining)
+	{
+	    buffer->complete = buffer->ready;
+	    if (FCGI_END_REQUEST == framer->type)
+	    {
+		framer->type = 0;
+		buffer->end = buffer->ready;
+		return 1;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+
+/* run the connection again after the current event has been handled */
+static void connection_schedule(struct connection_s *conn)
+{
+    if ( !conn->is_scheduled && CONNECTION_STATE_DONE != conn->state )
+    {
+	TAILQ_INSERT_TAIL(&conn->worker->runlist, conn, run_entries);
+	conn->is_scheduled = 1;
+    }
+}
+
+
+static void connection_unschedule(struct connection_s *conn)
+{
+    if (conn->is_scheduled)
+    {
+	TAILQ_REMOVE(&conn->worker->runlist, conn, run_entries);
+	conn->is_scheduled = 0;
+    }
+}
+
+
+/* read the records the multiplexed connection passed to this request.
+ * returns like connection_buffer_read(), end of file if the multiplexed
+ * connection has been closed.
+ */
+static int connection_mux_read(struct connection_endpoint_s *endpoint, struct connection_buffer_s *buffer, int maxlen)
+{
+    struct connection_s *conn = endpoint->conn;
+    struct connection_buffer_s *muxin = &conn->muxin;
+
+    int len = muxin->end - muxin->start;
+    if (0 == len)
+    {
+	if ( !conn->mux )
+	    return 0;
+
+	errno = EAGAIN;
+	endpoint->can_read = 0;
+	return -1;
+    }
+    if (maxlen)
+	len = min(len, maxlen);
+
+    connection_buffer_reserve(buffer, len);
+    memcpy(buffer->data + buffer->end, muxin->data + muxin->start, len);
+    buffer->end += len;
+    muxin->start += len;
+    if (muxin->start == muxin->end)
+	muxin->start = muxin->complete = muxin->ready = muxin->end = 0;
+
+    /* the multiplexed connection may wait for the space */
+    if (conn->mux && conn->mux->is_mux_full && muxin->end - muxin->start < muxin->maxsize)
+	connection_schedule(conn->mux);
+
+    return len;
+}
+
+
+/* pass complete records of this request to the multiplexed connection.
+ * returns like connection_endpoint_write()
+ */
+static int connection_mux_write(struct connection_endpoint_s *endpoint, const char *data, int len)
+{
+    struct connection_s *mux = endpoint->conn->mux;
+    if ( !mux )
+    {
+	errno = EPIPE;
+	return -1;
+    }
+
+    struct connection_buffer_s *out = &mux->toweb;
+    if (out->end - out->start >= out->maxsize)
+    {
+	/* the web server does not keep up, wait for the multiplexed
+	 * connection to write */
+	errno = EAGAIN;
+	endpoint->can_write = 0;
+	return -1;
+    }
+
+    connection_buffer_reserve(out, len);
+    memcpy(out->data + out->end, data, len);
+    out->end += len;
+    out->complete = out->ready = out->end;
+    connection_schedule(mux);
+
+    return len;
+}
+
+
+/* read from the endpoint into the buffer. Read maxlen bytes at most, or
+ * fill the free space of the buffer if maxlen is 0.
+ * returns the bytes read, 0 on end of file or -1 on error. If the endpoint
+ * has no data available, return -1 with errno EAGAIN and reset the read flag.
+ */
+static int connection_buffer_read(struct connection_endpoint_s *endpoint, struct connection_buffer_s *buffer, int maxlen)
+{
+    if (endpoint->is_virtual)
+	return connection_mux_read(endpoint, buffer, maxlen);
+
+    if ( !buffer->readsize )
+	buffer->readsize = DEFAULT_BUFFER_SIZE;
+    if ( !maxlen )
+	maxlen = buffer->readsize;
+    connection_buffer_reserve(buffer, maxlen);
+
+    int len = min(buffer->size - buffer->end, maxlen);
+    int readbytes = read(endpoint->fd, buffer->data + buffer->end, len);
+    debug(1, "read %d from fd %d", readbytes, endpoint->fd);
+    if (-1 == readbytes)
+    {
+	if (EAGAIN == errno || EWOULDBLOCK == errno)
+	{
+	    errno = EAGAIN;
+	    endpoint->can_read = 0;
+	}
+	else if (EINTR == errno)
+	{
+	    errno = EAGAIN;
+	}
+    }
+    else
+    {
+	buffer->end += readbytes;
+
+	/* the data keeps streaming, read more at once next time */
+	if (readbytes == buffer->readsize && buffer->readsize < buffer->maxsize)
+	    buffer->readsize = min(2*buffer->readsize, buffer->maxsize);
+    }
+
+    return readbytes;
+}
+
+
+/* write data to the endpoint.
+ * returns the bytes written or -1 on error. If the endpoint can not take
+ * more data, return -1 with errno EAGAIN and reset the write flag.
+ */
+static int connection_endpoint_write(struct connection_endpoint_s *endpoint, const char *data, int len)
+{
+    if (endpoint->is_virtual)
+	return connection_mux_write(endpoint, data, len);
+
+    int writebytes = write(endpoint->fd, data, len);
+    debug(1, "wrote %d to fd %d", writebytes, endpoint->fd);
+    if (-1 == writebytes)
+    {
+	if (EAGAIN == errno || EWOULDBLOCK == errno)
+	{
+	    errno = EAGAIN;
+	    endpoint->can_write = 0;
+	}
+	else if (EINTR == errno)
+	{
+	    errno = EAGAIN;
+	}
+    }
+    else if (writebytes < len)
+    {
+	endpoint->can_write = 0;
+    }
+
+    return writebytes;
+}
+
+
+/* returns the end of the data which can be send to the endpoint */
+static int connection_buffer_get_sendable(const struct connection_buffer_s *buffer, const struct connection_endpoint_s *endpoint)
+{
+    return endpoint->is_virtual ? buffer->complete : buffer->ready;
+}
+
+
+/* write the ready data of the buffer to the endpoint */
+static int connection_buffer_write(struct connection_endpoint_s *endpoint, struct connection_buffer_s *buffer)
+{
+    int writebytes = connection_endpoint_write(endpoint, buffer->data + buffer->start, connection_buffer_get_sendable(buffer, endpoint) - buffer->start);
+    if (writebytes > 0)
+    {
+	buffer->start += writebytes;
+	if (buffer->start == buffer->end)
+	    buffer->start = buffer->complete = buffer->ready = buffer->end = 0;
+    }
+
+    return writebytes;
+}
+
+
+/* returns true if the buffer or the pipe has data to send to the endpoint */
+static int connection_relay_has_data(const struct connection_buffer_s *buffer, const struct connection_pipe_s *pipe, const struct connection_endpoint_s *endpoint)
+{
+    return pipe->len > 0 || connection_buffer_get_sendable(buffer, endpoint) > buffer->start;
+}
+
+
+static void connection_pipe_init(struct connection_pipe_s *pipe)
+{
+    pipe->fd[0] = -1;
+    pipe->fd[1] = -1;
+    pipe->len = 0;
+}
+
+
+static void connection_pipe_close(struct connection_pipe_s *pipe)
+{
+    if (-1 != pipe->fd[0])
+    {
+	close(pipe->fd[0]);
+	close(pipe->fd[1]);
+    }
+    connection_pipe_init(pipe);
+}
+
+
+/* move at most the remaining record content from the endpoint into the
+ * pipe. The pipe is opened on first use.
+ * returns like connection_buffer_read()
+ */
+static int connection_pipe_read(struct connection_endpoint_s *endpoint, struct connection_pipe_s *pipe, struct connection_framer_s *framer)
+{
+    if (-1 == pipe->fd[0])
+    {
+	int retval = pipe2(pipe->fd, O_NONBLOCK|O_CLOEXEC);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: can not create pipe");
+	    connection_pipe_init(pipe);
+	    return -1;
+	}
+    }
+
+    int len = min(framer->remaining, MAX_SPLICE_SIZE);
+    int splicebytes = splice(endpoint->fd, NULL, pipe->fd[1], NULL, len, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    debug(1, "spliced %d from fd %d", splicebytes, endpoint->fd);
+    if (-1 == splicebytes)
+    {
+	/* the pipe is empty, so EAGAIN refers to the socket */
+	if (EAGAIN == errno || EWOULDBLOCK == errno)
+	{
+	    errno = EAGAIN;
+	    endpoint->can_read = 0;
+	}
+	else if (EINTR == errno)
+	{
+	    errno = EAGAIN;
+	}
+    }
+    else
+    {
+	pipe->len += splicebytes;
+	framer->remaining -= splicebytes;
+    }
+
+    return splicebytes;
+}
+
+
+/* move the data of the pipe to the endpoint.
+ * returns like connection_endpoint_write()
+ */
+static int connection_pipe_write(struct connection_endpoint_s *endpoint, struct connection_pipe_s *pipe)
+{
+    int splicebytes = splice(pipe->fd[0], NULL, endpoint->fd, NULL, pipe->len, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    debug(1, "spliced %d to fd %d", splicebytes, endpoint->fd);
+    if (-1 == splicebytes)
+    {
+	if (EAGAIN == errno || EWOULDBLOCK == errno)
+	{
+	    errno = EAGAIN;
+	    endpoint->can_write = 0;
+	}
+	else if (EINTR == errno)
+	{
+	    errno = EAGAIN;
+	}
+    }
+    else
+    {
+	pipe->len -= splicebytes;
+    }
+
+    return splicebytes;
+}
+
+
+static void connection_endpoint_register(struct connection_s *conn, struct connection_endpoint_s *endpoint)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = endpoint;
+
+    int retval = epoll_ctl(conn->worker->epollfd, EPOLL_CTL_ADD, endpoint->fd, &event);
+    if (-1 == retval)
+    {
+	logerror("ERROR: adding fd %d to epoll fd %d", endpoint->fd, conn->worker->epollfd);
+	qexit(EXIT_FAILURE);
+    }
+    endpoint->is_registered = 1;
+}
+
+
+/* the buffers of the connection take their memory from the pool of the
+ * worker. They grow up to the configured size, limited by the buffer size of
+ * the network socket.
+ */
+static void connection_attach_buffers(struct connection_s *conn, struct connection_pool_s *pool)
+{
+    int maxsize = max(DEFAULT_BUFFER_SIZE, min(max_buffer_size, connection_manager_get_network_buffer_size()));
+
+    conn->inbuf.pool = pool;
+    conn->inbuf.maxsize = maxsize;
+    conn->tochild.pool = pool;
+    conn->tochild.maxsize = maxsize;
+    conn->toweb.pool = pool;
+    conn->toweb.maxsize = maxsize;
+    conn->muxin.pool = pool;
+    conn->muxin.maxsize = maxsize;
+    conn->toweb_answers.pool = pool;
+    conn->toweb_answers.maxsize = maxsize;
+}
+
+
+static void connection_endpoint_unregister(struct connection_s *conn, struct connection_endpoint_s *endpoint)
+{
+    int retval = epoll_ctl(conn->worker->epollfd, EPOLL_CTL_DEL, endpoint->fd, NULL);
+    if (-1 == retval)
+    {
+	logerror("ERROR: removing fd %d from epoll fd %d", endpoint->fd, conn->worker->epollfd);
+	qexit(EXIT_FAILURE);
+    }
+    endpoint->is_registered = 0;
+}
+
+
+static void connection_endpoint_close(struct connection_endpoint_s *endpoint)
+{
+    if (-1 != endpoint->fd)
+    {
+	/* note: close() does not remove the file descriptor from the epoll
+	 * set if a forked child process still holds a copy of it */
+	if (endpoint->is_registered)
+	    connection_endpoint_unregister(endpoint->conn, endpoint);
+	int retval = close(endpoint->fd);
+	debug(1, "closed fd %d, retval %d, errno %d", endpoint->fd, retval, errno);
+	endpoint->fd = -1;
+    }
+    endpoint->can_read = 0;
+    endpoint->can_write = 0;
+}
+
+
+static void connection_set_timer(struct connection_s *conn, int milliseconds)
+{
+    struct timespec timeradd = { tv_sec: milliseconds/1000, tv_nsec: (milliseconds%1000)*1000*1000 };
+    int retval = qgis_timer_start(&conn->timer);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    qgis_timer_add(&conn->timer, &timeradd);
+
+    if ( !conn->has_timer )
+    {
+	TAILQ_INSERT_TAIL(&conn->worker->timerlist, conn, timer_entries);
+	conn->has_timer = 1;
+    }
+}
+
+
+static void connection_clear_timer(struct connection_s *conn)
+{
+    if (conn->has_timer)
+    {
+	TAILQ_REMOVE(&conn->worker->timerlist, conn, timer_entries);
+	conn->has_timer = 0;
+    }
+}
+
+
+static struct connection_s *connection_new(int netfd, const char *hostname)
+{
+    struct connection_s *conn = calloc(1, sizeof(*conn));
+    assert(conn);
+    if ( !conn )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    int retval = qgis_timer_start(&conn->starttime);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+
+    /* the accepted socket blocks, but the worker must not */
+    if (-1 != netfd)
+    {
+	int flags = fcntl(netfd, F_GETFL, 0);
+	if (-1 == flags || -1 == fcntl(netfd, F_SETFL, flags | O_NONBLOCK))
+	{
+	    logerror("ERROR: fcntl(%d, F_SETFL, O_NONBLOCK)", netfd);
+	    qexit(EXIT_FAILURE);
+	}
+    }
+
+    conn->state = CONNECTION_STATE_READ_PARAMS;
+    conn->web.conn = conn;
+    conn->web.fd = netfd;
+    conn->web.is_virtual = (-1 == netfd);
+    conn->use_splice = use_splice && !conn->web.is_virtual;
+    conn->child.conn = conn;
+    conn->child.fd = -1;
+    connection_pipe_init(&conn->tochild_pipe);
+    connection_pipe_init(&conn->toweb_pipe);
+    if (hostname)
+    {
+	conn->hostname = strdup(hostname);
+	assert(conn->hostname);
+	if ( !conn->hostname )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+    }
+    conn->session = fcgi_session_new(0);
+    conn->datalist = fcgi_data_list_new();
+    conn->pid = -1;
+    conn->failed_pid = -1;
+    TAILQ_INIT(&conn->muxlist);
+
+    return conn;
+}
+
+
+static void connection_delete(struct connection_s *conn)
+{
+    if (conn)
+    {
+	assert(-1 == conn->web.fd);
+	assert(-1 == conn->child.fd);
+	fcgi_session_delete(conn->session);
+	fcgi_data_list_delete(conn->datalist);
+	connection_buffer_free(&conn->inbuf);
+	connection_buffer_free(&conn->tochild);
+	connection_buffer_free(&conn->toweb);
+	connection_buffer_free(&conn->muxin);
+	connection_buffer_free(&conn->toweb_answers);
+	connection_pipe_close(&conn->tochild_pipe);
+	connection_pipe_close(&conn->toweb_pipe);
+	free(conn->hostname);
+	free(conn);
+    }
+}
+
+
+/* the child process has answered the request and keeps the connection open.
+ * Store the connection in the process entry for the next request and give
+ * the process back to the process list.
+ */
+static void connection_park_process(struct connection_s *conn)
+{
+    assert(0 < conn->pid);
+
+    connection_endpoint_unregister(conn, &conn->child);
+    int retval = db_process_store_client_socket(conn->pid, conn->child.fd, conn->child_bufsize);
+    if (-1 == retval)
+	connection_endpoint_close(&conn->child);
+    conn->child.fd = -1;
+    conn->child.can_read = 0;
+    conn->child.can_write = 0;
+
+    db_process_set_state_idle(conn->pid);
+    conn->pid = -1;
+}
+
+
+/* close the connection to the child process and give the process back to
+ * the process list.
+ */
+static void connection_release_failed_process(struct connection_s *conn)
+{
+    if (0 < conn->failed_pid)
+    {
+	db_process_set_state_idle(conn->failed_pid);
+	conn->failed_pid = -1;
+    }
+}
+
+
+static void connection_release_process(struct connection_s *conn)
+{
+    connection_endpoint_close(&conn->child);
+    if (0 < conn->pid)
+    {
+	db_process_set_state_idle(conn->pid);
+	conn->pid = -1;
+    }
+    connection_release_failed_process(conn);
+}
+
+
+/* called by the admission queue from any thread, if a process has been
+ * handed to the connection. It is taken with the next try to acquire.
+ */
+static void connection_admission_notify(void *arg)
+{
+    struct connection_s *conn = arg;
+
+    __sync_lock_test_and_set(&conn->is_admission_notified, 1);
+    connection_worker_wakeup(conn->worker);
+}
+
+
+static void connection_leave_admission_queue(struct connection_s *conn)
+{
+    if (conn->is_waiting)
+    {
+	admission_queue_cancel(&conn->waiter);
+	TAILQ_REMOVE(&conn->worker->waitlist, conn, wait_entries);
+	conn->is_waiting = 0;
+	connection_clear_timer(conn);
+    }
+}
+
+
+/* detach the request from its multiplexed web connection, or all requests
+ * from the closed multiplexed web connection. The requests read end of file
+ * then.
+ */
+static void connection_mux_detach(struct connection_s *conn)
+{
+    if (conn->mux)
+    {
+	TAILQ_REMOVE(&conn->mux->muxlist, conn, mux_entries);
+	conn->mux->num_mux--;
+	/* the multiplexed connection may wait for the space of this request */
+	if (conn->mux->is_mux_full)
+	    connection_schedule(conn->mux);
+	conn->mux = NULL;
+    }
+
+    struct connection_s *request;
+    while ((request = TAILQ_FIRST(&conn->muxlist)) != NULL)
+    {
+	TAILQ_REMOVE(&conn->muxlist, request, mux_entries);
+	conn->num_mux--;
+	request->mux = NULL;
+	request->web.can_read = 1;
+	request->web.can_write = 1;
+	connection_schedule(request);
+    }
+}
+
+
+/* log the time of the request and add it to the statistics */
+static void connection_add_statistic(struct connection_s *conn)
+{
+    struct timespec ts = conn->starttime;
+    int retval = qgis_timer_stop(&ts);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    printlog("[%lu] done connection, %ld.%03ld sec", pthread_self(), ts.tv_sec, ts.tv_nsec/(1000*1000));
+    statistic_add_connection(&ts);
+    statistic_add_relay(conn->copied_bytes, conn->spliced_bytes, conn->syscalls);
+}
+
+
+/* learn the time the process needed for the request */
+static void connection_add_service_time(struct connection_s *conn)
+{
+    struct timespec ts = conn->relay_start;
+    int retval = qgis_timer_stop(&ts);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    long long int usec = (long long int)ts.tv_sec*1000*1000 + ts.tv_nsec/1000;
+    service_time_add(conn->projname, conn->signature, usec);
+    if (conn->affinity_key)
+	statistic_add_affinity(conn->waiter.is_affinity_hit, usec);
+}
+
+
+static void connection_finish(struct connection_s *conn)
+{
+    struct connection_worker_s *worker = conn->worker;
+
+    connection_leave_admission_queue(conn);
+    connection_clear_timer(conn);
+    connection_unschedule(conn);
+    connection_release_process(conn);
+    connection_mux_detach(conn);
+    connection_endpoint_close(&conn->web);
+
+    /* a kept connection closed by the web server has no request left */
+    if (conn->has_begin_request || 0 == conn->num_requests)
+	connection_add_statistic(conn);
+
+    /* the connection may be referenced by further events of this epoll
+     * round, so delete it later */
+    conn->state = CONNECTION_STATE_DONE;
+    TAILQ_REMOVE(&worker->activelist, conn, entries);
+    TAILQ_INSERT_TAIL(&worker->closedlist, conn, entries);
+}
+
+
+/* the web server keeps the connection open after the request. Forget the
+ * finished request and wait for the next begin request on the connection.
+ * This saves the web server the connect() and the scheduler the accept()
+ * for the next request.
+ * Nothing of the finished request may reach the next child process: the
+ * pipe and the framers start empty.
+ */
+static void connection_next_request(struct connection_s *conn)
+{
+    connection_clear_timer(conn);
+    connection_release_process(conn);
+    connection_add_statistic(conn);
+
+    fcgi_session_delete(conn->session);
+    conn->session = fcgi_session_new(0);
+    fcgi_data_list_delete(conn->datalist);
+    conn->datalist = fcgi_data_list_new();
+    conn->has_begin_request = 0;
+    conn->requestId = 0;
+    conn->keep_conn = 0;
+    conn->projname = NULL;
+    conn->has_acquire_started = 0;
+    conn->connect_retries = 0;
+    conn->has_connect_started = 0;
+    conn->connect_failovers = 0;
+    conn->connect_retries_total = 0;
+    conn->child_retries = 0;
+    conn->is_child_kept = 0;
+    conn->child_requestId = 0;
+    conn->child_bufsize = 0;
+    conn->copied_bytes = 0;
+    conn->spliced_bytes = 0;
+    conn->syscalls = 0;
+    memset(&conn->tochild_framer, 0, sizeof(conn->tochild_framer));
+    memset(&conn->toweb_framer, 0, sizeof(conn->toweb_framer));
+    if (conn->tochild_pipe.len > 0)
+	connection_pipe_close(&conn->tochild_pipe);
+    if (conn->toweb_pipe.len > 0)
+	connection_pipe_close(&conn->toweb_pipe);
+
+    /* the buffer sizes have been limited by the last child process */
+    struct connection_pool_s *pool = conn->inbuf.pool;
+    connection_buffer_free(&conn->inbuf);
+    connection_buffer_free(&conn->tochild);
+    connection_buffer_free(&conn->toweb);
+    connection_buffer_free(&conn->toweb_answers);
+    connection_attach_buffers(conn, pool);
+
+    int retval = qgis_timer_start(&conn->starttime);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+
+    conn->num_requests++;
+    conn->state = CONNECTION_STATE_READ_PARAMS;
+}
+
+
+/* returns true if the data to the web server ends between two records of
+ * the child process, so a record of the scheduler can follow. A multiplexed
+ * connection gets complete records only.
+ */
+static int connection_toweb_is_record_boundary(const struct connection_s *conn)
+{
+    return conn->web.is_virtual || (0 == conn->toweb_framer.remaining && 0 == conn->toweb_pipe.len);
+}
+
+
+/* move the answers of the scheduler into the buffer to the web server. They
+ * are put behind the complete records only, an incomplete record header
+ * moves behind the answers.
+ */
+static void connection_pass_answers(struct connection_s *conn)
+{
+    struct connection_buffer_s *answers = &conn->toweb_answers;
+    struct connection_buffer_s *buffer = &conn->toweb;
+    if (connection_buffer_is_empty(answers) || !connection_toweb_is_record_boundary(conn))
+	return;
+
+    int len = answers->end - answers->start;
+    connection_buffer_reserve(buffer, len);
+    char *pos = buffer->data + buffer->complete;
+    memmove(pos + len, pos, buffer->end - buffer->complete);
+    memcpy(pos, answers->data + answers->start, len);
+    buffer->complete += len;
+    buffer->ready += len;
+    buffer->end += len;
+    connection_buffer_free(answers);
+}
+
+
+/* send an overload message to the web server and close the connection
+ * after the message has been written.
+ * If a record of the child process has been passed to the web server in
+ * parts, the message would end up inside of it. Close the connection
+ * without the message then.
+ */
+static void connection_abort(struct connection_s *conn)
+{
+    connection_clear_timer(conn);
+    connection_release_process(conn);
+
+    if (conn->has_begin_request)
+    {
+	if ( !connection_toweb_is_record_boundary(conn) )
+	{
+	    printlog("[%lu] Answer of the child process for %s is incomplete, close connection", pthread_self(), conn->hostname);
+	    connection_finish(conn);
+	    return;
+	}
+
+	/* drop an incomplete record header, then append the message.
+	 * A multiplexed connection has not yet seen the incomplete record.
+	 */
+	conn->toweb.end = connection_buffer_get_sendable(&conn->toweb, &conn->web);
+	conn->toweb.ready = conn->toweb.end;
+	connection_buffer_append_endrequest(&conn->toweb, conn->requestId, FCGI_OVERLOADED);
+    }
+
+    /* the web server may still send data of the aborted request */
+    conn->keep_conn = 0;
+    conn->state = CONNECTION_STATE_FLUSH;
+}
+
+
+/* the child process failed. Try again with another process or give up
+ * after MAX_CHILD_COMMUNICATION_RETRY attempts.
+ */
+static void connection_retry_process(struct connection_s *conn)
+{
+    connection_clear_timer(conn);
+    connection_endpoint_close(&conn->child);
+    conn->pid = -1;
+
+    conn->child_retries++;
+    if (MAX_CHILD_COMMUNICATION_RETRY <= conn->child_retries)
+    {
+	connection_abort(conn);
+    }
+    else
+    {
+	conn->has_acquire_started = 0;
+	conn->state = CONNECTION_STATE_ACQUIRE;
+    }
+}
+
+
+/* parse the complete fcgi records in the input buffer.
+ * The records are copied into the data list to be send to the child process
+ * later on. The session parser gets the records without padding.
+ */
+static void connection_parse_records(struct connection_s *conn)
+{
+    struct connection_buffer_s *inbuf = &conn->inbuf;
+
+    while (inbuf->start < inbuf->end)
+    {
+	/* the connection of a project listener is routed after the begin
+	 * request, the parameters are passed to the child process unparsed */
+	if (conn->listen_projname && conn->has_begin_request)
+	    break;
+
+	char *record = inbuf->data + inbuf->start;
+	int len = inbuf->end - inbuf->start;
+	int type, requestId, contentLength;
+	int recordlen = fcgi_record_get_header(record, len, &type, &requestId, &contentLength);
+	if (0 == recordlen || recordlen > len)
+	    break;	// wait for the complete record
+
+	if (0 == requestId || (conn->has_begin_request && requestId != conn->requestId))
+	{
+	    /* management record or a second request on a not multiplexed
+	     * connection, do not pass to the child process */
+	    connection_answer_foreign_record(&conn->toweb, record, recordlen);
+	}
+	else if ( !conn->has_begin_request && FCGI_BEGIN_REQUEST != type )
+	{
+	    /* a record of the last request on a kept connection, or of no request */
+	    debug(1, "ignore record type %d of request id %d before the begin request", type, requestId);
+	}
+	else
+	{
+	    switch (type)
+	    {
+	    case FCGI_BEGIN_REQUEST:
+	    {
+		/* set the connection flag FCGI_KEEP_CONN for the child
+		 * process. This way the child process keeps the unix socket
+		 * open after the work is done, and the next request can use it.
+		 */
+		int flag = fcgi_record_get_flag(record, recordlen);
+		conn->keep_conn = flag >= 0 && (flag & FCGI_KEEP_CONN) && !conn->web.is_virtual;
+		if (flag >= 0 && !(flag & FCGI_KEEP_CONN))
+		    fcgi_record_set_flag(record, recordlen, flag | FCGI_KEEP_CONN);
+		conn->has_begin_request = 1;
+		conn->requestId = requestId;
+	    }
+		// fall through
+	    case FCGI_ABORT_REQUEST:
+	    case FCGI_PARAMS:
+	    case FCGI_STDIN:
+	    case FCGI_DATA:
+		fcgi_session_parse(conn->session, record, sizeof(FCGI_Header) + contentLength);
+		fcgi_data_add_data(conn->datalist, record, recordlen);
+		break;
+
+	    default:
+		debug(1, "ignore unknown record type %d", type);
+		break;
+	    }
+	}
+
+	inbuf->start += recordlen;
+    }
+}
+
+
+static void connection_read_params(struct connection_s *conn)
+{
+    while (conn->web.can_read)
+    {
+	int readbytes = connection_buffer_read(&conn->web, &conn->inbuf, 0);
+	if (-1 == readbytes)
+	{
+	    if (EAGAIN == errno)
+		break;
+	    logerror("WARNING: reading from network socket");
+	    connection_finish(conn);
+	    return;
+	}
+	else if (0 == readbytes)
+	{
+	    /* end of file received */
+	    connection_finish(conn);
+	    return;
+	}
+#ifdef PRINT_NETWORK_DATA
+	debug(1, "network data:");
+	fwrite(conn->inbuf.data + conn->inbuf.end - readbytes, 1, readbytes, stderr);
+#endif
+
+	connection_parse_records(conn);
+
+	/* find the project as soon as the parameters the routing looks at have
+	 * arrived. The process is acquired and connected while the web server
+	 * still sends the rest of the request, the relay passes it on.
+	 */
+	enum fcgi_session_state_e session_state = fcgi_session_get_state(conn->session);
+	int is_params_done = FCGI_SESSION_STATE_PARAMS_DONE == session_state || FCGI_SESSION_STATE_END == session_state;
+	int is_listener = conn->listen_projname && conn->has_begin_request;
+	int is_early = !is_listener && !is_params_done && FCGI_SESSION_STATE_RUNNING == session_state
+		&& conn->has_begin_request && connection_manager_can_get_project(conn->session);
+	if (is_listener || is_params_done || is_early)
+	{
+	    if ( !conn->has_begin_request )
+	    {
+		printlog("[%lu] WARNING: no begin request received from %s, close connection", pthread_self(), conn->hostname);
+		connection_finish(conn);
+		return;
+	    }
+
+	    service_time_get_signature(conn->session, conn->signature, sizeof(conn->signature));
+	    if (is_listener)
+	    {
+		conn->projname = conn->listen_projname;
+		debug(1, "found project '%s' by the listener", conn->projname);
+		statistic_add_route_listener();
+	    }
+	    else
+	    {
+		conn->projname = connection_manager_get_project(conn->session);
+		debug(1, "found project '%s' in query string%s", conn->projname, is_early ? " before the end of the parameters" : "");
+		statistic_add_route(is_early);
+	    }
+	    if (conn->projname && FCGI_RESPONDER != fcgi_session_get_role(conn->session))
+	    {
+		/* invalidate project name, later answer with abort request */
+		conn->projname = NULL;
+	    }
+	    conn->affinity_key = 0;
+	    if (conn->projname && config_get_affinity(conn->projname))
+		conn->affinity_key = affinity_get_key(conn->session);
+
+	    /* keep the not yet complete record for the child process */
+	    if ( !connection_buffer_is_empty(&conn->inbuf) )
+		fcgi_data_add_data(conn->datalist, conn->inbuf.data + conn->inbuf.start, conn->inbuf.end - conn->inbuf.start);
+	    connection_buffer_free(&conn->inbuf);
+	    fcgi_session_delete(conn->session);
+	    conn->session = NULL;
+
+	    conn->state = CONNECTION_STATE_ACQUIRE;
+	    return;
+	}
+    }
+
+    /* send the answers to management records */
+    if (conn->web.can_write && connection_relay_has_data(&conn->toweb, &conn->toweb_pipe, &conn->web))
+    {
+	if (-1 == connection_buffer_write(&conn->web, &conn->toweb) && EAGAIN != errno)
+	{
+	    logerror("WARNING: writing to network socket");
+	    connection_finish(conn);
+	}
+    }
+}
+
+
+/* copy the stored request into the buffer to the child process. The request
+ * gets a new request id, the child process may have seen the id of the web
+ * server on this connection before.
+ */
+static void connection_start_relay(struct connection_s *conn)
+{
+    struct fcgi_data_list_iterator_s *iterator = fcgi_data_get_iterator(conn->datalist);
+    while (fcgi_data_iterator_has_data(iterator))
+    {
+	const struct fcgi_data_s *data = fcgi_data_get_next_data(&iterator);
+	int datalen = fcgi_data_get_datalen(data);
+	connection_buffer_reserve(&conn->tochild, datalen);
+	memcpy(conn->tochild.data + conn->tochild.end, fcgi_data_get_data(data), datalen);
+	conn->tochild.end += datalen;
+    }
+
+    /* the buffer size of the child socket is read once per connection, the
+     * connection is kept for the next requests */
+    if ( !conn->child_bufsize )
+    {
+	conn->child_bufsize = connection_manager_get_socket_buffer_size(conn->child.fd);
+	if (-1 == conn->child_bufsize)
+	    conn->child_bufsize = DEFAULT_BUFFER_SIZE;
+    }
+    conn->tochild.maxsize = min(conn->tochild.maxsize, conn->child_bufsize);
+    conn->toweb.maxsize = min(conn->toweb.maxsize, conn->child_bufsize);
+
+    conn->child_requestId = (__sync_fetch_and_add(&next_child_requestid, 1) % UINT16_MAX) + 1;
+    conn->has_relay_input = 0;
+    conn->has_relay_answer = 0;
+    memset(&conn->tochild_framer, 0, sizeof(conn->tochild_framer));
+    memset(&conn->toweb_framer, 0, sizeof(conn->toweb_framer));
+    connection_buffer_frame(&conn->tochild, &conn->tochild_framer, conn->child_requestId, conn);
+
+    int retval = qgis_timer_start(&conn->relay_start);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+
+    conn->state = CONNECTION_STATE_RELAY;
+}
+
+
+/* connect to the child process of the request. The time to connect
+ * includes the retries and the failovers.
+ */
+static void connection_start_connect(struct connection_s *conn)
+{
+    conn->is_child_kept = 0;
+    conn->connect_retries = 0;
+    conn->connect_backoff = MIN_CONNECT_BACKOFF;
+    if ( !conn->has_connect_started )
+    {
+	int retval = qgis_timer_start(&conn->connect_start);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	    qexit(EXIT_FAILURE);
+	}
+	conn->has_connect_started = 1;
+    }
+    conn->state = CONNECTION_STATE_CONNECT;
+}
+
+
+/* the child process closed the connection kept from the last request before
+ * it got this request. The request is sent again over a new connection to
+ * the process, if nothing has been answered yet and the input has not been
+ * relayed behind the stored request.
+ * returns 1 if the request is sent again, 0 if it has to be aborted.
+ */
+static int connection_reconnect_kept_process(struct connection_s *conn)
+{
+    if ( !conn->is_child_kept || conn->has_relay_input || conn->has_relay_answer )
+	return 0;
+
+    debug(1, "[%lu] kept connection %d to process %d has been closed, connect again", pthread_self(), conn->child.fd, conn->pid);
+    connection_endpoint_close(&conn->child);
+    connection_buffer_free(&conn->tochild);
+    conn->child_bufsize = 0;
+    connection_start_connect(conn);
+
+    return 1;
+}
+
+
+static void connection_acquire_process(struct connection_s *conn)
+{
+    if ( !conn->projname )
+    {
+	printlog("[%lu] Found no project for request from %s", pthread_self(), conn->hostname);
+	connection_abort(conn);
+	return;
+    }
+
+    if ( !conn->has_acquire_started )
+    {
+	int is_cold_start = connection_manager_check_idle_processes(conn->projname);
+	memset(&conn->waiter, 0, sizeof(conn->waiter));
+	conn->waiter.is_cold_start = is_cold_start;
+	conn->waiter.expected_usec = service_time_get_estimate(conn->projname, conn->signature);
+	conn->waiter.affinity_key = conn->affinity_key;
+	conn->waiter.notify = connection_admission_notify;
+	conn->waiter.arg = conn;
+	conn->has_acquire_started = 1;
+    }
+
+    pid_t pid = admission_queue_try_acquire(&conn->waiter, conn->projname);
+
+    /* the process which did not accept the connection is not taken twice.
+     * Give it back now, it may accept the next time.
+     */
+    connection_release_failed_process(conn);
+
+    if (ADMISSION_QUEUE_WAIT == pid)
+    {
+	/* wait for the notification of the queue or the timeout */
+	if ( !conn->is_waiting )
+	{
+	    TAILQ_INSERT_TAIL(&conn->worker->waitlist, conn, wait_entries);
+	    conn->is_waiting = 1;
+	}
+	if ( !conn->has_timer )
+	    connection_set_timer(conn, admission_queue_get_remaining_time(&conn->waiter));
+	return;
+    }
+
+    /* the queue has already removed the waiter */
+    if (conn->is_waiting)
+    {
+	TAILQ_REMOVE(&conn->worker->waitlist, conn, wait_entries);
+	conn->is_waiting = 0;
+	connection_clear_timer(conn);
+    }
+
+    if (pid < 0)
+    {
+	if (ADMISSION_QUEUE_FULL == pid)
+	    printlog("[%lu] Admission queue is full for network request from %s for project %s. Answer overload and close connection", pthread_self(), conn->hostname, conn->projname);
+	else
+	    printlog("[%lu] Found no free process for network request from %s for project %s. Answer overload and close connection", pthread_self(), conn->hostname, conn->projname);
+	connection_abort(conn);
+	return;
+    }
+
+    printlog("[%lu] Use process %d to handle request for %s, project %s", pthread_self(), pid, conn->hostname, conn->projname);
+    conn->pid = pid;
+
+    /* use the connection kept open from the last request. If the child
+     * process closed it in the meantime, connect again.
+     */
+    int fd = db_process_take_client_socket(pid, &conn->child_bufsize);
+    if (-1 != fd)
+    {
+	char c;
+	int retval = recv(fd, &c, 1, MSG_PEEK|MSG_DONTWAIT);
+	if (-1 == retval && (EAGAIN == errno || EWOULDBLOCK == errno))
+	{
+	    debug(1, "[%lu] reuse connection %d to process %d", pthread_self(), fd, pid);
+	    conn->is_child_kept = 1;
+	    conn->child.fd = fd;
+	    connection_endpoint_register(conn, &conn->child);
+	    conn->child.can_write = 1;
+	    connection_start_relay(conn);
+	    return;
+	}
+	debug(1, "[%lu] connection %d to process %d is stale, connect again", pthread_self(), fd, pid);
+	close(fd);
+    }
+
+    connection_start_connect(conn);
+}
+
+
+/* count the time from the first connect() of the request until a child
+ * process accepted, with all retries and failovers.
+ */
+static void connection_add_connect_statistic(struct connection_s *conn)
+{
+    struct timespec ts = conn->connect_start;
+    int retval = qgis_timer_stop(&ts);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    statistic_add_child_connect((long long int)ts.tv_sec*1000*1000 + ts.tv_nsec/1000, conn->connect_retries_total, conn->connect_failovers);
+}
+
+
+static void connection_connect_process(struct connection_s *conn)
+{
+    struct sockaddr_un sockaddr;
+    socklen_t sockaddrlen = sizeof(sockaddr);
+
+    /* get the address of the socket transferred to the child process,
+     * then connect to it.
+     */
+    int childunixsocketfd = db_get_process_socket(conn->pid);	// refers to the socket the child process accept()s from
+    if (-1 == childunixsocketfd)
+    {
+	printlog("[%lu] WARNING: DB returned socket '-1' for child process '%d'. Dump this and try again with next process", pthread_self(), conn->pid);
+	process_manager_restart_process(conn->pid);
+	connection_retry_process(conn);
+	return;
+    }
+    int retval = getsockname(childunixsocketfd, (struct sockaddr *)&sockaddr, &sockaddrlen);
+    if (-1 == retval)
+    {
+	logerror("[%lu] WARNING: retrieving the name of child process socket %d", pthread_self(), childunixsocketfd);
+	process_manager_restart_process(conn->pid);
+	connection_retry_process(conn);
+	return;
+    }
+
+    retval = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (-1 == retval)
+    {
+	logerror("[%lu] ERROR: can not create socket to child process", pthread_self());
+	db_process_set_state_idle(conn->pid);
+	connection_retry_process(conn);
+	return;
+    }
+    conn->child.fd = retval;
+
+    retval = connect(conn->child.fd, (struct sockaddr *)&sockaddr, sockaddrlen);
+    if (-1 == retval)
+    {
+	if (EAGAIN == errno)
+	{
+	    /* the child process has not yet accept()ed the last connection */
+	    connection_endpoint_close(&conn->child);
+	    conn->connect_retries++;
+	    conn->connect_retries_total++;
+	    if (MAX_CHILD_SOCKET_CONNECTION_RETRY > conn->connect_retries)
+	    {
+		debug(1, "can not connect to child process %d, %d. try, wait %d msec", conn->pid, conn->connect_retries, conn->connect_backoff);
+		connection_set_timer(conn, conn->connect_backoff);
+		conn->connect_backoff = min(2*conn->connect_backoff, MAX_CONNECT_BACKOFF);
+		return;
+	    }
+
+	    /* the process is alive but does not accept, take the next one */
+	    printlog("[%lu] WARNING: child process %d does not accept connections, try the next process", pthread_self(), conn->pid);
+	    conn->failed_pid = conn->pid;
+	    conn->pid = -1;
+	    conn->connect_failovers++;
+	    connection_retry_process(conn);
+	    return;
+	}
+	else if (EINPROGRESS == errno)
+	{
+	    connection_endpoint_register(conn, &conn->child);
+	    conn->state = CONNECTION_STATE_CONNECTING;
+	    return;
+	}
+
+	logerror("ERROR: can not connect to child process");
+	process_manager_restart_process(conn->pid);
+	connection_retry_process(conn);
+	return;
+    }
+
+    connection_endpoint_register(conn, &conn->child);
+    conn->child.can_write = 1;
+    connection_add_connect_statistic(conn);
+    connection_start_relay(conn);
+}
+
+
+static void connection_check_connected(struct connection_s *conn)
+{
+    if ( !conn->child.can_write )
+	return;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    int retval = getsockopt(conn->child.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (-1 == retval || error)
+    {
+	if ( !retval )
+	    errno = error;
+	logerror("ERROR: can not connect to child process");
+	process_manager_restart_process(conn->pid);
+	connection_retry_process(conn);
+	return;
+    }
+
+    connection_add_connect_statistic(conn);
+    connection_start_relay(conn);
+}
+
+
+/* read the next part of the fcgi records from the endpoint. With splice
+ * enabled the record headers are read into the buffer one by one, and the
+ * content of large records is moved into the pipe. Small records are copied
+ * through the buffer.
+ * Data is read only if the buffer and the pipe have no data to send.
+ * returns like connection_buffer_read(). *is_end_request is set to 1 if an
+ * FCGI_END_REQUEST record has been completed.
+ */
+static int connection_relay_read(struct connection_endpoint_s *endpoint, struct connection_buffer_s *buffer, struct connection_pipe_s *pipe, struct connection_framer_s *framer, int requestId, int *is_end_request)
+{
+    *is_end_request = 0;
+
+    endpoint->conn->syscalls++;
+
+    int splice = endpoint->conn->use_splice;
+    if (splice && connection_buffer_is_empty(buffer) && framer->remaining >= MIN_SPLICE_SIZE)
+	return connection_pipe_read(endpoint, pipe, framer);
+
+    /* read up to the next record header, or the rest of a held record */
+    int maxlen = 0;
+    if (splice && 0 == framer->remaining)
+	maxlen = (framer->held ? framer->held : (int)sizeof(FCGI_Header)) - (buffer->end - buffer->ready);
+
+    /* the records of the web server may be answered by the scheduler */
+    struct connection_s *web_conn = NULL;
+    if (endpoint == &endpoint->conn->web)
+	web_conn = endpoint->conn;
+
+    int retval = connection_buffer_read(endpoint, buffer, maxlen);
+    if (retval > 0)
+    {
+#ifdef PRINT_SOCKET_DATA
+	debug(1, "fcgi data:");
+	fwrite(buffer->data + buffer->end - retval, 1, retval, stderr);
+#endif
+	*is_end_request = connection_buffer_frame(buffer, framer, requestId, web_conn);
+    }
+
+    return retval;
+}
+
+
+/* write the data of the buffer or the pipe to the endpoint. Only one of
+ * them has data to send at a time.
+ * returns like connection_endpoint_write()
+ */
+static int connection_relay_write(struct connection_s *conn, struct connection_endpoint_s *endpoint, struct connection_buffer_s *buffer, struct connection_pipe_s *pipe)
+{
+    int retval;
+
+    conn->syscalls++;
+    if (pipe->len > 0)
+    {
+	retval = connection_pipe_write(endpoint, pipe);
+	if (retval > 0)
+	    conn->spliced_bytes += retval;
+    }
+    else
+    {
+	retval = connection_buffer_write(endpoint, buffer);
+	if (retval > 0)
+	    conn->copied_bytes += retval;
+    }
+
+    return retval;
+}
+
+
+/* transfer the data between web server and child process.
+ * The request ids of the records are exchanged on the way. After the child
+ * process has send the end request record the connection to the child
+ * process is kept open for the next request.
+ * returns 1 if some data has been transferred, 0 otherwise.
+ */
+static int connection_relay(struct connection_s *conn)
+{
+    int has_progress = 0;
+    int is_end_request;
+    int retval;
+
+    /* web server -> child process */
+    if (conn->child.can_write && connection_relay_has_data(&conn->tochild, &conn->tochild_pipe, &conn->child))
+    {
+	retval = connection_relay_write(conn, &conn->child, &conn->tochild, &conn->tochild_pipe);
+	if (-1 == retval)
+	{
+	    if (EAGAIN != errno)
+	    {
+		if ((ECONNRESET == errno || EPIPE == errno) && connection_reconnect_kept_process(conn))
+		    return 1;
+		if (ECONNRESET == errno || EPIPE == errno)
+		    logerror("WARNING: connection reset by child socket, closing connection");
+		else
+		    logerror("ERROR: writing to child process socket");
+		connection_abort(conn);
+		return 1;
+	    }
+	}
+	else if (retval > 0)
+	{
+	    has_progress = 1;
+	}
+    }
+
+    if ( !connection_relay_has_data(&conn->tochild, &conn->tochild_pipe, &conn->child) && conn->web.can_read )
+    {
+	retval = connection_relay_read(&conn->web, &conn->tochild, &conn->tochild_pipe, &conn->tochild_framer, conn->child_requestId, &is_end_request);
+	if (-1 == retval)
+	{
+	    if (EAGAIN != errno)
+	    {
+		logerror("ERROR: reading from network socket (%d)", errno);
+		connection_finish(conn);
+		return 1;
+	    }
+	}
+	else if (0 == retval)
+	{
+	    /* end of file received */
+	    connection_finish(conn);
+	    return 1;
+	}
+	else
+	{
+	    conn->has_relay_input = 1;
+	    has_progress = 1;
+	}
+    }
+
+    /* child process -> web server */
+    if ( !connection_relay_has_data(&conn->toweb, &conn->toweb_pipe, &conn->web) && conn->child.can_read )
+    {
+	retval = connection_relay_read(&conn->child, &conn->toweb, &conn->toweb_pipe, &conn->toweb_framer, conn->requestId, &is_end_request);
+	if (-1 == retval)
+	{
+	    if (EAGAIN != errno)
+	    {
+		if (ECONNRESET == errno && connection_reconnect_kept_process(conn))
+		    return 1;
+		if (ECONNRESET == errno)
+		    logerror("WARNING: connection reset by child socket, closing connection");
+		else
+		    logerror("ERROR: reading from child process socket");
+		connection_abort(conn);
+		return 1;
+	    }
+	}
+	else if (0 == retval)
+	{
+	    if (connection_reconnect_kept_process(conn))
+		return 1;
+
+	    /* the child process closed the connection without keeping it.
+	     * The answer may be incomplete, close the web connection as well.
+	     */
+	    connection_release_process(conn);
+	    conn->keep_conn = 0;
+	    conn->state = CONNECTION_STATE_FLUSH;
+	    return 1;
+	}
+	else
+	{
+	    conn->has_relay_answer = 1;
+	    if (is_end_request)
+	    {
+		/* the child process has done its work */
+		connection_add_service_time(conn);
+		connection_park_process(conn);
+		conn->state = CONNECTION_STATE_FLUSH;
+		return 1;
+	    }
+	    has_progress = 1;
+	}
+    }
+
+    connection_pass_answers(conn);
+    if (conn->web.can_write && connection_relay_has_data(&conn->toweb, &conn->toweb_pipe, &conn->web))
+    {
+	retval = connection_relay_write(conn, &conn->web, &conn->toweb, &conn->toweb_pipe);
+	if (-1 == retval)
+	{
+	    if (EAGAIN != errno)
+	    {
+		logerror("ERROR: writing to network socket");
+		connection_finish(conn);
+		return 1;
+	    }
+	}
+	else
+	{
+	    has_progress = 1;
+	}
+    }
+
+    return has_progress;
+}
+
+
+static int connection_flush(struct connection_s *conn)
+{
+    connection_pass_answers(conn);
+    while (connection_relay_has_data(&conn->toweb, &conn->toweb_pipe, &conn->web))
+    {
+	if ( !conn->web.can_write )
+	    return 0;
+
+	int retval = connection_relay_write(conn, &conn->web, &conn->toweb, &conn->toweb_pipe);
+	if (-1 == retval)
+	{
+	    if (EAGAIN == errno)
+		return 0;
+	    if (ECONNRESET == errno || EPIPE == errno)
+		debug(1, "errno %d, connection reset by network peer, closing connection", errno);
+	    else
+		logerror("WARNING: writing to network socket");
+	    connection_finish(conn);
+	    return 1;
+	}
+    }
+
+    /* the web server may still send the input of the finished request. It
+     * can not be told apart from the next request, so close the connection.
+     */
+    if (conn->keep_conn && !conn->tochild_framer.has_end_of_stdin)
+    {
+	debug(1, "input of the request from %s is not complete, close connection", conn->hostname);
+	conn->keep_conn = 0;
+    }
+
+    if (conn->keep_conn)
+	connection_next_request(conn);
+    else
+	connection_finish(conn);
+
+    return 1;
+}
+
+
+/* create the request for a new request id on the multiplexed web
+ * connection. The request runs through the states like a connection of its
+ * own, but exchanges the records with the multiplexed connection.
+ */
+static struct connection_s *connection_mux_new_request(struct connection_s *front, int requestId)
+{
+    struct connection_worker_s *worker = front->worker;
+
+    struct connection_s *request = connection_new(-1, front->hostname);
+    request->worker = worker;
+    request->mux = front;
+    request->listen_projname = front->listen_projname;
+    request->web.can_write = 1;
+    connection_attach_buffers(request, &worker->pool);
+    TAILQ_INSERT_TAIL(&worker->activelist, request, entries);
+    TAILQ_INSERT_TAIL(&front->muxlist, request, mux_entries);
+    front->num_mux++;
+
+    debug(1, "new request id %d on multiplexed connection from %s", requestId, front->hostname);
+
+    return request;
+}
+
+
+static struct connection_s *connection_mux_find_request(struct connection_s *front, int requestId)
+{
+    struct connection_s *request;
+    TAILQ_FOREACH(request, &front->muxlist, mux_entries)
+    {
+	/* the request id is known after the begin request has been parsed */
+	if (request->requestId == requestId)
+	    return request;
+    }
+
+    return NULL;
+}
+
+
+/* pass the complete records read from the multiplexed web connection to
+ * the requests by their request id. If a request has not taken its records
+ * up to the buffer size the records are kept back from this one on, the
+ * web connection is not read until the request took them.
+ * A new request beyond the advertised FCGI_MAX_REQS is rejected.
+ */
+static void connection_mux_dispatch(struct connection_s *front)
+{
+    struct connection_buffer_s *inbuf = &front->inbuf;
+
+    front->is_mux_full = 0;
+    while (inbuf->start < inbuf->end)
+    {
+	char *record = inbuf->data + inbuf->start;
+	int len = inbuf->end - inbuf->start;
+	int type, requestId;
+	int recordlen = fcgi_record_get_header(record, len, &type, &requestId, NULL);
+	if (0 == recordlen || recordlen > len)
+	    break;	// wait for the complete record
+
+	if (0 == requestId)
+	{
+	    connection_answer_management_record(&front->toweb, record, recordlen);
+	}
+	else
+	{
+	    struct connection_s *request = connection_mux_find_request(front, requestId);
+	    if ( !request && FCGI_BEGIN_REQUEST == type )
+	    {
+		if (front->num_mux >= connection_manager_get_capacity())
+		{
+		    debug(1, "reject request id %d, %d requests on multiplexed connection from %s", requestId, front->num_mux, front->hostname);
+		    connection_buffer_append_endrequest(&front->toweb, requestId, FCGI_OVERLOADED);
+		    inbuf->start += recordlen;
+		    continue;
+		}
+		request = connection_mux_new_request(front, requestId);
+		request->requestId = requestId;
+	    }
+
+	    if (request)
+	    {
+		struct connection_buffer_s *muxin = &request->muxin;
+		if (muxin->end - muxin->start >= muxin->maxsize)
+		{
+		    front->is_mux_full = 1;
+		    break;
+		}
+		connection_buffer_reserve(muxin, recordlen);
+		memcpy(muxin->data + muxin->end, record, recordlen);
+		muxin->end += recordlen;
+		muxin->complete = muxin->ready = muxin->end;
+		request->web.can_read = 1;
+		connection_schedule(request);
+	    }
+	    else
+	    {
+		debug(1, "ignore record type %d of unknown request id %d", type, requestId);
+	    }
+	}
+
+	inbuf->start += recordlen;
+    }
+}
+
+
+/* the web connection multiplexes many requests. Read the records and pass
+ * them to the requests, write the answers of the requests.
+ * returns 1 if some data has been transferred, 0 otherwise.
+ */
+static int connection_mux_front(struct connection_s *conn)
+{
+    int has_progress = 0;
+    int retval;
+
+    /* requests -> web server */
+    if (conn->web.can_write && connection_relay_has_data(&conn->toweb, &conn->toweb_pipe, &conn->web))
+    {
+	retval = connection_buffer_write(&conn->web, &conn->toweb);
+	if (-1 == retval)
+	{
+	    if (EAGAIN != errno)
+	    {
+		if (ECONNRESET == errno || EPIPE == errno)
+		    debug(1, "errno %d, connection reset by network peer, closing connection", errno);
+		else
+		    logerror("WARNING: writing to network socket");
+		connection_finish(conn);
+		return 1;
+	    }
+	}
+	else if (retval > 0)
+	{
+	    has_progress = 1;
+	}
+    }
+
+    /* wake up the requests waiting for space in the buffer */
+    if (conn->toweb.end - conn->toweb.start < conn->toweb.maxsize)
+    {
+	struct connection_s *request;
+	TAILQ_FOREACH(request, &conn->muxlist, mux_entries)
+	{
+	    if ( !request->web.can_write )
+	    {
+		request->web.can_write = 1;
+		connection_schedule(request);
+	    }
+	}
+    }
+
+    /* pass the records kept back for a request which took its records now */
+    if (conn->is_mux_full)
+    {
+	int start = conn->inbuf.start;
+	connection_mux_dispatch(conn);
+	if (conn->inbuf.start != start)
+	    has_progress = 1;
+    }
+
+    /* web server -> requests. Not read as long as a request has no space
+     * for its records, the web server gets the back pressure. */
+    if (conn->web.can_read && !conn->is_mux_full)
+    {
+	retval = connection_buffer_read(&conn->web, &conn->inbuf, 0);
+	if (-1 == retval)
+	{
+	    if (EAGAIN != errno)
+	    {
+		logerror("WARNING: reading from network socket");
+		connection_finish(conn);
+		return 1;
+	    }
+	}
+	else if (0 == retval)
+	{
+	    /* end of file received */
+	    connection_finish(conn);
+	    return 1;
+	}
+	else
+	{
+	    connection_mux_dispatch(conn);
+	    has_progress = 1;
+	}
+    }
+
+    return has_progress;
+}
+
+
+/* drive the state machine of the connection as far as possible without
+ * blocking.
+ */
+static void connection_run(struct connection_s *conn)
+{
+    int has_progress = 1;
+    while (has_progress)
+    {
+	enum connection_state_e state = conn->state;
+	has_progress = 0;
+
+	switch (state)
+	{
+	case CONNECTION_STATE_READ_PARAMS:
+	    connection_read_params(conn);
+	    break;
+
+	case CONNECTION_STATE_ACQUIRE:
+	    /* runs on the notification of the admission queue and on the
+	     * timeout of the wait */
+	    connection_acquire_process(conn);
+	    break;
+
+	case CONNECTION_STATE_CONNECT:
+	    if ( !conn->has_timer )
+		connection_connect_process(conn);
+	    break;
+
+	case CONNECTION_STATE_CONNECTING:
+	    connection_check_connected(conn);
+	    break;
+
+	case CONNECTION_STATE_RELAY:
+	    has_progress = connection_relay(conn);
+	    break;
+
+	case CONNECTION_STATE_FLUSH:
+	    has_progress = connection_flush(conn);
+	    break;
+
+	case CONNECTION_STATE_MUX:
+	    has_progress = connection_mux_front(conn);
+	    break;
+
+	case CONNECTION_STATE_DONE:
+	    return;
+	}
+
+	if (state != conn->state)
+	    has_progress = 1;
+    }
+}
+
+
+/* returns the time in milliseconds until the next timer expires,
+ * or -1 if no timer is active.
+ */
+static int connection_worker_get_timeout(struct connection_worker_s *worker)
+{
+    if (TAILQ_EMPTY(&worker->timerlist))
+	return -1;
+
+    struct connection_s *conn;
+    struct timespec *next = NULL;
+    TAILQ_FOREACH(conn, &worker->timerlist, timer_entries)
+    {
+	if ( !next || qgis_timer_isgreaterthan(next, &conn->timer) )
+	    next = &conn->timer;
+    }
+
+    struct timespec now;
+    int retval = qgis_timer_start(&now);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    if ( !qgis_timer_isgreaterthan(next, &now) )
+	return 0;
+
+    long long timeout = (long long)(next->tv_sec - now.tv_sec)*1000 + (next->tv_nsec - now.tv_nsec)/(1000*1000);
+
+    return (int)max(timeout + 1, 1LL);
+}
+
+
+static void connection_worker_handle_timers(struct connection_worker_s *worker)
+{
+    struct connection_list_s expired;
+    TAILQ_INIT(&expired);
+
+    struct timespec now;
+    int retval = qgis_timer_start(&now);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+
+    struct connection_s *conn = TAILQ_FIRST(&worker->timerlist);
+    while (conn)
+    {
+	struct connection_s *next = TAILQ_NEXT(conn, timer_entries);
+	if ( !qgis_timer_isgreaterthan(&conn->timer, &now) )
+	{
+	    TAILQ_REMOVE(&worker->timerlist, conn, timer_entries);
+	    TAILQ_INSERT_TAIL(&expired, conn, timer_entries);
+	}
+	conn = next;
+    }
+
+    while ((conn = TAILQ_FIRST(&expired)) != NULL)
+    {
+	TAILQ_REMOVE(&expired, conn, timer_entries);
+	conn->has_timer = 0;
+	connection_run(conn);
+    }
+}
+
+
+/* run the connections which have been passed data by other connections of
+ * the worker.
+ */
+static void connection_worker_run_scheduled(struct connection_worker_s *worker)
+{
+    struct connection_s *conn;
+    while ((conn = TAILQ_FIRST(&worker->runlist)) != NULL)
+    {
+	connection_unschedule(conn);
+	connection_run(conn);
+    }
+}
+
+
+/* run the connections the admission queue has notified */
+static void connection_worker_handle_admission(struct connection_worker_s *worker)
+{
+    struct connection_s *conn;
+    TAILQ_FOREACH(conn, &worker->waitlist, wait_entries)
+    {
+	if (__sync_lock_test_and_set(&conn->is_admission_notified, 0))
+	    connection_schedule(conn);
+    }
+}
+
+
+static void connection_worker_handle_new_connections(struct connection_worker_s *worker)
+{
+    uint64_t value;
+    int retval = read(worker->eventfd, &value, sizeof(value));
+    if (-1 == retval && EAGAIN != errno)
+    {
+	logerror("ERROR: reading from event fd %d", worker->eventfd);
+	qexit(EXIT_FAILURE);
+    }
+
+    struct connection_list_s newlist;
+    TAILQ_INIT(&newlist);
+
+    connection_worker_lock(worker);
+    TAILQ_CONCAT(&newlist, &worker->newlist, entries);
+    connection_worker_unlock(worker);
+
+    struct connection_s *conn;
+    while ((conn = TAILQ_FIRST(&newlist)) != NULL)
+    {
+	TAILQ_REMOVE(&newlist, conn, entries);
+	TAILQ_INSERT_TAIL(&worker->activelist, conn, entries);
+	conn->worker = worker;
+	connection_attach_buffers(conn, &worker->pool);
+	connection_endpoint_register(conn, &conn->web);
+    }
+}
+
+
+static void *connection_worker_thread(void *arg)
+{
+    struct connection_worker_s *worker = arg;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    debug(1, "started connection worker %d", worker->num);
+
+    int has_finished = 0;
+    while ( !has_finished )
+    {
+	int timeout = connection_worker_get_timeout(worker);
+	int retval = epoll_wait(worker->epollfd, events, MAX_EPOLL_EVENTS, timeout);
+	if (-1 == retval)
+	{
+	    if (EINTR == errno)
+		continue;
+	    logerror("ERROR: %s() calling epoll_wait", __FUNCTION__);
+	    qexit(EXIT_FAILURE);
+	}
+
+	int i;
+	for (i=0; i<retval; i++)
+	{
+	    struct connection_endpoint_s *endpoint = events[i].data.ptr;
+	    if ( !endpoint )
+	    {
+		connection_worker_handle_new_connections(worker);
+		connection_worker_handle_admission(worker);
+		continue;
+	    }
+
+	    struct connection_s *conn = endpoint->conn;
+	    if (CONNECTION_STATE_DONE == conn->state)
+		continue;
+
+	    uint32_t ev = events[i].events;
+	    if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		endpoint->can_read = 1;
+	    if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		endpoint->can_write = 1;
+
+	    connection_run(conn);
+	}
+
+	connection_worker_run_scheduled(worker);
+	connection_worker_handle_timers(worker);
+	connection_worker_run_scheduled(worker);
+
+	struct connection_s *conn;
+	while ((conn = TAILQ_FIRST(&worker->closedlist)) != NULL)
+	{
+	    TAILQ_REMOVE(&worker->closedlist, conn, entries);
+	    connection_delete(conn);
+	}
+
+	connection_worker_lock(worker);
+	has_finished = worker->is_shutdown;
+	connection_worker_unlock(worker);
+    }
+
+    /* close all remaining connections */
+    struct connection_s *conn;
+    TAILQ_CONCAT(&worker->activelist, &worker->newlist, entries);
+    while ((conn = TAILQ_FIRST(&worker->activelist)) != NULL)
+    {
+	conn->worker = worker;
+	connection_finish(conn);
+    }
+    while ((conn = TAILQ_FIRST(&worker->closedlist)) != NULL)
+    {
+	TAILQ_REMOVE(&worker->closedlist, conn, entries);
+	connection_delete(conn);
+    }
+
+    connection_pool_delete(&worker->pool);
+
+    debug(1, "stopped connection worker %d", worker->num);
+
+    return NULL;
+}
+
+
+void connection_worker_init(int num)
+{
+    assert(num > 0);
+    assert( !workers );
+
+    workers = calloc(num, sizeof(*workers));
+    assert(workers);
+    if ( !workers )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    num_workers = num;
+
+    const char *relay = config_get_connection_relay();
+    if (relay && 0 == strcmp(relay, CONNECTION_RELAY_COPY))
+    {
+	use_splice = 0;
+    }
+    else
+    {
+	if (relay && 0 != strcmp(relay, CONNECTION_RELAY_SPLICE))
+	    printlog("WARNING: unknown connection relay '%s', use '%s'", relay, CONNECTION_RELAY_SPLICE);
+	use_splice = 1;
+    }
+    debug(1, "relay fcgi data with %s", use_splice ? CONNECTION_RELAY_SPLICE : CONNECTION_RELAY_COPY);
+    max_buffer_size = max(DEFAULT_BUFFER_SIZE, config_get_max_transfer_buffer());
+    use_multiplex = config_get_multiplex_connections();
+    debug(1, "multiplex web connections: %s", use_multiplex ? "yes" : "no");
+
+    int i;
+    for (i=0; i<num; i++)
+    {
+	struct connection_worker_s *worker = &workers[i];
+	worker->num = i;
+	TAILQ_INIT(&worker->newlist);
+	TAILQ_INIT(&worker->activelist);
+	TAILQ_INIT(&worker->closedlist);
+	TAILQ_INIT(&worker->timerlist);
+	TAILQ_INIT(&worker->runlist);
+	TAILQ_INIT(&worker->waitlist);
+
+	int retval = pthread_mutex_init(&worker->lock, NULL);
+	if (retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: init mutex");
+	    qexit(EXIT_FAILURE);
+	}
+
+	worker->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (-1 == worker->epollfd)
+	{
+	    logerror("ERROR: can not create epoll fd");
+	    qexit(EXIT_FAILURE);
+	}
+
+	worker->eventfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (-1 == worker->eventfd)
+	{
+	    logerror("ERROR: can not create event fd");
+	    qexit(EXIT_FAILURE);
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	retval = epoll_ctl(worker->epollfd, EPOLL_CTL_ADD, worker->eventfd, &event);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: adding event fd to epoll fd");
+	    qexit(EXIT_FAILURE);
+	}
+
+	retval = pthread_create(&worker->thread, NULL, connection_worker_thread, worker);
+	if (retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: creating thread");
+	    qexit(EXIT_FAILURE);
+	}
+    }
+}
+
+
+void connection_worker_delete(void)
+{
+    int i;
+    for (i=0; i<num_workers; i++)
+    {
+	struct connection_worker_s *worker = &workers[i];
+	connection_worker_lock(worker);
+	worker->is_shutdown = 1;
+	connection_worker_unlock(worker);
+	connection_worker_wakeup(worker);
+    }
+
+    for (i=0; i<num_workers; i++)
+    {
+	struct connection_worker_s *worker = &workers[i];
+	int retval = pthread_join(worker->thread, NULL);
+	if (retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: joining worker thread");
+	    qexit(EXIT_FAILURE);
+	}
+	close(worker->eventfd);
+	close(worker->epollfd);
+	pthread_mutex_destroy(&worker->lock);
+    }
+
+    free(workers);
+    workers = NULL;
+    num_workers = 0;
+}
+
+
+/* hand the accepted network connection over to the next worker.
+ * The requests of a connection accepted on the listener of project
+ * "projname" are routed to this project.
+ * returns the number of the worker.
+ */
+int connection_worker_add_connection(int netfd, const char *hostname, const char *projname)
+{
+    assert(workers);
+    assert(num_workers > 0);
+
+    struct connection_s *conn = connection_new(netfd, hostname);
+    conn->listen_projname = projname;
+    if (use_multiplex)
+	conn->state = CONNECTION_STATE_MUX;
+
+    /* round robin is good enough to spread the load. More than one
+     * acceptor thread may add connections at the same time. */
+    int num = __sync_fetch_and_add(&next_worker, 1) % num_workers;
+    struct connection_worker_s *worker = &workers[num];
+
+    connection_worker_lock(worker);
+    TAILQ_INSERT_TAIL(&worker->newlist, conn, entries);
+    connection_worker_unlock(worker);
+
+    connection_worker_wakeup(worker);
+
+    return num;
+}
+
+
+/* open the connection to the idle child process before the first request
+ * arrives. If this fails the connection is opened on request.
+ */
+void connection_worker_prepare_process_connection(pid_t pid)
+{
+    struct sockaddr_un sockaddr;
+    socklen_t sockaddrlen = sizeof(sockaddr);
+
+    int childunixsocketfd = db_get_process_socket(pid);
+    if (-1 == childunixsocketfd)
+	return;
+    int retval = getsockname(childunixsocketfd, (struct sockaddr *)&sockaddr, &sockaddrlen);
+    if (-1 == retval)
+    {
+	logerror("WARNING: retrieving the name of child process socket %d", childunixsocketfd);
+	return;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (-1 == fd)
+    {
+	logerror("WARNING: can not create socket to child process");
+	return;
+    }
+
+    retval = connect(fd, (struct sockaddr *)&sockaddr, sockaddrlen);
+    if (-1 == retval && EINPROGRESS != errno)
+    {
+	debug(1, "can not connect to child process %d, errno %d", pid, errno);
+	close(fd);
+	return;
+    }
+
+    int bufsize = connection_manager_get_socket_buffer_size(fd);
+    if (-1 == bufsize)
+	bufsize = 0;	// read again on first use
+
+    retval = db_process_store_client_socket(pid, fd, bufsize);
+    if (-1 == retval)
+	close(fd);
+    else
+	debug(1, "prepared connection %d to process %d", fd, pid);
+}
@@ -0,0 +1,46 @@
+/*
+ * connection_worker.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Event driven worker pool for the network connections.
+    Each worker runs an epoll event loop and handles the complete request of
+    many connections without blocking: read the parameters, find the project,
+    get an idle child process, connect to it and relay the data.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef CONNECTION_WORKER_H_
+#define CONNECTION_WORKER_H_
+
+#include <sys/types.h>
+
+
+void connection_worker_init(int num);
+void connection_worker_delete(void);
+int connection_worker_add_connection(int netfd, const char *hostname, const char *projname);
+void connection_worker_prepare_process_connection(pid_t pid);
+
+
+#endif /* CONNECTION_WORKER_H_ */
@@ -8,6 +8,21 @@
 /*
     Database for the project and process data.
     Provides information about all current projects, processes and statistics.
+    The tables are kept in memory in plain C structures. The processes are
+    found by their pid in a hash table and by their project in a list per
+    project, each project counts its processes per state. So the queries
+    done for each request do not need to search all processes.
+    Each project keeps the idle processes of its active list in a stack, the
+    last process getting idle is on top. The selection policy of the project
+    takes the next process from the top, from the bottom, in the order of
+    the process start or by the number of requests served. Requests with an
+    affinity key prefer the processes the key maps to on a consistent hash
+    ring of the active processes of the project, so requests of the same
+    key go to the same process as long as it is idle. Taking and
+    handing back a process and counting the processes of a project lock the
+    project only, requests of different projects do not wait for each other.
+    If the scheduler is built with sqlite3 the dump of the tables is done by
+    exporting them into a sqlite3 memory database.
 
     Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
 
@@ -32,16 +47,24 @@
 
 #include "database.h"
 
+#include "config.h"
+
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdarg.h>
-#include <sqlite3.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <assert.h>
 #include <string.h>
 #include <libgen.h>
 #include <errno.h>
+#include <sys/queue.h>
+
+#if defined(HAVE_LIBSQLITE3) && defined(HAVE_SQLITE3_H)
+#define DB_DUMP_SQLITE
+#include <sqlite3.h>
+#endif
 
+#include "admission_queue.h"
 #include "logger.h"
 #include "qgis_config.h"
 #include "qgis_shutdown_queue.h"
@@ -51,198 +74,96 @@
 
 
 /* process data:
- * process id, list state, process state, worker thread id, socket fd
+ * process id, list state, process state, worker thread id, socket fd,
+ * number of requests served
  *
  * project data:
- * project name, number of crashes during init phase
- */
-
-#define DB_MAX_RETRIES	10
-
-
-/* callback function for the common query function.
- * First parameter is the data given by "callback_arg"
- * from int db_select_parameter_callback(enum db_select_statement_id sid, sqlite3_callback callback, void *callback_arg, ...)
- * Second parameter is the number of columns in the result.
- * Third parameter is the data type of the result array, one entry for each result.
- * Forth parameter is the array of results, which have to be converted. Do like this:
- * switch (type[i])
- * {
- * case SQLITE_INTEGER:
- * 	int value = results[i].integer;
- * 	break;
- * case SQLITE_FLOAT:
- * 	double value = results[i].floating;
- * 	break;
- * case SQLITE_BLOB:
- * 	const void *data = results[i].blob;
- * 	break;
- * case SQLITE_NULL:
- * 	break;
- * case SQLITE_TEXT:
- * 	char *value = strdup(results[i].text);
- * 	break;
- * }
- * Fifth parameter is the array of column names.
+ * project name, number of crashes during init phase, process selection policy
+ *
+ * locks:
+ * The table lock protects the lists of all projects and processes and the
+ * project data besides the processes. It is taken to add and remove
+ * processes and projects, and to walk through all of them.
+ * The lock of a pid hash bucket protects the processes in the bucket from
+ * being removed. The lock of a project protects the data of its processes,
+ * its process list and its idle list.
+ * Locks are taken in this order: table, pid bucket, project.
+ * The project hash is read without lock. Its entries are only added and
+ * stay until db_delete().
  */
-union callback_result_t {
-    long long int integer;
-    double floating;
-    const unsigned char *text;
-    const void *blob;
-};
-typedef int (*db_callback)(void *data, int ncol, int *type, union callback_result_t *results, const char**cols);
 
+#define DB_PID_BUCKETS		1024
+#define DB_PROJECT_BUCKETS	256
+#define DB_RING_POINTS		32	/* points of each process on the hash ring */
+#define DB_RING_CHOICES		2	/* processes tried for an affinity key */
 
-static sqlite3 *dbhandler = NULL;
 
-static pthread_mutex_t db_mutex_lock = PTHREAD_MUTEX_INITIALIZER;
+struct db_process_s;
 
-static pthread_cond_t idle_process_condition = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t idle_process_mutex = PTHREAD_MUTEX_INITIALIZER;
+struct db_ring_point_s
+{
+    uint32_t hash;
+    struct db_process_s *proc;
+};
 
-/* This is a global flag where statements can set the default error behaviour
- * Normally the error is printed on standard error channel or into the log file.
- * By setting this variable != 0 the behavior changes and the application exits
- * with an error message.
- *
- * CAUTION: This variable needs to be changed under the protection of
- * "db_mutex_lock", i.e. inbetween db_global_lock() and db_global_unlock().
- */
-static int db_exit_on_error = 0;
-
-
-enum db_select_statement_id
-{
-    DB_SELECT_ID_NULL = 0,
-    // from this id on we can use prepared statements
-    DB_SELECT_CREATE_PROJECT_TABLE,
-    DB_SELECT_CREATE_PROCESS_TABLE,
-    DB_SELECT_GET_NAMES_FROM_PROJECT,
-    DB_INSERT_PROJECT_DATA,
-    DB_DELETE_PROJECT_DATA,
-    DB_SELECT_CONFIGPATH_WITH_PROJECT,
-    DB_INSERT_PROCESS_DATA,
-    DB_UPDATE_PROCESS_STATE,
-    DB_GET_PROCESS_STATE,
-    DB_GET_STATE_PROCESS,
-    DB_GET_NUM_START_INIT_IDLE_PROCESS,
-    DB_GET_ALL_PROCESS,
-    DB_GET_PROCESS_FROM_LIST,
-    DB_GET_NUM_PROCESS_FROM_LIST,
-    DB_UPDATE_PROCESS_LISTS_WITH_NAME_AND_LIST,
-    DB_UPDATE_PROCESS_LIST_PID,
-    DB_UPDATE_PROCESS_LIST,
-    DB_UPDATE_PROCESS_SIGNAL_TIMER,
-    DB_SELECT_PROCESS_SIGNAL_TIMER,
-    DB_SELECT_PROCESS_MIN_SIGNAL_TIMER,
-    DB_DELETE_PROCESS_WITH_STATE,
-    DB_INC_PROJECT_STARTUP_FAILURE,
-    DB_SELECT_PROJECT_STARTUP_FAILURE,
-    DB_RESET_PROJECT_STARTUP_FAILURE,
-    DB_SELECT_PROJECT_WITH_PID,
-    DB_SELECT_PROCESS_WITH_NAME_LIST_AND_STATE,
-    DB_GET_LIST_FROM_PROCESS,
-    DB_GET_PROCESS_SOCKET_FROM_PROCESS,
-    DB_UPDATE_PROJECT_WITH_CONFIG_AND_WATCHD,
-    DB_GET_PROJECTS_FOR_WATCHES_AND_CONFIGS,
-    DB_GET_WATCHD_FROM_CONFIG,
-    DB_GET_WATCHD_FROM_PROJECT,
-    DB_GET_NUM_WATCHD_FROM_CONFIG,
-    DB_GET_NUM_WATCHD_FROM_WATCHD,
-    DB_DUMP_PROJECT,
-    DB_DUMP_PROCESS,
-
-    DB_SELECT_ID_MAX	// last entry, do not use
+struct db_project_s
+{
+    struct db_project_s *hash_next;		/* project hash bucket, constant after insertion */
+    TAILQ_ENTRY(db_project_s) entries;		/* all projects in the order of their creation */
+    TAILQ_HEAD(db_project_process_list_s, db_process_s) processes;	/* processes of this project */
+    TAILQ_HEAD(db_project_idle_list_s, db_process_s) idle;	/* idle processes of the active list, last idle first */
+    pthread_mutex_t lock;	/* protects the process data of this project */
+    char *name;
+    char *configpath;
+    char *configbasename;
+    int watchd;
+    int nr_crashs;
+    int is_removed;	/* the project is gone, the entry is kept for a later use */
+    int num_state[PROCESS_STATE_MAX];	/* number of processes per state, atomic access */
+    enum db_process_select_e select;	/* policy to take the next idle process */
+    struct db_process_s *round_robin_next;	/* process to try first with SELECT_ROUND_ROBIN, NULL starts at the first */
+    struct db_ring_point_s *ring;	/* consistent hash ring of the active processes, sorted by hash */
+    int ring_len;
+    int ring_size;
+    int is_ring_changed;	/* the active processes changed, rebuild the ring before use */
 };
 
 
-static const char *db_select_statement[DB_SELECT_ID_MAX] =
+struct db_process_s
 {
-	// DB_SELECT_ID_NULL
-	"",
-	// DB_SELECT_CREATE_PROJECT_TABLE
-	"CREATE TABLE projects (name TEXT UNIQUE NOT NULL, configpath TEXT DEFAULT '', configbasename TEXT DEFAULT '', watchd INTEGER DEFAULT 0, nr_crashs INTEGER DEFAULT 0)",
-	// DB_SELECT_CREATE_PROCESS_TABLE
-	"CREATE TABLE processes (projectname TEXT REFERENCES projects (name), "
-	    "list INTEGER NOT NULL, state INTEGER NOT NULL, "
-	    "threadid INTEGER, pid INTEGER UNIQUE NOT NULL, "
-	    "process_socket_fd INTEGER NOT NULL, client_socket_fd INTEGER DEFAULT -1, "
-	    "starttime_sec INTEGER DEFAULT 0, starttime_nsec INTEGER DEFAULT 0, "
-	    "signaltime_sec INTEGER DEFAULT 0, signaltime_nsec INTEGER DEFAULT 0 )",
-	// DB_SELECT_GET_NAMES_FROM_PROJECT
-	"SELECT name FROM projects",
-	// DB_INSERT_PROJECT_DATA
-	"INSERT INTO projects (name) VALUES (%s)",
-	// DB_DELETE_PROJECT_DATA
-	"DELETE FROM projects WHERE name = %s",
-	// DB_SELECT_CONFIGPATH_WITH_PROJECT
-	"SELECT configpath FROM projects WHERE name = %s",
-	// DB_INSERT_PROCESS_DATA
-	"INSERT INTO processes (projectname, list, state, pid, process_socket_fd) VALUES (%s,%i,%i,%i,%i)",
-	// DB_UPDATE_PROCESS_STATE
-	"UPDATE processes SET state = %i, threadid = %l WHERE pid = %i",
-	// DB_GET_PROCESS_STATE
-	"SELECT state FROM processes WHERE pid = %i",
-	// DB_GET_STATE_PROCESS
-	"SELECT pid FROM processes WHERE projectname = %s AND state = %i",
-	// DB_GET_NUM_START_INIT_IDLE_PROCESS
-	"SELECT count(pid) FROM processes WHERE projectname = %s AND ( state = 0 OR state = 1 OR state = 2 )",
-	// DB_GET_ALL_PROCESS
-	"SELECT pid FROM processes",
-	// DB_GET_PROCESS_FROM_LIST
-	"SELECT pid FROM processes WHERE list = %d",
-	// DB_GET_NUM_PROCESS_FROM_LIST
-	"SELECT count(pid) FROM processes WHERE list = %d",
-	// DB_UPDATE_PROCESS_LISTS_WITH_NAME_AND_LIST
-	"UPDATE processes SET list = %i WHERE projectname = %s AND list = %i",
-	// DB_UPDATE_PROCESS_LIST_PID
-	"UPDATE processes SET list = %i WHERE pid = %i",
-	// DB_UPDATE_PROCESS_LIST
-	"UPDATE processes SET list = %i",
-	// DB_UPDATE_PROCESS_SIGNAL_TIMER
-	"UPDATE processes SET signaltime_sec = %l, signaltime_nsec = %l WHERE pid = %i",
-	// DB_SELECT_PROCESS_SIGNAL_TIMER
-	"SELECT signaltime_sec,signaltime_nsec FROM processes WHERE pid = %i",
-	// DB_SELECT_PROCESS_MIN_SIGNAL_TIMER
-	"SELECT signaltime_sec,signaltime_nsec FROM processes WHERE signaltime_sec != 0  AND signaltime_nsec != 0 ORDER BY signaltime_sec ASC, signaltime_nsec ASC LIMIT 1",
-	// DB_DELETE_PROCESS_WITH_STATE
-	"DELETE FROM processes WHERE STATE = %i",
-	// DB_INC_PROJECT_STARTUP_FAILURE
-	"UPDATE projects SET nr_crashs = nr_crashs+1 WHERE name = %s",
-	// DB_SELECT_PROJECT_STARTUP_FAILURE
-	"SELECT nr_crashs FROM projects WHERE name = %s",
-	// DB_RESET_PROJECT_STARTUP_FAILURE
-	"UPDATE projects SET nr_crashs = 0 WHERE name = %s",
-	// DB_SELECT_PROJECT_WITH_PID
-	"SELECT projectname FROM processes WHERE pid = %i",
-	// DB_SELECT_PROCESS_WITH_NAME_LIST_AND_STATE
-	"SELECT pid FROM processes WHERE (projectname= %s AND list = %i AND state = %i) LIMIT 1",
-	// DB_GET_LIST_FROM_PROCESS
-	"SELECT list FROM processes WHERE pid = %d",
-	// DB_GET_PROCESS_SOCKET_FROM_PROCESS
-	"SELECT process_socket_fd FROM processes WHERE pid = %d",
-	// DB_UPDATE_PROJECT_WITH_CONFIG_AND_WATCHD
-	"UPDATE OR IGNORE projects SET configpath = %s, configbasename = %s, watchd = %i WHERE name = %s",
-	// DB_GET_PROJECTS_FOR_WATCHES_AND_CONFIGS
-	"SELECT name FROM projects WHERE watchd = %d AND configbasename = %s",
-	// DB_GET_WATCHD_FROM_CONFIG
-	"SELECT watchd FROM projects WHERE configpath = %s",
-	// DB_GET_WATCHD_FROM_PROJECT
-	"SELECT watchd FROM projects WHERE name = %s",
-	// DB_GET_NUM_WATCHD_FROM_CONFIG
-	"SELECT count(watchd) FROM projects WHERE watchd IN (SELECT watchd FROM projects WHERE configpath = %s)",
-	// DB_GET_NUM_WATCHD_FROM_WATCHD
-	"SELECT count(watchd) FROM projects WHERE watchd = %d",
-	// DB_DUMP_PROJECT
-	"SELECT * FROM projects ORDER BY name ASC",
-	// DB_DUMP_PROCESS
-	"SELECT * FROM processes ORDER BY projectname ASC, pid ASC",
+    LIST_ENTRY(db_process_s) hash_entries;	/* pid hash bucket */
+    TAILQ_ENTRY(db_process_s) project_entries;	/* processes of the project in the order of their start */
+    TAILQ_ENTRY(db_process_s) entries;		/* all processes in the order of their start */
+    TAILQ_ENTRY(db_process_s) idle_entries;	/* idle processes of the project */
+    struct db_project_s *project;
+    pid_t pid;
+    enum db_process_list_e list;
+    enum db_process_state_e state;
+    int is_idle;	/* process is in the idle list */
+    pthread_t threadid;
+    int process_socket_fd;
+    int client_socket_fd;
+    int client_socket_bufsize;
+    struct timespec signaltime;
+    long long int idletime_sec;
+    long long int requests;	/* number of requests given to the process */
+};
+
 
+struct db_pid_bucket_s
+{
+    pthread_mutex_t lock;
+    LIST_HEAD(db_process_bucket_s, db_process_s) processes;
 };
 
 
-static sqlite3_stmt *db_prepared_stmt[DB_SELECT_ID_MAX] = { 0 };
+static struct db_project_s *project_buckets[DB_PROJECT_BUCKETS];
+static TAILQ_HEAD(db_project_list_s, db_project_s) projectlist = TAILQ_HEAD_INITIALIZER(projectlist);
+static struct db_pid_bucket_s pid_buckets[DB_PID_BUCKETS];
+static TAILQ_HEAD(db_process_list_s, db_process_s) processlist = TAILQ_HEAD_INITIALIZER(processlist);
+static int num_list[LIST_SELECTOR_MAX];	/* number of processes per list, atomic access */
+
+static pthread_mutex_t db_mutex_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 static void db_global_lock(void)
@@ -269,621 +190,331 @@ static void db_global_unlock(void)
 }
 
 
-static sqlite3_stmt *db_statement_prepare(enum db_select_statement_id sid)
+static void db_mutex_lock_or_exit(pthread_mutex_t *lock)
 {
-    assert(sid < DB_SELECT_ID_MAX);
-
-    sqlite3_stmt *ppstmt;
-    const char *const sql = db_select_statement[sid];
-    const char *srcsql = sql;
-
-    /* exchange "%N" markers with '?' */
-    char * const copysql = strdup(sql);
-    char *destsql = copysql;
-    char c;
-    do
+    int retval = pthread_mutex_lock(lock);
+    if (retval)
     {
-	c = *srcsql++;
-	if ('%' == c)
-	{
-	    switch(*srcsql++)
-	    {
-	    case 'p':
-		/* found pointer value "%p". */
-		// fall through
-	    case 'f':
-		/* found double value "%f". */
-		// fall through
-	    case 's':
-		/* found string value "%s". */
-		// fall through
-	    case 'd':
-		/* found integer value "%i". */
-		// fall through
-	    case 'i':
-		/* found integer value "%i". */
-		// fall through
-	    case 'l':
-		/* found long long integer value "%l". */
-
-		/* exchange "%N" with '?' */
-		c = '?';
-		break;
-
-	    case '%':
-		/* found double percent sign "%%". just go on */
-
-		/* exchange "%%" with '%' */
-		break;
-
-	    case '\0':
-		/* percentage sign has been the last character in the string
-		 * rewind the string, so the outer while() catches the end of
-		 * the string.
-		 */
-		debug(1, "Huh? found '%%' at the end of the sql '%s'", sql);
-		srcsql--;
-		break;
-
-	    default:
-		/* unknown character found. exit */
-		srcsql--;
-		printlog("ERROR: unknown character found in sql string '%s', position %ld: '%c'", db_select_statement[sid], (long int)(srcsql - db_select_statement[sid]), *srcsql);
-		qexit(EXIT_FAILURE);
-	    }
-	}
+	errno = retval;
+	logerror("ERROR: acquire mutex lock");
+	qexit(EXIT_FAILURE);
+    }
+}
 
-	*destsql++ = c;
-    } while ( c ); // moved while() down here to copy terminating '\0' to "destsql"
-    debug(1, "transferred sql from '%s' to '%s'", sql, copysql);
 
-    int retval = sqlite3_prepare(dbhandler, copysql, -1, &ppstmt, NULL);
-    if (SQLITE_OK != retval)
+static void db_mutex_unlock_or_exit(pthread_mutex_t *lock)
+{
+    int retval = pthread_mutex_unlock(lock);
+    if (retval)
     {
-	printlog("ERROR: preparing sql statement '%s': %s", sql, sqlite3_errstr(retval));
+	errno = retval;
+	logerror("ERROR: unlock mutex lock");
 	qexit(EXIT_FAILURE);
     }
-
-    free(copysql);
-
-    return ppstmt;
 }
 
 
-static void db_statement_finalize(sqlite3_stmt *ppstmt)
+static void db_mutex_init_or_exit(pthread_mutex_t *lock)
 {
-    int retval = sqlite3_finalize(ppstmt);
-    if (SQLITE_OK != retval)
+    int retval = pthread_mutex_init(lock, NULL);
+    if (retval)
     {
-	printlog("ERROR: finalizing sql statement: %s", sqlite3_errstr(retval));
+	errno = retval;
+	logerror("ERROR: init mutex");
 	qexit(EXIT_FAILURE);
     }
 }
 
 
-static int db_select_parameter_callback(enum db_select_statement_id sid, db_callback callback, void *callback_arg, ...)
+static char *db_strdup(const char *str)
 {
-    /* The life-cycle of a prepared statement object usually goes like this:
-     *
-     * 1. Create the prepared statement object using sqlite3_prepare_v2().
-     * 2. Bind values to parameters using the sqlite3_bind_*() interfaces.
-     * 3. Run the SQL by calling sqlite3_step() one or more times.
-     * 4. Reset the prepared statement using sqlite3_reset() then go back to step 2. Do this zero or more times.
-     * 5. Destroy the object using sqlite3_finalize().
-     */
-    int retval;
-    const int loglevel = config_get_debuglevel();
-
-#define BUFFERSIZE 64
-    char debug_buffer[BUFFERSIZE] = {0,};
-    int debug_loglen = BUFFERSIZE;
-    char *debug_log = NULL;
-    if (1 <= loglevel)
+    char *ret = strdup(str);
+    assert(ret);
+    if ( !ret )
     {
-	debug_log = malloc(BUFFERSIZE);
-	if (NULL == debug_log)
-	{
-	    logerror("ERROR: malloc");
-	    qexit(EXIT_FAILURE);
-	}
-	*debug_log = '\0';
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
     }
 
-    assert(dbhandler);
-    assert(sid < DB_SELECT_ID_MAX);
-    const char *sql = db_select_statement[sid];
+    return ret;
+}
 
-    sqlite3_stmt *ppstmt;
-    if ( !db_prepared_stmt[sid] )
-	db_prepared_stmt[sid] =
-		ppstmt = db_statement_prepare(sid);
-    else
-	ppstmt = db_prepared_stmt[sid];
 
-    /* evaluate the remaining arguments */
-    int col = 1;	// column position index
-    va_list args;
-    va_start(args, callback_arg);
-    while (*sql)
+static uint32_t db_hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    const char *c;
+    for (c=name; *c; c++)
     {
-	if ('%' == *sql++)
-	{
-	    switch(*sql++)
-	    {
-	    case 'p':
-		/* found pointer value "%p". The next argument is the
-		 * type "void *" */
-	    {
-		assert(0); // TODO need to extend "%p" to "%NNNp" with NNN being decimal number describing the size of 'p'
-                const void *v = va_arg(args, void *);
-                retval = sqlite3_bind_blob(ppstmt, col++, v, -1, SQLITE_STATIC);
-                if ( SQLITE_OK != retval )
-                {
-                    printlog("ERROR: in sql '%s' bind column %d returned: %s", sql, col, sqlite3_errstr(retval));
-                    qexit(EXIT_FAILURE);
-                }
-                if (1 <= loglevel)
-                {
-                    snprintf(debug_buffer, BUFFERSIZE-1, ", %p", v);
-                    strnbcat(&debug_log, &debug_loglen, debug_buffer);
-                }
-		break;
-	    }
+	hash ^= (unsigned char)*c;
+	hash *= 16777619u;
+    }
 
-	    case 'f':
-		/* found double value "%f". The next argument is the
-		 * type "double" */
-	    {
-                double d = va_arg(args, double);
-                retval = sqlite3_bind_double(ppstmt, col++, d);
-                if ( SQLITE_OK != retval )
-                {
-                    printlog("ERROR: in sql '%s' bind column %d returned: %s", sql, col, sqlite3_errstr(retval));
-                    qexit(EXIT_FAILURE);
-                }
-                if (1 <= loglevel)
-                {
-                    snprintf(debug_buffer, BUFFERSIZE-1, ", %f", d);
-                    strnbcat(&debug_log, &debug_loglen, debug_buffer);
-                }
-		break;
-	    }
+    return hash;
+}
 
-	    case 's':
-		/* found string value "%s". The next argument is the
-		 * type "const char *" */
-	    {
-                const char *s = va_arg(args, char *);
-                retval = sqlite3_bind_text(ppstmt, col++, s, -1, SQLITE_STATIC);
-                if ( SQLITE_OK != retval )
-                {
-                    printlog("ERROR: in sql '%s' bind column %d returned: %s", sql, col, sqlite3_errstr(retval));
-                    qexit(EXIT_FAILURE);
-                }
-                if (1 <= loglevel)
-                {
-                    snprintf(debug_buffer, BUFFERSIZE-1, ", %s", s);
-                    strnbcat(&debug_log, &debug_loglen, debug_buffer);
-                }
-		break;
-	    }
 
-	    case 'd':	// fall through
-	    case 'i':
-		/* found integer value "%i". The next argument is the
-		 * type "int" */
-	    {
-                int i = va_arg(args, int);
-                retval = sqlite3_bind_int(ppstmt, col++, i);
-                if ( SQLITE_OK != retval )
-                {
-                    printlog("ERROR: in sql '%s' bind column %d returned: %s", sql, col, sqlite3_errstr(retval));
-                    qexit(EXIT_FAILURE);
-                }
-                if (1 <= loglevel)
-                {
-                    snprintf(debug_buffer, BUFFERSIZE-1, ", %d", i);
-                    strnbcat(&debug_log, &debug_loglen, debug_buffer);
-                }
-		break;
-	    }
+/* returns the project entry with this name, regardless if it has been
+ * removed. Returns NULL if there is none.
+ * Needs no lock, the entries are never removed from the hash.
+ */
+static struct db_project_s *db_nolock__find_project_entry(const char *projname)
+{
+    struct db_project_s *project = __atomic_load_n(&project_buckets[db_hash_name(projname) % DB_PROJECT_BUCKETS], __ATOMIC_ACQUIRE);
+    while (project)
+    {
+	if (0 == strcmp(project->name, projname))
+	    break;
+	project = project->hash_next;
+    }
 
-	    case 'l':
-		/* found 64bit integer value "%l". The next argument is the
-		 * type "long long int" */
-	    {
-                long long int l = va_arg(args, long long int);
-                retval = sqlite3_bind_int64(ppstmt, col++, l);
-                if ( SQLITE_OK != retval )
-                {
-                    printlog("ERROR: in sql '%s' bind column %d returned: %s", sql, col, sqlite3_errstr(retval));
-                    qexit(EXIT_FAILURE);
-                }
-                if (1 <= loglevel)
-                {
-                    snprintf(debug_buffer, BUFFERSIZE-1, ", %lld", l);
-                    strnbcat(&debug_log, &debug_loglen, debug_buffer);
-                }
-		break;
-	    }
+    return project;
+}
 
-	    case '%':
-		/* found double percent sign "%%". just go on */
-		break;
-
-	    case '\0':
-		/* percentage sign has been the last character in the string
-		 * rewind the string, so the outer while() catches the end of
-		 * the string.
-		 */
-		sql--;
-		break;
-
-	    default:
-		/* unknown character found. exit */
-		printlog("ERROR: unknown character found in sql string '%s', position %ld: %c", db_select_statement[sid], (long int)(sql - db_select_statement[sid]), *sql);
-		qexit(EXIT_FAILURE);
-	    }
-	}
-    }
-    va_end(args);
-    debug(1, "db selected %d: '%s%s'", sid, db_select_statement[sid], debug_log);
-    free(debug_log);
-
-    int try_num = 0;
-    do {
-	retval = sqlite3_step(ppstmt);
-	if (SQLITE_BUSY == retval)
-	    try_num++;
-	else if (SQLITE_ROW == retval)
-	{
-	    /* there is data available, fetch data and recall step() */
-	    debug(1, "data available: sql '%s'", db_select_statement[sid]);
-	    assert(callback);
-	    if ( !callback )
-	    {
-		printlog("ERROR: data available but no callback function defined for sql '%s'", db_select_statement[sid]);
-		/* go on with the loop until no more data is available */
-	    }
-	    else
-	    {
-		/* prepare the callback data */
-		const int ncol_result = sqlite3_column_count(ppstmt);
-		int *type = calloc(ncol_result, sizeof(*type));
-		if ( !type )
-		{
-		    printlog("ERROR: not enough memory");
-		    qexit(EXIT_FAILURE);
-		}
-		union callback_result_t *results = calloc(ncol_result, sizeof(*results));
-		if ( !results )
-		{
-		    printlog("ERROR: not enough memory");
-		    qexit(EXIT_FAILURE);
-		}
-		const char **cols = calloc(ncol_result, sizeof(*cols));
-		if ( !cols )
-		{
-		    printlog("ERROR: not enough memory");
-		    qexit(EXIT_FAILURE);
-		}
-
-		int i;
-		for (i = 0; i<ncol_result; i++)
-		{
-		    int mytype =
-			    type[i] = sqlite3_column_type(ppstmt, i);
-		    switch(mytype)
-		    {
-		    case SQLITE_INTEGER:
-			results[i].integer = sqlite3_column_int64(ppstmt, i);
-			break;
-
-		    case SQLITE_FLOAT:
-			results[i].floating = sqlite3_column_double(ppstmt, i);
-			break;
-
-		    case SQLITE_TEXT:
-			results[i].text = sqlite3_column_text(ppstmt, i);
-			break;
-
-		    case SQLITE_BLOB:
-			results[i].blob = sqlite3_column_blob(ppstmt, i);
-			break;
-
-		    case SQLITE_NULL:
-			break;
-
-		    default:
-			printlog("ERROR: unknown type %d", mytype);
-			qexit(EXIT_FAILURE);
-		    }
-		    cols[i] = sqlite3_column_name(ppstmt, i);
-		}
-
-		retval = callback(callback_arg, ncol_result, type, results, cols);
-
-		//TODO: reuse arrays for the next row
-		free(type);
-		free(results);
-		free(cols);
-
-		if (retval)
-		{
-		    retval = SQLITE_ABORT;
-		    break;
-		}
-	    }
-	}
-	else
-	    break;
-    } while (try_num < DB_MAX_RETRIES);
 
-    switch(retval)
-    {
-    case SQLITE_BUSY:
-	printlog("ERROR: db busy! Exceeded max calls (%d) to fetch data", try_num);
-	break;
+/* returns the project with this name or NULL if it does not exist.
+ * The caller holds the table lock.
+ */
+static struct db_project_s *db_nolock__get_project(const char *projname)
+{
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project && project->is_removed)
+	project = NULL;
 
-    case SQLITE_ROW:
-	/* error: there has been data available,
-	 * but the program broke out of the loop?
-	 */
-	assert(0);
-	break;
+    return project;
+}
 
-    case SQLITE_ERROR:
-	/* there has been a data error. Print out and reset() the statement */
+
+/* creates a removed project entry and publishes it in the project hash.
+ * The caller holds the table lock.
+ */
+static struct db_project_s *db_nolock__create_project_entry(const char *projname)
+{
+    struct db_project_s *project = calloc(1, sizeof(*project));
+    assert(project);
+    if ( !project )
     {
-	const char *sql = db_select_statement[sid];
-	printlog("ERROR: stepping sql statement '%s': %s", sql, sqlite3_errstr(retval));
-	if (db_exit_on_error)
-	{
-	    printlog("exiting..");
-	    qexit(EXIT_FAILURE);
-	}
-	else
-	{
-	    retval = sqlite3_reset(ppstmt);
-	    if (SQLITE_OK != retval)
-	    {
-		printlog("ERROR: resetting sql statement '%s': %s", sql, sqlite3_errstr(retval));
-	    }
-	}
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
     }
-    break;
+    TAILQ_INIT(&project->processes);
+    TAILQ_INIT(&project->idle);
+    db_mutex_init_or_exit(&project->lock);
+    project->name = db_strdup(projname);
+    project->configpath = db_strdup("");
+    project->configbasename = db_strdup("");
+    project->is_removed = 1;
 
-    case SQLITE_MISUSE:
-	/* the statement has been incorrect */
-	printlog("ERROR: misuse of prepared sql statement '%s'", db_select_statement[sid]);
-	if (db_exit_on_error)
-	{
-	    printlog("exiting..");
-	    qexit(EXIT_FAILURE);
-	}
-	break;
+    TAILQ_INSERT_TAIL(&projectlist, project, entries);
 
-    case SQLITE_ABORT:
-	printlog("ERROR: abort in callback function during steps of sql '%s'", db_select_statement[sid]);
-	qexit(EXIT_FAILURE);
-	break;
+    struct db_project_s **bucket = &project_buckets[db_hash_name(projname) % DB_PROJECT_BUCKETS];
+    project->hash_next = *bucket;
+    __atomic_store_n(bucket, project, __ATOMIC_RELEASE);
 
-    case SQLITE_OK:
-    case SQLITE_DONE:
-	/* the statement has finished successfully */
-	retval = sqlite3_reset(ppstmt);
-	if (SQLITE_OK != retval)
-	{
-	    const char *sql = db_select_statement[sid];
-	    printlog("ERROR: resetting sql statement '%s': %s", sql, sqlite3_errstr(retval));
-	    qexit(EXIT_FAILURE);
-	}
-	break;
-    }
+    return project;
+}
 
-//    if ( !db_prepared_stmt[sid] )
-//	db_statement_finalize(ppstmt);
 
-    return 0;
+static void db_nolock__set_project_config(struct db_project_s *project, const char *path, const char *basenam, int watchd)
+{
+    free(project->configpath);
+    project->configpath = db_strdup(path);
+    free(project->configbasename);
+    project->configbasename = db_strdup(basenam);
+    project->watchd = watchd;
 }
 
 
-#define db_select_parameter(sid, ...)	\
-	db_select_parameter_callback(sid, NULL, NULL, ##__VA_ARGS__);
+static void db_project_lock(struct db_project_s *project)
+{
+    db_mutex_lock_or_exit(&project->lock);
+}
 
 
-/* prepare database stements for use */
-//static void db_statements_prepare(void)
-//{
-//    enum db_select_statement_id i;
-//    for (i=DB_SELECT_GET_NAMES_FROM_PROJECT; i<DB_SELECT_ID_MAX; i++)
-//    {
-//	sqlite3_stmt *ppstmt = db_statement_prepare(i);
-//	db_prepared_stmt[i] = ppstmt;
-//    }
-//}
+static void db_project_unlock(struct db_project_s *project)
+{
+    db_mutex_unlock_or_exit(&project->lock);
+}
 
 
-static pid_t db_nolock__get_process(const char *projname, enum db_process_list_e list, enum db_process_state_e state)
+static struct db_pid_bucket_s *db_get_pid_bucket(pid_t pid)
 {
-    assert(state < PROCESS_STATE_MAX);
-    assert(list < LIST_SELECTOR_MAX);
+    return &pid_buckets[(unsigned int)pid % DB_PID_BUCKETS];
+}
 
-    int get_process(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *proc = data;
 
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
+/* The caller holds the lock of the pid bucket */
+static struct db_process_s *db_nolock__find_process(struct db_pid_bucket_s *bucket, pid_t pid)
+{
+    struct db_process_s *proc;
+    LIST_FOREACH(proc, &bucket->processes, hash_entries)
+    {
+	if (proc->pid == pid)
+	    return proc;
+    }
 
-	*proc = results[0].integer;
+    return NULL;
+}
 
-	return 0;
-    }
 
-    pid_t ret = -1;
-    int mylist = list;
-    int mystate = state;
+/* returns the process with this pid and locks its project, or returns NULL
+ * if there is none. The caller unlocks the project.
+ */
+static struct db_process_s *db_lock_process(pid_t pid)
+{
+    struct db_process_s *proc = NULL;
+    if (0 < pid)
+    {
+	struct db_pid_bucket_s *bucket = db_get_pid_bucket(pid);
+	db_mutex_lock_or_exit(&bucket->lock);
 
-    db_select_parameter_callback(DB_SELECT_PROCESS_WITH_NAME_LIST_AND_STATE, get_process, &ret, projname, mylist, mystate);
+	proc = db_nolock__find_process(bucket, pid);
+	/* the process can not be removed as long as the project is locked */
+	if (proc)
+	    db_project_lock(proc->project);
 
-    debug(1, "returned %d", ret);
+	db_mutex_unlock_or_exit(&bucket->lock);
+    }
 
-    return ret;
+    return proc;
 }
 
 
-static int db_nolock__process_set_state(pid_t pid, enum db_process_state_e state, pthread_t threadid)
+static void db_unlock_process(struct db_process_s *proc)
 {
-    int ret = 0;
+    db_project_unlock(proc->project);
+}
 
-    if (0 > pid)
-    {
-	// do not execute DB update command with invalid pid
-	ret = -1;
-    }
-    else
-    {
-	// we need to type cast values to a "guaranteed" 64 bit value
-	// because the vararg parser assumes type "long long int" with "%l"
-	int mystate = state;
-	int mypid = pid;
-	long long int mythreadid = threadid;
-	db_select_parameter(DB_UPDATE_PROCESS_STATE, mystate, mythreadid, mypid);
-    }
 
-    return ret;
+/* keeps the process in the idle list of its project as long as it idles in
+ * the active list. The caller holds the lock of the project.
+ */
+static void db_nolock__process_update_idle(struct db_process_s *proc)
+{
+    int is_idle = (LIST_ACTIVE == proc->list && PROC_STATE_IDLE == proc->state);
+    if (is_idle && !proc->is_idle)
+	TAILQ_INSERT_HEAD(&proc->project->idle, proc, idle_entries);
+    else if (!is_idle && proc->is_idle)
+	TAILQ_REMOVE(&proc->project->idle, proc, idle_entries);
+    proc->is_idle = is_idle;
 }
 
 
-
-/* delete prepared statements */
-static void db_statements_finalize(void)
+/* The caller holds the lock of the project */
+static void db_nolock__process_set_list(struct db_process_s *proc, enum db_process_list_e list)
 {
-    enum db_select_statement_id i;
-    for (i=DB_SELECT_ID_NULL; i<DB_SELECT_ID_MAX; i++)
-    {
-	sqlite3_stmt *ppstmt = db_prepared_stmt[i];
-	db_statement_finalize(ppstmt);
+    assert(list < LIST_SELECTOR_MAX);
 
-	db_prepared_stmt[i] = NULL;
-    }
+    if ((LIST_ACTIVE == proc->list) != (LIST_ACTIVE == list))
+	proc->project->is_ring_changed = 1;
+    __atomic_fetch_sub(&num_list[proc->list], 1, __ATOMIC_RELAXED);
+    proc->list = list;
+    __atomic_fetch_add(&num_list[list], 1, __ATOMIC_RELAXED);
+    db_nolock__process_update_idle(proc);
 }
 
 
-/* called by sqlite3 function sqlite3_log()
- */
-static void db_log(void *obsolete, int result, const char *msg)
+/* The caller holds the lock of the project */
+static void db_nolock__process_set_state(struct db_process_s *proc, enum db_process_state_e state, pthread_t threadid)
 {
-    (void)obsolete;
-    /* TODO documentation says we have to be thread save.
-     * is it sufficient to rely on printlog(...) ?
-     */
-    debug(1, "SQlite3: retval %d, %s", result, msg);
+    assert(state < PROCESS_STATE_MAX);
+
+    __atomic_fetch_sub(&proc->project->num_state[proc->state], 1, __ATOMIC_RELAXED);
+    proc->state = state;
+    __atomic_fetch_add(&proc->project->num_state[state], 1, __ATOMIC_RELAXED);
+    proc->threadid = threadid;
+    db_nolock__process_update_idle(proc);
 }
 
 
-void db_init(void)
+/* sets the state of the process with this pid. Returns -1 if there is no
+ * such process.
+ */
+static int db_process_set_state_thread(pid_t pid, enum db_process_state_e state, pthread_t threadid)
 {
-    int retval = sqlite3_config(SQLITE_CONFIG_SERIALIZED);
-    if (SQLITE_OK != retval)
-    {
-	printlog("ERROR: calling sqlite3_config(): %s\n"
-		"Can not set thread safe access mode\n"
-		"Did you compile sqlite3 with 'SQLITE_THREADSAFE=1'?", sqlite3_errstr(retval));
-	qexit(EXIT_FAILURE);
-    }
+    int ret = -1;
 
-    retval = sqlite3_config(SQLITE_CONFIG_LOG, db_log, NULL);
-    if (SQLITE_OK != retval)
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
     {
-	printlog("ERROR: calling sqlite3_config(): %s\n"
-		"Can not set db log function", sqlite3_errstr(retval));
-	qexit(EXIT_FAILURE);
+	db_nolock__process_set_state(proc, state, threadid);
+	db_unlock_process(proc);
+	ret = 0;
     }
 
-    retval = sqlite3_initialize();
-    if (SQLITE_OK != retval)
-    {
-	printlog("ERROR: calling sqlite3_initialize(): %s", sqlite3_errstr(retval));
-	qexit(EXIT_FAILURE);
-    }
+    return ret;
+}
 
-    retval = sqlite3_open(":memory:", &dbhandler);
-    if (SQLITE_OK != retval)
-    {
-	printlog("ERROR: calling sqlite3_open(): %s", sqlite3_errstr(retval));
-	qexit(EXIT_FAILURE);
-    }
-    debug(1, "created memory db");
 
+/* The caller holds the table lock */
+static void db_nolock__remove_process(struct db_process_s *proc)
+{
+    struct db_project_s *project = proc->project;
+    struct db_pid_bucket_s *bucket = db_get_pid_bucket(proc->pid);
+
+    db_mutex_lock_or_exit(&bucket->lock);
+    db_project_lock(project);
+
+    if (proc->is_idle)
+	TAILQ_REMOVE(&project->idle, proc, idle_entries);
+    if (project->round_robin_next == proc)
+	project->round_robin_next = TAILQ_NEXT(proc, project_entries);
+    if (LIST_ACTIVE == proc->list)
+	project->is_ring_changed = 1;
+    LIST_REMOVE(proc, hash_entries);
+    TAILQ_REMOVE(&project->processes, proc, project_entries);
+    TAILQ_REMOVE(&processlist, proc, entries);
+    __atomic_fetch_sub(&project->num_state[proc->state], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&num_list[proc->list], 1, __ATOMIC_RELAXED);
+
+    db_project_unlock(project);
+    db_mutex_unlock_or_exit(&bucket->lock);
+
+    free(proc);
+}
 
-    /* initialize the condition variable timeout clock attribute with the same
-     * value we use in the clock measurements. Else if we don't we have
-     * different timeout values (clock module <-> pthread condition timeout)
-     */
-    pthread_condattr_t	condattr;
-    retval = pthread_condattr_init(&condattr);
-    if (retval)
-    {
-	errno = retval;
-	logerror("ERROR: pthread_condattr_init");
-	qexit(EXIT_FAILURE);
-    }
-    retval = pthread_condattr_setclock(&condattr, get_valid_clock_id());
-    if (retval)
-    {
-	errno = retval;
-	logerror("ERROR: pthread_condattr_setclock() id %d", get_valid_clock_id());
-	qexit(EXIT_FAILURE);
-    }
-    retval = pthread_cond_init(&idle_process_condition, &condattr);
-    if (retval)
-    {
-	errno = retval;
-	logerror("ERROR: pthread_cond_init");
-	qexit(EXIT_FAILURE);
-    }
-    retval = pthread_condattr_destroy(&condattr);
-    if (retval)
+
+void db_init(void)
+{
+    int i;
+    for (i=0; i<DB_PID_BUCKETS; i++)
     {
-	errno = retval;
-	logerror("ERROR: pthread_condattr_destroy");
-	qexit(EXIT_FAILURE);
+	db_mutex_init_or_exit(&pid_buckets[i].lock);
+	LIST_INIT(&pid_buckets[i].processes);
     }
 
-
-    /* setup all tables */
-    db_select_parameter(DB_SELECT_CREATE_PROJECT_TABLE);
-
-    db_select_parameter(DB_SELECT_CREATE_PROCESS_TABLE);
-
-    /* prepare further statements */
-//    db_statements_prepare();
+    debug(1, "created memory db");
 }
 
 
 void db_delete(void)
 {
-    /* remove the projects */
-
     debug(1, "shutdown memory db");
-    db_statements_finalize();
 
-    int retval = sqlite3_close(dbhandler);
-    if (SQLITE_OK != retval)
-    {
-	printlog("ERROR: calling sqlite3_close(): %s", sqlite3_errstr(retval));
-	qexit(EXIT_FAILURE);
-    }
-    dbhandler = NULL;
+    db_global_lock();
 
-    retval = sqlite3_shutdown();
-    if (SQLITE_OK != retval)
+    struct db_process_s *proc;
+    while ((proc = TAILQ_FIRST(&processlist)) != NULL)
+	db_nolock__remove_process(proc);
+
+    struct db_project_s *project;
+    while ((project = TAILQ_FIRST(&projectlist)) != NULL)
     {
-	printlog("ERROR: calling sqlite3_shutdown(): %s", sqlite3_errstr(retval));
-	qexit(EXIT_FAILURE);
+	TAILQ_REMOVE(&projectlist, project, entries);
+	pthread_mutex_destroy(&project->lock);
+	free(project->name);
+	free(project->configpath);
+	free(project->configbasename);
+	free(project->ring);
+	free(project);
     }
+    memset(project_buckets, 0, sizeof(project_buckets));
+
+    int i;
+    for (i=0; i<DB_PID_BUCKETS; i++)
+	pthread_mutex_destroy(&pid_buckets[i].lock);
+
+    db_global_unlock();
 }
 
 
@@ -893,9 +524,23 @@ void db_add_project(const char *projname)
 
     db_global_lock();
 
-    db_exit_on_error = 1;	// exit on error
-    db_select_parameter(DB_INSERT_PROJECT_DATA, projname);
-    db_exit_on_error = 0;	// reset exit flag
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if ( !project )
+    {
+	project = db_nolock__create_project_entry(projname);
+    }
+    else if ( !project->is_removed )
+    {
+	printlog("ERROR: project '%s' already exists in db", projname);
+	qexit(EXIT_FAILURE);
+    }
+    else
+    {
+	/* the project is back again, it starts at the end of the list */
+	TAILQ_REMOVE(&projectlist, project, entries);
+	TAILQ_INSERT_TAIL(&projectlist, project, entries);
+    }
+    project->is_removed = 0;
 
     db_global_unlock();
 }
@@ -906,38 +551,27 @@ int db_get_names_project(char ***projname, int *len)
     assert(projname);
     assert(len);
 
-    struct data_s
-    {
-	char **array;
-	int arraysize;
-	int num;
-    };
-
-    int get_names_list(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	struct data_s *mydata = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_TEXT == type[0]);
-
-	char *str = strdup((const char *)results[0].text);
-	arraycat(&mydata->array, &mydata->arraysize, &mydata->num, &str, sizeof(str));
-
-	return 0;
-    }
-
-
-    struct data_s data = {0};
+    char **array = NULL;
+    int arraysize = 0;
+    int num = 0;
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_SELECT_GET_NAMES_FROM_PROJECT, get_names_list, &data);
+    struct db_project_s *project;
+    TAILQ_FOREACH(project, &projectlist, entries)
+    {
+	if ( !project->is_removed )
+	{
+	    char *str = db_strdup(project->name);
+	    arraycat(&array, &arraysize, &num, &str, sizeof(str));
+	}
+    }
 
     db_global_unlock();
 
-    debug(1, "select found %d project names", data.num);
-    *projname = data.array;
-    *len = data.num;
+    debug(1, "select found %d project names", num);
+    *projname = array;
+    *len = num;
 
     return 0;
 }
@@ -957,13 +591,22 @@ void db_free_names_project(char **projname, int len)
 }
 
 
+/* The entry of the project is kept. The processes of the project may still be
+ * in the shutdown list, and the requests find the project without lock.
+ */
 void db_remove_project(const char *projname)
 {
     assert(projname);
 
     db_global_lock();
 
-    db_select_parameter(DB_DELETE_PROJECT_DATA, projname);
+    struct db_project_s *project = db_nolock__get_project(projname);
+    if (project)
+    {
+	project->is_removed = 1;
+	project->nr_crashs = 0;
+	db_nolock__set_project_config(project, "", "", 0);
+    }
 
     db_global_unlock();
 
@@ -974,23 +617,13 @@ char *db_get_configpath_from_project(const char *projname)
 {
     assert(projname);
 
-    int get_configpath_from_project(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	const char **path = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_TEXT == type[0]);
-
-	*path = strdup((const char *)results[0].text);
-
-	return 0;
-    }
-
     char *ret = NULL;
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_SELECT_CONFIGPATH_WITH_PROJECT, get_configpath_from_project, &ret, projname);
+    struct db_project_s *project = db_nolock__get_project(projname);
+    if (project)
+	ret = db_strdup(project->configpath);
 
     db_global_unlock();
 
@@ -1008,36 +641,64 @@ void db_add_process(const char *projname, pid_t pid, int process_socket_fd)
 
     db_global_lock();
 
-    db_select_parameter(DB_INSERT_PROCESS_DATA, projname, LIST_INIT, PROC_STATE_START, pid, process_socket_fd);
+    struct db_pid_bucket_s *bucket = db_get_pid_bucket(pid);
+    db_mutex_lock_or_exit(&bucket->lock);
 
-    db_global_unlock();
-}
+    if (db_nolock__find_process(bucket, pid))
+    {
+	printlog("ERROR: process %d already exists in db", pid);
+    }
+    else
+    {
+	struct db_project_s *project = db_nolock__find_project_entry(projname);
+	if ( !project )
+	    project = db_nolock__create_project_entry(projname);
 
+	struct db_process_s *proc = calloc(1, sizeof(*proc));
+	assert(proc);
+	if ( !proc )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	proc->project = project;
+	proc->pid = pid;
+	proc->list = LIST_INIT;
+	proc->state = PROC_STATE_START;
+	proc->process_socket_fd = process_socket_fd;
+	proc->client_socket_fd = -1;
+
+	db_project_lock(project);
+
+	LIST_INSERT_HEAD(&bucket->processes, proc, hash_entries);
+	TAILQ_INSERT_TAIL(&project->processes, proc, project_entries);
+	TAILQ_INSERT_TAIL(&processlist, proc, entries);
+	__atomic_fetch_add(&project->num_state[proc->state], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&num_list[proc->list], 1, __ATOMIC_RELAXED);
+
+	db_project_unlock(project);
+    }
+
+    db_mutex_unlock_or_exit(&bucket->lock);
 
-//int db_get_num_idle_process(const char *projname);
+    db_global_unlock();
+}
 
 
 char *db_get_project_for_this_process(pid_t pid)
 {
-    int get_projectname(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	const char **projname = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_TEXT == type[0]);
-
-	*projname = strdup((const char *)results[0].text);
-
-	return 0;
-    }
-
     char *ret = NULL;
 
-    db_global_lock();
+    /* the project of the process does not change, the lock of the bucket
+     * keeps the process */
+    struct db_pid_bucket_s *bucket = db_get_pid_bucket(pid);
+    db_mutex_lock_or_exit(&bucket->lock);
 
-    db_select_parameter_callback(DB_SELECT_PROJECT_WITH_PID, get_projectname, &ret, pid);
+    struct db_process_s *proc = db_nolock__find_process(bucket, pid);
+    if (proc)
+	ret = db_strdup(proc->project->name);
 
-    db_global_unlock();
+    db_mutex_unlock_or_exit(&bucket->lock);
 
     debug(1, "returned %s", ret);
 
@@ -1045,143 +706,246 @@ char *db_get_project_for_this_process(pid_t pid)
 }
 
 
-/* find a process in a certain list with a distinct state
- * Note:
- * Using the pid as key index value may create problems, if a process dies
- * and another process gets the same pid.
- * This should be handled by the manager which evaluates the SIGCHLD signal.
- */
-//pid_t db_get_process(const char *projname, enum db_process_list_e list, enum db_process_state_e state)
-//{
-//    int retval = pthread_mutex_lock(&db_lock);
-//    if (retval)
-//    {
-//	errno = retval;
-//	logerror("ERROR: acquire mutex lock");
-//	qexit(EXIT_FAILURE);
-//    }
-//
-//    pid_t ret = db_nolock__get_process(projname, list, state);
-//
-//    retval = pthread_mutex_unlock(&db_lock);
-//    if (retval)
-//    {
-//	errno = retval;
-//	logerror("ERROR: unlock mutex lock");
-//	qexit(EXIT_FAILURE);
-//    }
-//
-//    return ret;
-//}
-
-
-pid_t db_get_next_idle_process_for_busy_work(const char *projname, int timeoutsec)
+void db_set_project_process_select(const char *projname, enum db_process_select_e select)
 {
     assert(projname);
+    assert(select < PROCESS_SELECT_MAX);
 
-    pid_t ret = -1;
-
-    int retval = pthread_mutex_lock(&idle_process_mutex);
-    if (retval)
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project)
     {
-	errno = retval;
-	logerror("ERROR: can not lock mutex");
-	qexit(EXIT_FAILURE);
+	db_project_lock(project);
+	project->select = select;
+	db_project_unlock(project);
     }
+}
 
-    db_global_lock();
 
-    ret = db_nolock__get_process(projname, LIST_ACTIVE, PROC_STATE_IDLE);
-    if (0 < ret)
+/* returns the idle process chosen by the selection policy of the project
+ * or NULL. The caller holds the lock of the project.
+ */
+static struct db_process_s *db_nolock__select_idle_process(struct db_project_s *project)
+{
+    struct db_process_s *ret = NULL;
+    struct db_process_s *proc;
+
+    switch (project->select)
     {
-	db_nolock__process_set_state(ret, PROC_STATE_BUSY, 0);
+    case SELECT_LRU:
+	ret = TAILQ_LAST(&project->idle, db_project_idle_list_s);
+	break;
+
+    case SELECT_ROUND_ROBIN:
+	if (TAILQ_EMPTY(&project->idle))
+	    break;
+	/* walk the processes once, starting behind the last one taken */
+	proc = project->round_robin_next;
+	if ( !proc )
+	    proc = TAILQ_FIRST(&project->processes);
+	while ( !proc->is_idle )
+	{
+	    proc = TAILQ_NEXT(proc, project_entries);
+	    if ( !proc )
+		proc = TAILQ_FIRST(&project->processes);
+	}
+	ret = proc;
+	project->round_robin_next = TAILQ_NEXT(proc, project_entries);
+	break;
 
-	db_global_unlock();
+    case SELECT_LEAST_SERVED:
+	/* the last idle process wins if the numbers are equal */
+	TAILQ_FOREACH(proc, &project->idle, idle_entries)
+	{
+	    if ( !ret || proc->requests < ret->requests )
+		ret = proc;
+	}
+	break;
+
+    case SELECT_MRU:
+    default:
+	ret = TAILQ_FIRST(&project->idle);
+	break;
     }
-    else
+
+    return ret;
+}
+
+
+/* position of the point number "num" of the process on the hash ring */
+static uint32_t db_ring_hash(pid_t pid, int num)
+{
+    uint32_t hash = (uint32_t)pid * 2654435761u + (uint32_t)num * 40503u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+
+static int db_ring_compare(const void *a, const void *b)
+{
+    const struct db_ring_point_s *pa = a;
+    const struct db_ring_point_s *pb = b;
+
+    return (pa->hash > pb->hash) - (pa->hash < pb->hash);
+}
+
+
+/* builds the hash ring of the active processes anew if they changed.
+ * The caller holds the lock of the project.
+ */
+static void db_nolock__update_ring(struct db_project_s *project)
+{
+    if ( !project->is_ring_changed )
+	return;
+
+    int num = 0;
+    struct db_process_s *proc;
+    TAILQ_FOREACH(proc, &project->processes, project_entries)
+    {
+	if (LIST_ACTIVE == proc->list)
+	    num++;
+    }
+
+    if (num * DB_RING_POINTS > project->ring_size)
     {
-	/* unsuccesful tried for idle process. conditional wait for some
-	 * process becoming idle.
-	 */
-	db_global_unlock();
-
-	debug(1, "no active process found, wait on condition for %d sec", timeoutsec);
-	struct timespec mytimeout = { tv_sec: timeoutsec, tv_nsec: 0 };
-	struct timespec now;
-	retval = qgis_timer_start(&now);
-	if (-1 == retval)
+	struct db_ring_point_s *ring = realloc(project->ring, num * DB_RING_POINTS * sizeof(*ring));
+	assert(ring);
+	if ( !ring )
 	{
-	    logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	    logerror("ERROR: could not allocate memory");
 	    qexit(EXIT_FAILURE);
 	}
-	qgis_timer_add(&mytimeout, &now);
+	project->ring = ring;
+	project->ring_size = num * DB_RING_POINTS;
+    }
 
-	retval = pthread_cond_timedwait(&idle_process_condition, &idle_process_mutex, &mytimeout);
-	if ( 0 != retval )
+    int len = 0;
+    TAILQ_FOREACH(proc, &project->processes, project_entries)
+    {
+	if (LIST_ACTIVE == proc->list)
 	{
-	    /* error during condition wait */
-	    if (ETIMEDOUT != retval)
+	    int i;
+	    for (i=0; i<DB_RING_POINTS; i++, len++)
 	    {
-		errno = retval;
-		logerror("ERROR: can not wait on condition");
-		qexit(EXIT_FAILURE);
-	    }
-	    /* else timeout: just return -1 for pid as error value */
-	    else
-	    {
-		debug(1, "condition timed out");
+		project->ring[len].hash = db_ring_hash(proc->pid, i);
+		project->ring[len].proc = proc;
 	    }
 	}
-	else
-	{
-	    /* got the condition within the timeout value
-	     * get the next idle process
-	     */
-	    db_global_lock();
-
-	    ret = db_nolock__get_process(projname, LIST_ACTIVE, PROC_STATE_IDLE);
+    }
+    qsort(project->ring, len, sizeof(*project->ring), db_ring_compare);
+    project->ring_len = len;
+    project->is_ring_changed = 0;
+}
 
-	    if (0 < ret)
-		db_nolock__process_set_state(ret, PROC_STATE_BUSY, 0);
 
-	    db_global_unlock();
-	}
+/* returns the idle process the key maps to on the hash ring. If the process
+ * is busy the next processes on the ring are tried, up to DB_RING_CHOICES
+ * processes. Returns NULL if none of them is idle.
+ * The caller holds the lock of the project.
+ */
+static struct db_process_s *db_nolock__select_affine_process(struct db_project_s *project, uint32_t key)
+{
+    db_nolock__update_ring(project);
+    if ( !project->ring_len )
+	return NULL;
+
+    /* the first point at or after the key */
+    int low = 0;
+    int high = project->ring_len;
+    while (low < high)
+    {
+	int mid = low + (high - low) / 2;
+	if (project->ring[mid].hash < key)
+	    low = mid + 1;
+	else
+	    high = mid;
     }
 
-    retval = pthread_mutex_unlock(&idle_process_mutex);
-    if (retval)
+    struct db_process_s *tried[DB_RING_CHOICES];
+    int num_tried = 0;
+    int i;
+    for (i=0; i<project->ring_len && num_tried<DB_RING_CHOICES; i++)
     {
-	errno = retval;
-	logerror("ERROR: unlock mutex lock");
-	qexit(EXIT_FAILURE);
+	struct db_process_s *proc = project->ring[(low + i) % project->ring_len].proc;
+	if (proc->is_idle)
+	    return proc;
+
+	int j;
+	for (j=0; j<num_tried && tried[j]!=proc; j++)
+	    ;
+	if (j == num_tried)
+	    tried[num_tried++] = proc;
     }
 
-    return ret;
+    return NULL;
 }
 
 
-/* return 0 if the pid is not in any of the process lists, 1 otherwise */
-int db_has_process(pid_t pid)
+/* returns the pid of an idle process which has been set to busy, or -1 if
+ * currently no process of this project is idle.
+ * A request with an affinity key (not 0) gets the process the key maps to
+ * if it is idle, then is_affinity_hit is set to 1. Else it gets the process
+ * of the selection policy of the project and is_affinity_hit is set to 0.
+ */
+pid_t db_try_get_affine_idle_process_for_busy_work(const char *projname, unsigned int key, int *is_affinity_hit)
 {
+    assert(projname);
+
+    pid_t ret = -1;
+    int is_hit = 0;
 
-    int has_process(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project)
     {
-	int *val = data;
+	db_project_lock(project);
 
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-	*val = 1;
+	struct db_process_s *proc = NULL;
+	if (key)
+	{
+	    proc = db_nolock__select_affine_process(project, key);
+	    is_hit = (NULL != proc);
+	}
+	if ( !proc )
+	    proc = db_nolock__select_idle_process(project);
+	if (proc)
+	{
+	    ret = proc->pid;
+	    proc->requests++;
+	    db_nolock__process_set_state(proc, PROC_STATE_BUSY, 0);
+	}
 
-	return 0;
+	db_project_unlock(project);
     }
 
-    int ret = 0;
+    if (is_affinity_hit)
+	*is_affinity_hit = is_hit;
 
-    db_global_lock();
+    return ret;
+}
 
-    db_select_parameter_callback(DB_GET_PROCESS_STATE, has_process, &ret, (int)pid);
 
-    db_global_unlock();
+/* returns the pid of an idle process which has been set to busy, or -1 if
+ * currently no process of this project is idle.
+ */
+pid_t db_try_get_next_idle_process_for_busy_work(const char *projname)
+{
+    return db_try_get_affine_idle_process_for_busy_work(projname, 0, NULL);
+}
+
+
+/* return 0 if the pid is not in any of the process lists, 1 otherwise */
+int db_has_process(pid_t pid)
+{
+    struct db_pid_bucket_s *bucket = db_get_pid_bucket(pid);
+    db_mutex_lock_or_exit(&bucket->lock);
+
+    int ret = (NULL != db_nolock__find_process(bucket, pid));
+
+    db_mutex_unlock_or_exit(&bucket->lock);
 
     debug(1, "pid = %d returned %d", pid, ret);
 
@@ -1191,51 +955,92 @@ int db_has_process(pid_t pid)
 
 int db_get_process_socket(pid_t pid)
 {
+    int ret = -1;
 
-    int get_process_socket(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *socket = data;
+    /* the socket does not change, the lock of the bucket keeps the process */
+    struct db_pid_bucket_s *bucket = db_get_pid_bucket(pid);
+    db_mutex_lock_or_exit(&bucket->lock);
 
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-	*socket = results[0].integer;
+    struct db_process_s *proc = db_nolock__find_process(bucket, pid);
+    if (proc)
+	ret = proc->process_socket_fd;
 
-	return 0;
-    }
+    db_mutex_unlock_or_exit(&bucket->lock);
 
-    int ret = -1;
+    return ret;
+}
 
-    db_global_lock();
 
-    db_select_parameter_callback(DB_GET_PROCESS_SOCKET_FROM_PROCESS, get_process_socket, &ret, (int)pid);
+/* The client socket is the kept open fcgi connection from the scheduler to
+ * the child process. It is stored here while the process is idle. The
+ * connection handler takes the socket together with the process and hands it
+ * back if the connection can be reused.
+ * The kernel buffer size of the socket is stored with it, so it has to be
+ * read only once per connection.
+ */
 
-    db_global_unlock();
+/* returns the stored client socket of the process and removes it from the
+ * process entry. Returns -1 if no socket is stored.
+ * bufsize may be NULL.
+ */
+int db_process_take_client_socket(pid_t pid, int *bufsize)
+{
+    int ret = -1;
+    int mybufsize = 0;
+
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	ret = proc->client_socket_fd;
+	mybufsize = proc->client_socket_bufsize;
+	proc->client_socket_fd = -1;
+	proc->client_socket_bufsize = 0;
+	db_unlock_process(proc);
+    }
+
+    if (bufsize)
+	*bufsize = mybufsize;
 
     return ret;
 }
 
 
-enum db_process_state_e db_get_process_state(pid_t pid)
+/* stores the client socket in the process entry.
+ * Returns 0 on success. Returns -1 if the process is about to end or another
+ * socket is already stored, the caller has to close the socket then.
+ */
+int db_process_store_client_socket(pid_t pid, int fd, int bufsize)
 {
+    assert(fd >= 0);
 
-    int get_process_state(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	enum db_process_state_e *state = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-	*state = results[0].integer;
+    int ret = -1;
 
-	return 0;
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	if (-1 == proc->client_socket_fd && proc->state < PROC_STATE_TERM)
+	{
+	    proc->client_socket_fd = fd;
+	    proc->client_socket_bufsize = bufsize;
+	    ret = 0;
+	}
+	db_unlock_process(proc);
     }
 
-    enum db_process_state_e ret = PROCESS_STATE_MAX ;
+    return ret;
+}
 
-    db_global_lock();
 
-    db_select_parameter_callback(DB_GET_PROCESS_STATE, get_process_state, &ret, pid);
+enum db_process_state_e db_get_process_state(pid_t pid)
+{
+    enum db_process_state_e ret = PROCESS_STATE_MAX ;
 
-    db_global_unlock();
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	ret = proc->state;
+	db_unlock_process(proc);
+    }
 
     debug(1, "for process %d returned %d", pid, ret);
 
@@ -1247,15 +1052,7 @@ int db_process_set_state_init(pid_t pid, pthread_t thread_id)
 {
     int ret = 0;
 
-    // we need to copy values to a "guaranteed" 64 bit value
-    // because the vararg parser assumes type "long long int" with "%l"
-    long long threadid = thread_id;
-
-    db_global_lock();
-
-    db_nolock__process_set_state(pid, PROC_STATE_INIT, threadid);
-
-    db_global_unlock();
+    db_process_set_state_thread(pid, PROC_STATE_INIT, thread_id);
 
     return ret;
 
@@ -1266,36 +1063,29 @@ int db_process_set_state_idle(pid_t pid)
 {
     int ret = 0;
 
-    int retval = pthread_mutex_lock(&idle_process_mutex);
-    if (retval)
+    /* remember since when the process idles for the idle timeout */
+    struct timespec ts;
+    int retval = qgis_timer_start(&ts);
+    if (-1 == retval)
     {
-	errno = retval;
-	logerror("ERROR: can not lock mutex");
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
 	qexit(EXIT_FAILURE);
     }
 
-    db_global_lock();
-
-    db_nolock__process_set_state(pid, PROC_STATE_IDLE, 0);
-
-    db_global_unlock();
-
-    /* send notification to waiting processes */
-    retval = pthread_cond_signal(&idle_process_condition);
-    if (retval)
+    /* the project entry stays valid after unlock, it is never freed */
+    const char *projname = NULL;
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
     {
-	errno = retval;
-	logerror("ERROR: can not wait on condition");
-	qexit(EXIT_FAILURE);
+	db_nolock__process_set_state(proc, PROC_STATE_IDLE, 0);
+	proc->idletime_sec = ts.tv_sec;
+	projname = proc->project->name;
+	db_unlock_process(proc);
     }
 
-    retval = pthread_mutex_unlock(&idle_process_mutex);
-    if (retval)
-    {
-	errno = retval;
-	logerror("ERROR: unlock mutex lock");
-	qexit(EXIT_FAILURE);
-    }
+    /* hand the process to the next waiting request of its project */
+    if (projname)
+	admission_queue_notify(projname);
 
     return ret;
 }
@@ -1305,11 +1095,7 @@ int db_process_set_state_exit(pid_t pid)
 {
     int ret = 0;
 
-    db_global_lock();
-
-    db_nolock__process_set_state(pid, PROC_STATE_EXIT, 0);
-
-    db_global_unlock();
+    db_process_set_state_thread(pid, PROC_STATE_EXIT, 0);
 
     return ret;
 }
@@ -1320,11 +1106,7 @@ int db_process_set_state(pid_t pid, enum db_process_state_e state)
     assert(state < PROCESS_STATE_MAX);
     int ret = 0;
 
-    db_global_lock();
-
-    db_nolock__process_set_state(pid, state, 0);
-
-    db_global_unlock();
+    db_process_set_state_thread(pid, state, 0);
 
     return ret;
 }
@@ -1335,25 +1117,11 @@ int db_get_num_process_by_status(const char *projname, enum db_process_state_e s
     assert(projname);
     assert(state < PROCESS_STATE_MAX);
 
-    int get_pid_by_status(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *num = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	(*num)++;
-
-	return 0;
-    }
-
     int ret = 0;
 
-    db_global_lock();
-
-    db_select_parameter_callback(DB_GET_STATE_PROCESS, get_pid_by_status, &ret, projname, (int)state);
-
-    db_global_unlock();
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project)
+	ret = __atomic_load_n(&project->num_state[state], __ATOMIC_RELAXED);
 
     debug(1, "returned %d", ret);
 
@@ -1366,9 +1134,6 @@ int db_get_num_active_process(const char *projname)
 {
     assert(projname);
 
-    /* intentional no lock here,
-     * Lock aquired in db_get_num_process_by_status()
-     */
     int ret = db_get_num_process_by_status(projname, PROC_STATE_BUSY);
 
     return ret;
@@ -1379,25 +1144,13 @@ int db_get_num_start_init_idle_process(const char *projname)
 {
     assert(projname);
 
-    int get_num_start_init_idle_process(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *num = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	*num = results[0].integer;
-
-	return 0;
-    }
-
     int ret = 0;
 
-    db_global_lock();
-
-    db_select_parameter_callback(DB_GET_NUM_START_INIT_IDLE_PROCESS, get_num_start_init_idle_process, &ret, projname);
-
-    db_global_unlock();
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project)
+	ret = __atomic_load_n(&project->num_state[PROC_STATE_START], __ATOMIC_RELAXED)
+	    + __atomic_load_n(&project->num_state[PROC_STATE_INIT], __ATOMIC_RELAXED)
+	    + __atomic_load_n(&project->num_state[PROC_STATE_IDLE], __ATOMIC_RELAXED);
 
     debug(1, "returned %d", ret);
 
@@ -1406,44 +1159,43 @@ int db_get_num_start_init_idle_process(const char *projname)
 }
 
 
-int db_get_complete_list_process(pid_t **pidlist, int *len)
+/* returns the pids of all processes in the list "list", or of all processes
+ * if "list" is LIST_SELECTOR_MAX. The caller holds the table lock.
+ */
+static void db_nolock__get_list_process(pid_t **pidlist, int *len, enum db_process_list_e list)
 {
-    assert(pidlist);
-    assert(len);
-
-    struct data_s
-    {
-	pid_t *array;
-	int arraysize;
-	int num;
-    };
+    pid_t *array = NULL;
+    int arraysize = 0;
+    int num = 0;
 
-    int get_pid_list(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
+    struct db_process_s *proc;
+    TAILQ_FOREACH(proc, &processlist, entries)
     {
-	struct data_s *mydata = data;
+	db_project_lock(proc->project);
+	int is_match = (LIST_SELECTOR_MAX == list || proc->list == list);
+	db_project_unlock(proc->project);
 
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	pid_t pid = results[0].integer;
-	arraycat(&mydata->array, &mydata->arraysize, &mydata->num, &pid, sizeof(pid));
-
-	return 0;
+	if (is_match)
+	    arraycat(&array, &arraysize, &num, &proc->pid, sizeof(proc->pid));
     }
 
+    debug(1, "select found %d processes", num);
+    *len = num;
+    *pidlist = array;
+}
 
-    struct data_s data = {0};
+
+int db_get_complete_list_process(pid_t **pidlist, int *len)
+{
+    assert(pidlist);
+    assert(len);
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_ALL_PROCESS, get_pid_list, &data);
+    db_nolock__get_list_process(pidlist, len, LIST_SELECTOR_MAX);
 
     db_global_unlock();
 
-    debug(1, "select found %d processes", data.num);
-    *len = data.num;
-    *pidlist = data.array;
-
     return 0;
 }
 
@@ -1454,39 +1206,12 @@ int db_get_list_process_by_list(pid_t **pidlist, int *len, enum db_process_list_
     assert(len);
     assert(list < LIST_SELECTOR_MAX);
 
-    struct data_s
-    {
-	pid_t *array;
-	int arraysize;
-	int num;
-    };
-
-    int get_pid_list(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	struct data_s *mydata = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	pid_t pid = results[0].integer;
-	arraycat(&mydata->array, &mydata->arraysize, &mydata->num, &pid, sizeof(pid));
-
-	return 0;
-    }
-
-
-    struct data_s data = {0};
-
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_PROCESS_FROM_LIST, get_pid_list, &data, (int)list);
+    db_nolock__get_list_process(pidlist, len, list);
 
     db_global_unlock();
 
-    debug(1, "select found %d processes", data.num);
-    *len = data.num;
-    *pidlist = data.array;
-
     return 0;
 }
 
@@ -1503,11 +1228,12 @@ void db_move_process_to_list(enum db_process_list_e list, pid_t pid)
     assert(LIST_SELECTOR_MAX > list);
     assert(0 < pid);
 
-    db_global_lock();
-
-    db_select_parameter(DB_UPDATE_PROCESS_LIST_PID, list, pid);
-
-    db_global_unlock();
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	db_nolock__process_set_list(proc, list);
+	db_unlock_process(proc);
+    }
 }
 
 
@@ -1515,46 +1241,108 @@ enum db_process_list_e db_get_process_list(pid_t pid)
 {
     assert(0 < pid);
 
-    int get_list_pid(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
+    enum db_process_list_e ret = LIST_SELECTOR_MAX;
+
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	ret = proc->list;
+	db_unlock_process(proc);
+    }
+
+    debug(1, "returned %d", ret);
+
+    return ret;
+}
+
+
+/* moves all processes of the project from list "from" to list "to" */
+static void db_move_project_list(const char *projname, enum db_process_list_e from, enum db_process_list_e to)
+{
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project)
     {
-	enum db_process_list_e *list = data;
+	db_project_lock(project);
 
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-	*list = results[0].integer;
+	struct db_process_s *proc;
+	TAILQ_FOREACH(proc, &project->processes, project_entries)
+	{
+	    if (from == proc->list)
+		db_nolock__process_set_list(proc, to);
+	}
 
-	return 0;
+	db_project_unlock(project);
     }
+}
 
-    enum db_process_list_e ret = LIST_SELECTOR_MAX;
-
-    db_global_lock();
 
-    db_select_parameter_callback(DB_GET_LIST_FROM_PROCESS, get_list_pid, &ret, (int)pid);
+/* processes in the init list with state idle are done with the initialization.
+ * move these processes to the active list to be picked up for net responses.
+ */
+void db_move_all_idle_process_from_init_to_active_list(const char *projname)
+{
+    assert(projname);
+    debug(1, "project '%s'", projname);
 
-    db_global_unlock();
+    db_move_project_list(projname, LIST_INIT, LIST_ACTIVE);
 
-    debug(1, "returned %d", ret);
+    qgis_shutdown_notify_changes();
 
-    return ret;
+    /* the new processes can answer the waiting requests now */
+    admission_queue_notify(projname);
 }
 
 
-/* processes in the init list with state idle are done with the initialization.
- * move these processes to the active list to be picked up for net responses.
+/* moves the process of the project which idles the longest time to the
+ * shutdown list, if it idles for at least "idle_sec" seconds.
+ * Returns the pid of the moved process or -1 if there is none.
  */
-void db_move_all_idle_process_from_init_to_active_list(const char *projname)
+pid_t db_move_idle_process_in_timeout_to_shutdown_list(const char *projname, int idle_sec)
 {
     assert(projname);
-    debug(1, "project '%s'", projname);
+    assert(0 < idle_sec);
 
-    db_global_lock();
+    struct timespec ts;
+    int retval = qgis_timer_start(&ts);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    long long int idletime = ts.tv_sec - idle_sec;
 
-    db_select_parameter(DB_UPDATE_PROCESS_LISTS_WITH_NAME_AND_LIST, LIST_ACTIVE, projname, LIST_INIT);
+    pid_t ret = -1;
 
-    db_global_unlock();
+    struct db_project_s *project = db_nolock__find_project_entry(projname);
+    if (project)
+    {
+	/* select and move under the same lock, so no request takes the
+	 * process in between */
+	db_project_lock(project);
 
-    qgis_shutdown_notify_changes();
+	struct db_process_s *oldest = NULL;
+	struct db_process_s *proc;
+	TAILQ_FOREACH(proc, &project->idle, idle_entries)
+	{
+	    if (proc->idletime_sec <= idletime
+		    && (!oldest || proc->idletime_sec < oldest->idletime_sec))
+		oldest = proc;
+	}
+	if (oldest)
+	{
+	    db_nolock__process_set_list(oldest, LIST_SHUTDOWN);
+	    ret = oldest->pid;
+	}
+
+	db_project_unlock(project);
+    }
+
+    if (0 < ret)
+	qgis_shutdown_notify_changes();
+
+    debug(1, "project '%s' returned %d", projname, ret);
+
+    return ret;
 }
 
 
@@ -1565,11 +1353,7 @@ void db_move_all_process_from_active_to_shutdown_list(const char *projname)
     assert(projname);
     debug(1, "project '%s'", projname);
 
-    db_global_lock();
-
-    db_select_parameter(DB_UPDATE_PROCESS_LISTS_WITH_NAME_AND_LIST, LIST_SHUTDOWN, projname, LIST_ACTIVE);
-
-    db_global_unlock();
+    db_move_project_list(projname, LIST_ACTIVE, LIST_SHUTDOWN);
 
     qgis_shutdown_notify_changes();
 }
@@ -1582,11 +1366,7 @@ void db_move_all_process_from_init_to_shutdown_list(const char *projname)
     assert(projname);
     debug(1, "project '%s'", projname);
 
-    db_global_lock();
-
-    db_select_parameter(DB_UPDATE_PROCESS_LISTS_WITH_NAME_AND_LIST, LIST_SHUTDOWN, projname, LIST_INIT);
-
-    db_global_unlock();
+    db_move_project_list(projname, LIST_INIT, LIST_SHUTDOWN);
 
     qgis_shutdown_notify_changes();
 }
@@ -1596,34 +1376,19 @@ void db_move_all_process_to_list(enum db_process_list_e list)
 {
     assert(LIST_SELECTOR_MAX > list);
 
-    int mylist = list;
-
     db_global_lock();
 
-    db_select_parameter(DB_UPDATE_PROCESS_LIST, mylist);
+    struct db_process_s *proc;
+    TAILQ_FOREACH(proc, &processlist, entries)
+    {
+	db_project_lock(proc->project);
+	db_nolock__process_set_list(proc, list);
+	db_project_unlock(proc->project);
+    }
 
     db_global_unlock();
 }
 
-/* returns the next process (pid) which needs to be worked on.
- * This could be
- * (1) a process which is transferred from busy to idle state and needs a TERM signal
- * (2) a process which is not removed from RAM and needs a KILL signal after a timeout
- * (3) a process which is not removed from RAM after a timeout and need to be removed from the db
- */
-//pid_t db_get_shutdown_process_in_timeout(void)
-//{
-//    pid_t ret = -1;
-//
-//    struct qgis_process_s *proc = get_next_shutdown_proc(shutdownlist);
-//    if (proc)
-//    {
-//	ret = qgis_process_get_pid(proc);
-//    }
-//
-//    return ret;
-//}
-
 
 int db_reset_signal_timer(pid_t pid)
 {
@@ -1632,16 +1397,12 @@ int db_reset_signal_timer(pid_t pid)
     struct timespec ts;
     qgis_timer_start(&ts);
 
-    // we need to copy values to a "guaranteed" 64 bit value
-    // because the vararg parser assumes type "long long int" with "%l"
-    long long sec = ts.tv_sec;
-    long long nsec = ts.tv_nsec;
-
-    db_global_lock();
-
-    db_select_parameter(DB_UPDATE_PROCESS_SIGNAL_TIMER, sec, nsec, (int)pid);
-
-    db_global_unlock();
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	proc->signaltime = ts;
+	db_unlock_process(proc);
+    }
 
     return ret;
 }
@@ -1652,28 +1413,14 @@ int db_get_signal_timer(struct timespec *ts, pid_t pid)
     assert(ts);
     assert(0 < pid);
 
-    int get_signal_timer(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	struct timespec *ts = data;
-
-	assert(2 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-	assert(SQLITE_INTEGER == type[1]);
-
-	ts->tv_sec = results[0].integer;
-	ts->tv_nsec = results[1].integer;
-	debug(1, "in callback got timer value %ld,%03lds", ts->tv_sec, (ts->tv_nsec/(1000*1000)));
-
-	return 0;
-    }
-
     struct timespec timesp = {0,0};
 
-    db_global_lock();
-
-    db_select_parameter_callback(DB_SELECT_PROCESS_SIGNAL_TIMER, get_signal_timer, &timesp, pid);
-
-    db_global_unlock();
+    struct db_process_s *proc = db_lock_process(pid);
+    if (proc)
+    {
+	timesp = proc->signaltime;
+	db_unlock_process(proc);
+    }
 
     *ts = timesp;
 
@@ -1689,26 +1436,25 @@ void db_shutdown_get_min_signaltimer(struct timespec *maxtimeval)
 {
     assert(maxtimeval);
 
-    int get_signal_timer(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	struct timespec *ts = data;
-
-	assert(2 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-	assert(SQLITE_INTEGER == type[1]);
-
-	ts->tv_sec = results[0].integer;
-	ts->tv_nsec = results[1].integer;
-	    debug(1, "returned value %ld,%03lds", ts->tv_sec, (ts->tv_nsec/(1000*1000)));
-
-	return 0;
-    }
-
     struct timespec timesp = {0,0};
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_SELECT_PROCESS_MIN_SIGNAL_TIMER, get_signal_timer, &timesp);
+    const struct db_process_s *proc;
+    TAILQ_FOREACH(proc, &processlist, entries)
+    {
+	db_project_lock(proc->project);
+	const struct timespec ts = proc->signaltime;
+	db_project_unlock(proc->project);
+
+	if (0 != ts.tv_sec && 0 != ts.tv_nsec)
+	{
+	    if ( (0 == timesp.tv_sec && 0 == timesp.tv_nsec)
+		    || ts.tv_sec < timesp.tv_sec
+		    || (ts.tv_sec == timesp.tv_sec && ts.tv_nsec < timesp.tv_nsec) )
+		timesp = ts;
+	}
+    }
 
     db_global_unlock();
 
@@ -1720,30 +1466,11 @@ void db_shutdown_get_min_signaltimer(struct timespec *maxtimeval)
 
 int db_get_num_shutdown_processes(void)
 {
+    int num_list_shutdown = __atomic_load_n(&num_list[LIST_SHUTDOWN], __ATOMIC_RELAXED);
 
-    int get_num_shutdown_processes(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *num = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	*num = results[0].integer;
-
-	return 0;
-    }
-
-    int num_list = 0;
-
-    db_global_lock();
-
-    db_select_parameter_callback(DB_GET_NUM_PROCESS_FROM_LIST, get_num_shutdown_processes, &num_list, LIST_SHUTDOWN);
-
-    db_global_unlock();
-
-    debug(1, "returned %d", num_list);
+    debug(1, "returned %d", num_list_shutdown);
 
-    return num_list;
+    return num_list_shutdown;
 }
 
 
@@ -1753,7 +1480,20 @@ int db_remove_process_with_state_exit(void)
 
     db_global_lock();
 
-    db_select_parameter(DB_DELETE_PROCESS_WITH_STATE, PROC_STATE_EXIT);
+    struct db_process_s *proc = TAILQ_FIRST(&processlist);
+    while (proc)
+    {
+	struct db_process_s *next = TAILQ_NEXT(proc, entries);
+
+	db_project_lock(proc->project);
+	int is_exit = (PROC_STATE_EXIT == proc->state);
+	db_project_unlock(proc->project);
+
+	/* processes in state exit do not change any more */
+	if (is_exit)
+	    db_nolock__remove_process(proc);
+	proc = next;
+    }
 
     db_global_unlock();
 
@@ -1767,7 +1507,9 @@ void db_inc_startup_failures(const char *projname)
 
     db_global_lock();
 
-    db_select_parameter(DB_INC_PROJECT_STARTUP_FAILURE, projname);
+    struct db_project_s *project = db_nolock__get_project(projname);
+    if (project)
+	project->nr_crashs++;
 
     db_global_unlock();
 }
@@ -1777,24 +1519,13 @@ int db_get_startup_failures(const char *projname)
 {
     assert(projname);
 
-    int get_startup_failures(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *val = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	*val = results[0].integer;
-	debug(1, "returned value %d", *val);
-
-	return 0;
-    }
-
     int ret = -1;
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_SELECT_PROJECT_STARTUP_FAILURE, get_startup_failures, &ret, projname);
+    struct db_project_s *project = db_nolock__get_project(projname);
+    if (project)
+	ret = project->nr_crashs;
 
     db_global_unlock();
 
@@ -1810,7 +1541,9 @@ void db_reset_startup_failures(const char *projname)
 
     db_global_lock();
 
-    db_select_parameter(DB_RESET_PROJECT_STARTUP_FAILURE, projname);
+    struct db_project_s *project = db_nolock__get_project(projname);
+    if (project)
+	project->nr_crashs = 0;
 
     db_global_unlock();
 }
@@ -1821,12 +1554,14 @@ int db_add_new_inotify_path(const char *projectname, const char *path, int watch
     assert(projectname);
     assert(path);
 
-    char *buffer = strdup(path);
+    char *buffer = db_strdup(path);
     char *basenam = basename(buffer);
 
     db_global_lock();
 
-    db_select_parameter(DB_UPDATE_PROJECT_WITH_CONFIG_AND_WATCHD, path, basenam, watchd, projectname);
+    struct db_project_s *project = db_nolock__get_project(projectname);
+    if (project)
+	db_nolock__set_project_config(project, path, basenam, watchd);
 
     db_global_unlock();
 
@@ -1842,38 +1577,27 @@ void db_get_projects_for_watchd_and_config(char ***list, int *len, int watchd, c
     assert(len);
     assert(filename);
 
-    struct data_s
-    {
-	char **array;
-	int arraysize;
-	int num;
-    };
-
-    int get_names_list(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	struct data_s *mydata = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_TEXT == type[0]);
-
-	char *str = strdup((const char *)results[0].text);
-	arraycat(&mydata->array, &mydata->arraysize, &mydata->num, &str, sizeof(str));
-
-	return 0;
-    }
-
-
-    struct data_s data = {0};
+    char **array = NULL;
+    int arraysize = 0;
+    int num = 0;
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_PROJECTS_FOR_WATCHES_AND_CONFIGS, get_names_list, &data, watchd, filename);
+    const struct db_project_s *project;
+    TAILQ_FOREACH(project, &projectlist, entries)
+    {
+	if ( !project->is_removed && watchd == project->watchd && 0 == strcmp(filename, project->configbasename) )
+	{
+	    char *str = db_strdup(project->name);
+	    arraycat(&array, &arraysize, &num, &str, sizeof(str));
+	}
+    }
 
     db_global_unlock();
 
-    debug(1, "select found %d project names", data.num);
-    *len = data.num;
-    *list = data.array;
+    debug(1, "select found %d project names", num);
+    *len = num;
+    *list = array;
 
 }
 
@@ -1890,28 +1614,45 @@ void db_delete_projects_for_watchd_and_config(char **list, int len)
 }
 
 
-int db_get_watchd_from_config(const char *path)
+/* returns the watch descriptor of the first project with the config file
+ * "path", or -1 if there is none.
+ */
+static int db_nolock__get_watchd_from_config(const char *path)
 {
-    assert(path);
-
-    int get_watchd_from_config(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
+    const struct db_project_s *project;
+    TAILQ_FOREACH(project, &projectlist, entries)
     {
-	int *val = data;
+	if ( !project->is_removed && 0 == strcmp(path, project->configpath) )
+	    return project->watchd;
+    }
+
+    return -1;
+}
 
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
 
-	*val = results[0].integer;
-	debug(1, "returned value %d", *val);
+/* returns the number of projects with the watch descriptor */
+static int db_nolock__get_num_watchd(int watchd)
+{
+    int ret = 0;
 
-	return 0;
+    const struct db_project_s *project;
+    TAILQ_FOREACH(project, &projectlist, entries)
+    {
+	if ( !project->is_removed && watchd == project->watchd )
+	    ret++;
     }
 
-    int ret = -1;
+    return ret;
+}
+
+
+int db_get_watchd_from_config(const char *path)
+{
+    assert(path);
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_WATCHD_FROM_CONFIG, get_watchd_from_config, &ret, path);
+    int ret = db_nolock__get_watchd_from_config(path);
 
     db_global_unlock();
 
@@ -1925,24 +1666,13 @@ int db_get_watchd_from_project(const char *projectname)
 {
     assert(projectname);
 
-    int get_watchd_from_project(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *val = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	*val = results[0].integer;
-	debug(1, "returned value %d", *val);
-
-	return 0;
-    }
-
     int ret = -1;
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_WATCHD_FROM_PROJECT, get_watchd_from_project, &ret, projectname);
+    struct db_project_s *project = db_nolock__get_project(projectname);
+    if (project)
+	ret = project->watchd;
 
     db_global_unlock();
 
@@ -1956,24 +1686,16 @@ int db_get_num_watchd_from_config(const char *path)
 {
     assert(path);
 
-    int get_num_watchd_from_config(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *val = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	*val = results[0].integer;
-	debug(1, "returned value %d", *val);
-
-	return 0;
-    }
-
-    int ret = -1;
+    int ret = 0;
 
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_NUM_WATCHD_FROM_CONFIG, get_num_watchd_from_config, &ret, path);
+    /* all projects using the watch descriptors of the config file. The
+     * projects with the same config file have the same watch descriptor.
+     */
+    int watchd = db_nolock__get_watchd_from_config(path);
+    if (-1 != watchd)
+	ret = db_nolock__get_num_watchd(watchd);
 
     db_global_unlock();
 
@@ -1985,25 +1707,9 @@ int db_get_num_watchd_from_config(const char *path)
 
 int db_get_num_watchd_from_watchd(int watchd)
 {
-
-    int get_num_watchd_from_watchd(void *data, int ncol, int *type, union callback_result_t *results, const char**cols)
-    {
-	int *val = data;
-
-	assert(1 == ncol);
-	assert(SQLITE_INTEGER == type[0]);
-
-	*val = results[0].integer;
-	debug(1, "returned value %d", *val);
-
-	return 0;
-    }
-
-    int ret = -1;
-
     db_global_lock();
 
-    db_select_parameter_callback(DB_GET_NUM_WATCHD_FROM_WATCHD, get_num_watchd_from_watchd, &ret, watchd);
+    int ret = db_nolock__get_num_watchd(watchd);
 
     db_global_unlock();
 
@@ -2019,52 +1725,106 @@ void db_remove_inotify_path(const char *projectname)
 
     db_global_lock();
 
-    db_select_parameter(DB_UPDATE_PROJECT_WITH_CONFIG_AND_WATCHD, "", "", 0, projectname);
+    struct db_project_s *project = db_nolock__get_project(projectname);
+    if (project)
+	db_nolock__set_project_config(project, "", "", 0);
 
     db_global_unlock();
 }
 
 
+#ifdef DB_DUMP_SQLITE
 
-void db_dump(void)
+/* export the tables into a sqlite3 memory database and print them with sql */
+
+static const char *db_dump_statement[] =
 {
-    struct callback_data_s {
-	int has_printed_headline;
-	int bufferlen;
-	char *buffer;
-    };
+	"CREATE TABLE projects (name TEXT UNIQUE NOT NULL, configpath TEXT DEFAULT '', configbasename TEXT DEFAULT '', watchd INTEGER DEFAULT 0, nr_crashs INTEGER DEFAULT 0, process_select INTEGER DEFAULT 0)",
+	"CREATE TABLE processes (projectname TEXT REFERENCES projects (name), "
+	    "list INTEGER NOT NULL, state INTEGER NOT NULL, "
+	    "threadid INTEGER, pid INTEGER UNIQUE NOT NULL, "
+	    "process_socket_fd INTEGER NOT NULL, client_socket_fd INTEGER DEFAULT -1, "
+	    "client_socket_bufsize INTEGER DEFAULT 0, "
+	    "signaltime_sec INTEGER DEFAULT 0, signaltime_nsec INTEGER DEFAULT 0, "
+	    "idletime_sec INTEGER DEFAULT 0, requests INTEGER DEFAULT 0 )",
+};
+static const char db_dump_insert_project[] = "INSERT INTO projects VALUES (?,?,?,?,?,?)";
+static const char db_dump_insert_process[] = "INSERT INTO processes VALUES (?,?,?,?,?,?,?,?,?,?,?,?)";
+static const char db_dump_select_project[] = "SELECT * FROM projects ORDER BY name ASC";
+static const char db_dump_select_process[] = "SELECT * FROM processes ORDER BY projectname ASC, pid ASC";
+
 
-    int dump_tabledata(void *data, int ncol, char **results, char **cols)
+static void db_dump_check(sqlite3 *dumphandler, int retval, const char *sql)
+{
+    if (SQLITE_OK != retval && SQLITE_DONE != retval)
     {
-	struct callback_data_s *val = data;
-	int i;
-	if ( !val->has_printed_headline )
-	{
-	    for (i=0; i<ncol; i++)
-	    {
-		strnbcat(&val->buffer, &val->bufferlen, cols[i]);
-		strnbcat(&val->buffer, &val->bufferlen, ",\t");
-	    }
-	    val->has_printed_headline = 1;
-	}
-	strnbcat(&val->buffer, &val->bufferlen, "\n");
+	printlog("ERROR: dump sql statement '%s': %s", sql, sqlite3_errmsg(dumphandler));
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static sqlite3_stmt *db_dump_prepare(sqlite3 *dumphandler, const char *sql)
+{
+    sqlite3_stmt *ppstmt;
+    int retval = sqlite3_prepare_v2(dumphandler, sql, -1, &ppstmt, NULL);
+    db_dump_check(dumphandler, retval, sql);
+
+    return ppstmt;
+}
+
+
+static void db_dump_step(sqlite3 *dumphandler, sqlite3_stmt *ppstmt, const char *sql)
+{
+    int retval = sqlite3_step(ppstmt);
+    db_dump_check(dumphandler, retval, sql);
+    retval = sqlite3_reset(ppstmt);
+    db_dump_check(dumphandler, retval, sql);
+}
+
+
+struct db_dump_data_s {
+    int has_printed_headline;
+    int bufferlen;
+    char *buffer;
+};
+
+
+static int db_dump_tabledata(void *data, int ncol, char **results, char **cols)
+{
+    struct db_dump_data_s *val = data;
 
+    int i;
+    if ( !val->has_printed_headline )
+    {
 	for (i=0; i<ncol; i++)
 	{
-	    if (results[i])
-		strnbcat(&val->buffer, &val->bufferlen, results[i]);
-	    else
-		strnbcat(&val->buffer, &val->bufferlen, "NULL");
+	    strnbcat(&val->buffer, &val->bufferlen, cols[i]);
 	    strnbcat(&val->buffer, &val->bufferlen, ",\t");
 	}
-	strnbcat(&val->buffer, &val->bufferlen, "\n");
-
+	val->has_printed_headline = 1;
+    }
+    strnbcat(&val->buffer, &val->bufferlen, "\n");
 
-	return 0;
+    for (i=0; i<ncol; i++)
+    {
+	if (results[i])
+	    strnbcat(&val->buffer, &val->bufferlen, results[i]);
+	else
+	    strnbcat(&val->buffer, &val->bufferlen, "NULL");
+	strnbcat(&val->buffer, &val->bufferlen, ",\t");
     }
+    strnbcat(&val->buffer, &val->bufferlen, "\n");
+
+
+    return 0;
+}
 
+
+void db_dump(void)
+{
     static const int buffer_size = 1024;
-    struct callback_data_s data = {0};
+    struct db_dump_data_s data = {0};
 
     data.bufferlen = buffer_size;
     data.buffer = malloc(data.bufferlen);
@@ -2075,23 +1835,141 @@ void db_dump(void)
     }
     *data.buffer = '\0';	// empty string
 
+    sqlite3 *dumphandler = NULL;
+    int retval = sqlite3_open(":memory:", &dumphandler);
+    if (SQLITE_OK != retval)
+    {
+	printlog("ERROR: calling sqlite3_open(): %s", sqlite3_errstr(retval));
+	qexit(EXIT_FAILURE);
+    }
+
+    unsigned int i;
+    for (i=0; i<sizeof(db_dump_statement)/sizeof(*db_dump_statement); i++)
+    {
+	retval = sqlite3_exec(dumphandler, db_dump_statement[i], NULL, NULL, NULL);
+	db_dump_check(dumphandler, retval, db_dump_statement[i]);
+    }
+
+    sqlite3_stmt *projstmt = db_dump_prepare(dumphandler, db_dump_insert_project);
+    sqlite3_stmt *procstmt = db_dump_prepare(dumphandler, db_dump_insert_process);
+
     db_global_lock();
 
-    char *err;
-    const char *sql = db_select_statement[DB_DUMP_PROJECT];
+    const struct db_project_s *project;
+    TAILQ_FOREACH(project, &projectlist, entries)
+    {
+	if (project->is_removed)
+	    continue;
+	sqlite3_bind_text(projstmt, 1, project->name, -1, SQLITE_STATIC);
+	sqlite3_bind_text(projstmt, 2, project->configpath, -1, SQLITE_STATIC);
+	sqlite3_bind_text(projstmt, 3, project->configbasename, -1, SQLITE_STATIC);
+	sqlite3_bind_int(projstmt, 4, project->watchd);
+	sqlite3_bind_int(projstmt, 5, project->nr_crashs);
+	sqlite3_bind_int(projstmt, 6, project->select);
+	db_dump_step(dumphandler, projstmt, db_dump_insert_project);
+    }
+
+    const struct db_process_s *proc;
+    TAILQ_FOREACH(proc, &processlist, entries)
+    {
+	db_project_lock(proc->project);
+	sqlite3_bind_text(procstmt, 1, proc->project->name, -1, SQLITE_STATIC);
+	sqlite3_bind_int(procstmt, 2, proc->list);
+	sqlite3_bind_int(procstmt, 3, proc->state);
+	sqlite3_bind_int64(procstmt, 4, (long long int)proc->threadid);
+	sqlite3_bind_int(procstmt, 5, proc->pid);
+	sqlite3_bind_int(procstmt, 6, proc->process_socket_fd);
+	sqlite3_bind_int(procstmt, 7, proc->client_socket_fd);
+	sqlite3_bind_int(procstmt, 8, proc->client_socket_bufsize);
+	sqlite3_bind_int64(procstmt, 9, proc->signaltime.tv_sec);
+	sqlite3_bind_int64(procstmt, 10, proc->signaltime.tv_nsec);
+	sqlite3_bind_int64(procstmt, 11, proc->idletime_sec);
+	sqlite3_bind_int64(procstmt, 12, proc->requests);
+	db_project_unlock(proc->project);
+	db_dump_step(dumphandler, procstmt, db_dump_insert_process);
+    }
+
+    db_global_unlock();
+
+    sqlite3_finalize(projstmt);
+    sqlite3_finalize(procstmt);
+
     strnbcat(&data.buffer, &data.bufferlen, "PROJECTS:\n");
-    sqlite3_exec(dbhandler, sql, dump_tabledata, &data, &err );
+    sqlite3_exec(dumphandler, db_dump_select_project, db_dump_tabledata, &data, NULL );
     printlog("%s", data.buffer);
 
     data.has_printed_headline = 0;
     *data.buffer = '\0';	// empty string
-    sql = db_select_statement[DB_DUMP_PROCESS];
     strnbcat(&data.buffer, &data.bufferlen, "PROCESSES:\n");
-    sqlite3_exec(dbhandler, sql, dump_tabledata, &data, &err );
+    sqlite3_exec(dumphandler, db_dump_select_process, db_dump_tabledata, &data, NULL );
     printlog("%s", data.buffer);
 
-    db_global_unlock();
+    retval = sqlite3_close(dumphandler);
+    if (SQLITE_OK != retval)
+    {
+	printlog("ERROR: calling sqlite3_close(): %s", sqlite3_errstr(retval));
+	qexit(EXIT_FAILURE);
+    }
 
     free(data.buffer);
 }
 
+#else /* DB_DUMP_SQLITE */
+
+void db_dump(void)
+{
+    static const int buffer_size = 1024;
+    int bufferlen = buffer_size;
+    char *buffer = malloc(bufferlen);
+    if (NULL == buffer)
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    *buffer = '\0';	// empty string
+
+    char line[512];
+
+    db_global_lock();
+
+    strnbcat(&buffer, &bufferlen, "PROJECTS:\n"
+	    "name,\tconfigpath,\tconfigbasename,\twatchd,\tnr_crashs,\tprocess_select,\t\n");
+    const struct db_project_s *project;
+    TAILQ_FOREACH(project, &projectlist, entries)
+    {
+	if (project->is_removed)
+	    continue;
+	snprintf(line, sizeof(line), "%s,\t%s,\t%s,\t%d,\t%d,\t%d,\t\n",
+		project->name, project->configpath, project->configbasename,
+		project->watchd, project->nr_crashs, project->select);
+	strnbcat(&buffer, &bufferlen, line);
+    }
+    printlog("%s", buffer);
+
+    *buffer = '\0';	// empty string
+    strnbcat(&buffer, &bufferlen, "PROCESSES:\n"
+	    "projectname,\tlist,\tstate,\tthreadid,\tpid,\tprocess_socket_fd,\t"
+	    "client_socket_fd,\tclient_socket_bufsize,\tsignaltime_sec,\t"
+	    "signaltime_nsec,\tidletime_sec,\trequests,\t\n");
+    const struct db_process_s *proc;
+    TAILQ_FOREACH(proc, &processlist, entries)
+    {
+	db_project_lock(proc->project);
+	snprintf(line, sizeof(line), "%s,\t%d,\t%d,\t%llu,\t%d,\t%d,\t%d,\t%d,\t%ld,\t%ld,\t%lld,\t%lld,\t\n",
+		proc->project->name, proc->list, proc->state,
+		(unsigned long long int)proc->threadid, proc->pid,
+		proc->process_socket_fd, proc->client_socket_fd,
+		proc->client_socket_bufsize, (long int)proc->signaltime.tv_sec,
+		(long int)proc->signaltime.tv_nsec, proc->idletime_sec,
+		proc->requests);
+	db_project_unlock(proc->project);
+	strnbcat(&buffer, &bufferlen, line);
+    }
+    printlog("%s", buffer);
+
+    db_global_unlock();
+
+    free(buffer);
+}
+
+#endif /* DB_DUMP_SQLITE */
@@ -78,6 +78,19 @@ enum db_process_list_e
     LIST_SELECTOR_MAX	// last entry. do not use
 };
 
+/* The policy choosing the idle process of a project which gets the next
+ * request.
+ */
+enum db_process_select_e
+{
+    SELECT_MRU,			// the process idling the shortest time, its caches are warm
+    SELECT_LRU,			// the process idling the longest time
+    SELECT_ROUND_ROBIN,		// the next process in the order of their start
+    SELECT_LEAST_SERVED,	// the process which served the fewest requests
+
+    PROCESS_SELECT_MAX	// last entry. do not use
+};
+
 struct timespec;
 
 void db_init(void);
@@ -88,15 +101,19 @@ void db_add_project(const char *projname);
 int db_get_names_project(char ***projname, int *len);
 void db_free_names_project(char **projname, int len);
 void db_remove_project(const char *projname);
+void db_set_project_process_select(const char *projname, enum db_process_select_e select);
 char *db_get_configpath_from_project(const char *projname);
 
 void db_add_process(const char *projname, pid_t pid, int process_socket_fd);
 int db_get_num_idle_process(const char *projname);
 char *db_get_project_for_this_process(pid_t pid);
 pid_t db_get_process(const char *projname, enum db_process_list_e list, enum db_process_state_e state);
-pid_t db_get_next_idle_process_for_busy_work(const char *projname, int timeoutsec);
+pid_t db_try_get_next_idle_process_for_busy_work(const char *projname);
+pid_t db_try_get_affine_idle_process_for_busy_work(const char *projname, unsigned int key, int *is_affinity_hit);
 int db_has_process(pid_t pid);
 int db_get_process_socket(pid_t pid);
+int db_process_take_client_socket(pid_t pid, int *bufsize);
+int db_process_store_client_socket(pid_t pid, int fd, int bufsize);
 enum db_process_state_e db_get_process_state(pid_t pid);
 int db_process_set_state_init(pid_t pid, pthread_t thread_id);
 int db_process_set_state_idle(pid_t pid);
@@ -116,6 +133,7 @@ enum db_process_list_e db_get_process_list(pid_t pid);
 void db_move_all_idle_process_from_init_to_active_list(const char *projname);
 void db_move_all_process_from_active_to_shutdown_list(const char *projname);
 void db_move_all_process_from_init_to_shutdown_list(const char *projname);
+pid_t db_move_idle_process_in_timeout_to_shutdown_list(const char *projname, int idle_sec);
 void db_move_all_process_to_list(enum db_process_list_e list);
 
 pid_t db_get_shutdown_process_in_timeout(void);
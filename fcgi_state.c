@@ -1418,3 +1418,168 @@ struct fcgi_message_s *fcgi_message_new_endrequest(uint16_t requestId, uint32_t
 }
 
 
+
+
+/* inspects the fcgi record header at the beginning of "data".
+ * The header fields are stored in the non NULL pointer arguments.
+ * returns the size of the complete record (header, content and padding) or 0
+ * if "len" is too short to contain the record header.
+ */
+int fcgi_record_get_header(const char *data, int len, int *type, int *requestId, int *contentLength)
+{
+    assert(data);
+    if ( !data || len < (int)sizeof(FCGI_Header) )
+	return 0;
+
+    const FCGI_Header *header = (const FCGI_Header *)data;
+    int mycontentlength = ASSEMBLE_FCGI_NUMBERS16(header->contentLength);
+
+    if (type)
+	*type = header->type;
+    if (requestId)
+	*requestId = ASSEMBLE_FCGI_NUMBERS16(header->requestId);
+    if (contentLength)
+	*contentLength = mycontentlength;
+
+    return sizeof(*header) + mycontentlength + header->paddingLength;
+}
+
+
+/* returns the flags of a complete FCGI_BEGIN_REQUEST record in "data"
+ * or -1 if the record is no begin request.
+ */
+int fcgi_record_get_flag(const char *data, int len)
+{
+    assert(data);
+    if ( !data || len < (int)sizeof(FCGI_BeginRequestRecord) )
+	return -1;
+
+    const FCGI_BeginRequestRecord *record = (const FCGI_BeginRequestRecord *)data;
+    if (FCGI_BEGIN_REQUEST != record->header.type)
+	return -1;
+
+    return record->body.flags;
+}
+
+
+/* overwrites the flags of a complete FCGI_BEGIN_REQUEST record in "data".
+ * returns 0 on success or -1 if the record is no begin request.
+ */
+int fcgi_record_set_flag(char *data, int len, unsigned char flags)
+{
+    assert(data);
+    if ( !data || len < (int)sizeof(FCGI_BeginRequestRecord) )
+	return -1;
+
+    FCGI_BeginRequestRecord *record = (FCGI_BeginRequestRecord *)data;
+    if (FCGI_BEGIN_REQUEST != record->header.type)
+	return -1;
+
+    record->body.flags = flags;
+
+    return 0;
+}
+
+
+/* overwrites the request id of the fcgi record header in "data".
+ * returns 0 on success or -1 if "len" is too short for the header.
+ */
+int fcgi_record_set_requestid(char *data, int len, uint16_t requestId)
+{
+    assert(data);
+    if ( !data || len < (int)sizeof(FCGI_Header) )
+	return -1;
+
+    FCGI_Header *header = (FCGI_Header *)data;
+    WRITE_FCGI_NUMBER16(header->requestId, requestId);
+
+    return 0;
+}
+
+
+/* writes a complete record of "type" with the given content to "buffer".
+ * returns the bytes written or -1 if the buffer is too small.
+ */
+static int fcgi_record_write(char *buffer, int len, unsigned char type, uint16_t requestId, const char *content, uint16_t contentLength)
+{
+    if (len < (int)sizeof(FCGI_Header) + contentLength)
+	return -1;
+
+    FCGI_Header *header = (FCGI_Header *)buffer;
+    memset(header, 0, sizeof(*header));
+    header->version = FCGI_VERSION_1;
+    header->type = type;
+    WRITE_FCGI_NUMBER16(header->requestId, requestId);
+    WRITE_FCGI_NUMBER16(header->contentLength, contentLength);
+    if (contentLength)
+	memcpy(buffer + sizeof(*header), content, contentLength);
+
+    return sizeof(*header) + contentLength;
+}
+
+
+/* answers the complete FCGI_GET_VALUES record in "data" with a
+ * FCGI_GET_VALUES_RESULT record written to "buffer". The result contains the
+ * variables of the request known to the fcgi specification, unknown
+ * variables are left out.
+ * returns the bytes written or -1 if the buffer is too small or the record
+ * is no FCGI_GET_VALUES record.
+ */
+int fcgi_record_write_get_values_result(char *buffer, int len, const char *data, int datalen, int max_conns, int max_reqs, int mpxs_conns)
+{
+    assert(buffer);
+    assert(data);
+
+    int type, requestId, contentLength;
+    int recordlen = fcgi_record_get_header(data, datalen, &type, &requestId, &contentLength);
+    if (0 == recordlen || recordlen > datalen || FCGI_GET_VALUES != type)
+	return -1;
+
+    char content[256];	// enough for the three known variables
+    int contentwritten = 0;
+    const unsigned char *names = (const unsigned char *)data + sizeof(FCGI_Header);
+    while (contentLength > 0)
+    {
+	struct fcgi_param_s param = {NULL, NULL};
+	int paramlen = fcgi_param_parse(&param, names, contentLength);
+	if (0 == paramlen)
+	    break;
+	names += paramlen;
+	contentLength -= paramlen;
+
+	int value = -1;
+	if (0 == strcmp(param.name, FCGI_MAX_CONNS))
+	    value = max_conns;
+	else if (0 == strcmp(param.name, FCGI_MAX_REQS))
+	    value = max_reqs;
+	else if (0 == strcmp(param.name, FCGI_MPXS_CONNS))
+	    value = mpxs_conns;
+
+	if (value >= 0)
+	{
+	    char valuestr[16];
+	    snprintf(valuestr, sizeof(valuestr), "%d", value);
+	    int retval = fcgi_param_list_write(content + contentwritten, sizeof(content) - contentwritten, param.name, valuestr);
+	    if (retval > 0)
+		contentwritten += retval;
+	}
+	free(param.name);
+	free(param.value);
+    }
+
+    return fcgi_record_write(buffer, len, FCGI_GET_VALUES_RESULT, 0, content, contentwritten);
+}
+
+
+/* writes a FCGI_UNKNOWN_TYPE record for the management record "type" to
+ * "buffer".
+ * returns the bytes written or -1 if the buffer is too small.
+ */
+int fcgi_record_write_unknown_type(char *buffer, int len, unsigned char type)
+{
+    FCGI_UnknownTypeBody body;
+    memset(&body, 0, sizeof(body));
+    body.type = type;
+
+    return fcgi_record_write(buffer, len, FCGI_UNKNOWN_TYPE, 0, (const char *)&body, sizeof(body));
+}
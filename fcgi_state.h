@@ -108,6 +108,13 @@ struct fcgi_message_s *fcgi_message_new_endrequest(uint16_t requestId, uint32_t
 
 int fcgi_param_list_write(char *buffer, int len, const char *name, const char *value);
 
+int fcgi_record_get_header(const char *data, int len, int *type, int *requestId, int *contentLength);
+int fcgi_record_get_flag(const char *data, int len);
+int fcgi_record_set_flag(char *data, int len, unsigned char flags);
+int fcgi_record_set_requestid(char *data, int len, uint16_t requestId);
+int fcgi_record_write_get_values_result(char *buffer, int len, const char *data, int datalen, int max_conns, int max_reqs, int mpxs_conns);
+int fcgi_record_write_unknown_type(char *buffer, int len, unsigned char type);
+
 
 #endif /* FCGI_STATE_H_ */
 
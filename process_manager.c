@@ -54,6 +54,7 @@
 #include "statistic.h"
 #include "stringext.h"
 #include "timer.h"
+#include "connection_manager.h"
 
 
 #define MIN_PROCESS_RUNTIME_SEC		5
@@ -389,6 +390,7 @@ static void process_manager_thread_function_init_new_child(struct thread_init_ne
 	}
 	else
 	{
+	    connection_manager_prepare_process_connection(pid);
 	    db_process_set_state_idle(pid);
 	}
     }
@@ -616,6 +618,9 @@ static int process_manager_thread_function_start_new_child(struct thread_start_n
 	close(STDOUT_FILENO);
 	close(STDERR_FILENO);
 
+	/* the ignored SIGPIPE of the scheduler is inherited by exec() */
+	signal(SIGPIPE, SIG_DFL);
+
 
 	execl(command, command, NULL);
 //	logerror("ERROR: could not execute '%s': ", command); # no log message allowed because of locking
@@ -679,9 +684,9 @@ static void *process_manager_thread_start_new_child(void *arg)
 void process_manager_start_new_process_wait(int num, const char *projname, int do_exchange_processes)
 {
     assert(projname);
-    assert(num > 0);
+    assert(num >= 0);
 
-    pthread_t threads[num];
+    pthread_t threads[max(num, 1)];
     int i;
     int retval;
 
@@ -974,6 +979,11 @@ void process_manager_cleanup_process(pid_t pid)
     else
 	close(fd);
     db_process_set_state_exit(pid);
+
+    /* close the kept open fcgi connection to the process, if any */
+    fd = db_process_take_client_socket(pid, NULL);
+    if (-1 != fd)
+	close(fd);
 }
 
 
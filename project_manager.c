@@ -47,8 +47,20 @@
 #include "process_manager.h"
 #include "qgis_inotify.h"
 #include "qgis_shutdown_queue.h"
+#include "service_time.h"
+#include "statistic.h"
 
 
+/* names of the process selection policies in the configuration, in the
+ * order of enum db_process_select_e */
+static const char *process_select_names[PROCESS_SELECT_MAX] =
+{
+	"mru",
+	"lru",
+	"round_robin",
+	"least_served",
+};
+
 
 struct thread_start_project_processes_args
 {
@@ -143,11 +155,70 @@ void project_manager_shutdown(void)
 }
 
 
+/* shut down the processes idling longer than proc_idle_timeout seconds,
+ * as long as the project keeps at least min_proc processes.
+ * With min_proc=0 the project scales down to no process at all, the next
+ * request starts a process again.
+ */
+void project_manager_stop_idle_processes(void)
+{
+    char **projects;
+    int len;
+    db_get_names_project(&projects, &len);
+
+    int i;
+    for (i=0; i<len; i++)
+    {
+	const char *projname = projects[i];
+	int idle_timeout = config_get_idle_timeout(projname);
+	if (0 >= idle_timeout)
+	    continue;
+
+	int minproc = config_get_min_idle_processes(projname);
+	int numproc = db_get_num_start_init_idle_process(projname) + db_get_num_active_process(projname);
+	int num = 0;
+	while (numproc > minproc)
+	{
+	    pid_t pid = db_move_idle_process_in_timeout_to_shutdown_list(projname, idle_timeout);
+	    if (0 >= pid)
+		break;
+	    numproc--;
+	    num++;
+	}
+
+	if (num)
+	{
+	    printlog("Stop %d process%s idling more than %d seconds in project '%s'", num, (num>1)?"es":"", idle_timeout, projname);
+	    statistic_add_idle_shutdown(num);
+	}
+    }
+
+    db_free_names_project(projects, len);
+}
+
+
+static enum db_process_select_e project_manager_get_process_select(const char *projname)
+{
+    const char *name = config_get_process_select(projname);
+
+    int i;
+    for (i=0; i<PROCESS_SELECT_MAX; i++)
+    {
+	if (name && 0 == strcmp(name, process_select_names[i]))
+	    return i;
+    }
+
+    printlog("WARNING: unknown process selection '%s' in project '%s', use '%s'", name, projname, process_select_names[SELECT_MRU]);
+    return SELECT_MRU;
+}
+
+
 void project_manager_start_project(const char *projname)
 {
     int retval;
 
     db_add_project(projname);
+    db_set_project_process_select(projname, project_manager_get_process_select(projname));
 
     const char *configpath = config_get_project_config_path(projname);
     /* if the path to a configuration file has been given and the path
@@ -161,6 +232,12 @@ void project_manager_start_project(const char *projname)
 
 
     int nr_of_childs_during_startup	= config_get_min_idle_processes(projname);
+    if (0 >= nr_of_childs_during_startup)
+    {
+	/* min_proc=0: the first request of this project starts the process */
+	printlog("startup project '%s', starting processes on demand", projname);
+	return;
+    }
     printlog("startup project '%s', starting %d processes", projname, nr_of_childs_during_startup);
 
 
@@ -229,7 +306,10 @@ void project_manager_manage_project_changes(const char **newproj, const char **c
     {
 	const char **deletedprojcopy = deletedproj;
 	while ((proj = *deletedprojcopy++))
+	{
 	    project_manager_shutdown_project(proj);
+	    service_time_delete_project(proj);
+	}
     }
 
     if (changedproj)
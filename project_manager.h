@@ -41,5 +41,6 @@ void project_manager_start_project(const char *projname);
 void project_manager_restart_project(const char *proj);
 void project_manager_shutdown_project(const char *project_name);
 void project_manager_shutdown(void);
+void project_manager_stop_idle_processes(void);
 
 #endif /* PROJECT_MANAGER_H_ */
@@ -121,6 +121,9 @@
 #include <regex.h>
 #include <fcntl.h>
 #include <pwd.h>
+#include <grp.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -132,11 +135,15 @@
 #include "logger.h"
 #include "timer.h"
 #include "qgis_shutdown_queue.h"
+#include "admission_queue.h"
+#include "service_time.h"
 #include "statistic.h"
 #include "database.h"
 #include "process_manager.h"
 #include "project_manager.h"
 #include "connection_manager.h"
+#include "connection_acceptor.h"
+#include "stringext.h"
 
 
 
@@ -147,6 +154,9 @@
 # define DEFAULT_CONFIG_PATH	"/etc/qgis-scheduler/qgis-scheduler.conf"
 #endif
 
+#define LISTEN_UNIX_PREFIX	"unix:"	/* listen to a unix domain socket */
+#define IDLE_CHECK_INTERVAL	1000	/* msec, look for processes in the idle timeout */
+
 
 
 
@@ -326,11 +336,341 @@ void signalaction(int sig, siginfo_t *info, void *ucontext)
 
 
 
+/* create a network socket bound to the address and port and listen to it
+ * with a backlog of "backlog" connections.
+ * The socket is bound with SO_REUSEPORT, so more than one socket can listen
+ * to the same address.
+ * returns the socket fd
+ */
+static int open_network_listener(const char *net_listen, const char *net_port, int backlog)
+{
+    int serversocketfd = -1;
+
+    struct addrinfo hints;
+    struct addrinfo *result = NULL, *rp = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC; /* Allow IPv4 or IPv6 */
+    hints.ai_socktype = SOCK_STREAM; /* TCP socket */
+    hints.ai_flags = AI_PASSIVE; /* For wildcard IP address */
+    //hints.ai_protocol = 0;          /* Any protocol */
+    //hints.ai_canonname = NULL;
+    //hints.ai_addr = NULL;
+    //hints.ai_next = NULL;
+
+    int s = getaddrinfo(net_listen, net_port, &hints, &result);
+    if (s != 0)
+    {
+	debug(1, "getaddrinfo: %s", gai_strerror(s));
+	qexit(EXIT_FAILURE);
+    }
+
+    /* getaddrinfo() returns a list of address structures.
+     Try each address until we successfully bind(2).
+     If socket(2) (or bind(2)) fails, we (close the socket
+     and) try the next address. */
+    for (rp = result; rp != NULL; rp = rp->ai_next)
+    {
+	//printf("try family %d, socket type %d, protocol %d\n",rp->ai_family,rp->ai_socktype,rp->ai_protocol);
+	serversocketfd = socket(rp->ai_family, rp->ai_socktype|SOCK_NONBLOCK|SOCK_CLOEXEC, rp->ai_protocol);
+	if (serversocketfd == -1)
+	{
+	    //printf(" could not create socket\n");
+	    logerror("ERROR: could not create socket for network data");
+	    continue;
+	}
+
+	int value = 1;
+	int retval = setsockopt(serversocketfd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value));
+	if (-1 == retval)
+	{
+	    logerror("ERROR: could not set socket to SOL_SOCKET");
+	}
+
+	if (bind(serversocketfd, rp->ai_addr, rp->ai_addrlen) == 0)
+	    break; /* Success */
+
+	//printf(" could not bind to socket\n");
+	logerror("ERROR: could not bind to network socket");
+	close(serversocketfd);
+    }
+
+    if (rp == NULL)
+    { /* No address succeeded */
+	//debug(1, "Could not bind"); // TODO better message
+	logerror("ERROR: could not create network socket");
+	qexit(EXIT_FAILURE);
+    }
+
+    freeaddrinfo(result); /* No longer needed */
+
+    /* we are server. listen to incoming connections */
+    int retval = listen(serversocketfd, backlog);
+    if (retval)
+    {
+	logerror("ERROR: can not listen to socket");
+	qexit(EXIT_FAILURE);
+    }
+
+    return serversocketfd;
+}
+
+
+/* create a unix domain socket at path and listen to it with a backlog of
+ * "backlog" connections.
+ * A socket left over from a previous run is removed. The file mode and owner
+ * are set as configured.
+ * returns the socket fd
+ */
+static int open_unix_listener(const char *path, int backlog)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+	printlog("ERROR: path of unix socket '%s' is too long", path);
+	qexit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    int serversocketfd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (-1 == serversocketfd)
+    {
+	logerror("ERROR: could not create unix socket");
+	qexit(EXIT_FAILURE);
+    }
+
+    /* remove the socket of a previous run, but do not steal the socket of
+     * a scheduler still running */
+    struct stat statbuf;
+    int retval = stat(path, &statbuf);
+    if (0 == retval)
+    {
+	if ( !S_ISSOCK(statbuf.st_mode) )
+	{
+	    printlog("ERROR: '%s' exists and is no socket", path);
+	    qexit(EXIT_FAILURE);
+	}
+
+	int testfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (-1 == testfd)
+	{
+	    logerror("ERROR: could not create unix socket");
+	    qexit(EXIT_FAILURE);
+	}
+	retval = connect(testfd, (struct sockaddr *)&addr, sizeof(addr));
+	close(testfd);
+	if (0 == retval)
+	{
+	    printlog("ERROR: unix socket '%s' is in use by a different process", path);
+	    qexit(EXIT_FAILURE);
+	}
+
+	debug(1, "remove stale unix socket '%s'", path);
+	retval = unlink(path);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: can not remove unix socket '%s'", path);
+	    qexit(EXIT_FAILURE);
+	}
+    }
+
+    retval = bind(serversocketfd, (struct sockaddr *)&addr, sizeof(addr));
+    if (-1 == retval)
+    {
+	logerror("ERROR: could not bind to unix socket '%s'", path);
+	qexit(EXIT_FAILURE);
+    }
+
+    int mode = config_get_listen_mode();
+    if (0 <= mode)
+    {
+	retval = chmod(path, mode);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: can not set mode %#o of unix socket '%s'", mode, path);
+	    qexit(EXIT_FAILURE);
+	}
+    }
+
+    const char *owner = config_get_listen_owner();
+    if (owner)
+    {
+	/* owner is "user" or "user:group" */
+	char *user = strdup(owner);
+	assert(user);
+	if ( !user )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	char *group = strchr(user, ':');
+	if (group)
+	    *group++ = '\0';
+
+	uid_t uid = -1;
+	gid_t gid = -1;
+	if (*user)
+	{
+	    errno = 0;
+	    struct passwd *pwnam = getpwnam(user);
+	    if ( !pwnam )
+	    {
+		if (errno)
+		    logerror("ERROR: can not get the id of user '%s'", user);
+		else
+		    printlog("ERROR: can not get the id of user '%s'. exiting", user);
+		qexit(EXIT_FAILURE);
+	    }
+	    uid = pwnam->pw_uid;
+	}
+	if (group && *group)
+	{
+	    errno = 0;
+	    struct group *grnam = getgrnam(group);
+	    if ( !grnam )
+	    {
+		if (errno)
+		    logerror("ERROR: can not get the id of group '%s'", group);
+		else
+		    printlog("ERROR: can not get the id of group '%s'. exiting", group);
+		qexit(EXIT_FAILURE);
+	    }
+	    gid = grnam->gr_gid;
+	}
+
+	retval = chown(path, uid, gid);
+	if (-1 == retval)
+	{
+	    logerror("ERROR: can not set owner of unix socket '%s' to %s", path, owner);
+	    qexit(EXIT_FAILURE);
+	}
+	free(user);
+    }
+
+    /* we are server. listen to incoming connections */
+    retval = listen(serversocketfd, backlog);
+    if (retval)
+    {
+	logerror("ERROR: can not listen to unix socket '%s'", path);
+	qexit(EXIT_FAILURE);
+    }
+
+    return serversocketfd;
+}
+
+
+/* the listening sockets, each one gets its own acceptor thread */
+struct listener_list_s
+{
+    int *fds;
+    int fdsize;
+    int num;
+    char **projnames;	/* project routed by the listener, NULL routes by the parameters */
+    int projnamesize;
+    int numprojnames;
+    char **unixpaths;
+    int unixpathsize;
+    int num_unixpaths;
+};
+
+
+/* open the sockets of a comma separated list of network addresses and unix
+ * socket paths. Each acceptor gets its own socket bound to the same inet
+ * address. A unix socket can not be bound twice, the acceptors share it.
+ * If projname is given the connections of the sockets are routed to this
+ * project without looking at the parameters.
+ */
+static void open_listeners(struct listener_list_s *listeners, const char *listenlist, const char *net_port, int backlog, const char *projname, int num_acceptors)
+{
+    char *list = strdup(listenlist);
+    assert(list);
+    if ( !list )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    char *saveptr = NULL;
+    char *net_listen;
+    for (net_listen = strtok_r(list, ", \t", &saveptr); net_listen; net_listen = strtok_r(NULL, ", \t", &saveptr))
+    {
+	int fd;
+	int i;
+	if (0 == strncmp(net_listen, LISTEN_UNIX_PREFIX, strlen(LISTEN_UNIX_PREFIX)))
+	{
+	    char *path = strdup(net_listen + strlen(LISTEN_UNIX_PREFIX));
+	    assert(path);
+	    if ( !path )
+	    {
+		logerror("ERROR: could not allocate memory");
+		qexit(EXIT_FAILURE);
+	    }
+	    arraycat(&listeners->unixpaths, &listeners->unixpathsize, &listeners->num_unixpaths, &path, sizeof(path));
+
+	    fd = open_unix_listener(path, backlog);
+	    for (i=0; i<num_acceptors; i++)
+	    {
+		int dupfd = fd;
+		if (i > 0)
+		{
+		    dupfd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		    if (-1 == dupfd)
+		    {
+			logerror("ERROR: can not duplicate unix socket fd %d", fd);
+			qexit(EXIT_FAILURE);
+		    }
+		}
+		arraycat(&listeners->fds, &listeners->fdsize, &listeners->num, &dupfd, sizeof(dupfd));
+	    }
+	    if (projname)
+		printlog("Listen on unix socket '%s' for project '%s'", path, projname);
+	    else
+		printlog("Listen on unix socket '%s'", path);
+	}
+	else
+	{
+	    if ( !net_port )
+	    {
+		printlog("ERROR: no port given for network address '%s' of project '%s'", net_listen, projname);
+		qexit(EXIT_FAILURE);
+	    }
+	    for (i=0; i<num_acceptors; i++)
+	    {
+		fd = open_network_listener(net_listen, net_port, backlog);
+		arraycat(&listeners->fds, &listeners->fdsize, &listeners->num, &fd, sizeof(fd));
+	    }
+	    if (projname)
+		printlog("Listen on network address '%s' port %s for project '%s'", net_listen, net_port, projname);
+	    else
+		printlog("Listen on network address '%s' port %s", net_listen, net_port);
+	}
+
+	for (i=0; i<num_acceptors; i++)
+	{
+	    char *name = NULL;
+	    if (projname)
+	    {
+		name = strdup(projname);
+		assert(name);
+		if ( !name )
+		{
+		    logerror("ERROR: could not allocate memory");
+		    qexit(EXIT_FAILURE);
+		}
+	    }
+	    arraycat(&listeners->projnames, &listeners->projnamesize, &listeners->numprojnames, &name, sizeof(name));
+	}
+    }
+    free(list);
+}
+
+
 int main(int argc, char **argv)
 {
     int exitvalue = EXIT_SUCCESS;
     int no_daemon = 0;
-    int serversocketfd = -1;
     const char *config_path = DEFAULT_CONFIG_PATH;
 
     int opt;
@@ -390,79 +730,40 @@ int main(int argc, char **argv)
     check_ressource_limits();
 
     db_init();
+    admission_queue_init();
 
-    /* prepare inet socket connection for application server process (this)
+    /* prepare the inet and unix socket connections for application server
+     * process (this). "listen" is a comma separated list of addresses.
+     * Projects with a "listen" setting of their own get their own sockets,
+     * the connections of these sockets are routed to the project without
+     * looking at the parameters.
      */
+    int num_acceptors = config_get_acceptors();
+    if (num_acceptors <= 0)
     {
-	struct addrinfo hints;
-	struct addrinfo *result = NULL, *rp = NULL;
-
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_UNSPEC; /* Allow IPv4 or IPv6 */
-	hints.ai_socktype = SOCK_STREAM; /* TCP socket */
-	hints.ai_flags = AI_PASSIVE; /* For wildcard IP address */
-	//hints.ai_protocol = 0;          /* Any protocol */
-	//hints.ai_canonname = NULL;
-	//hints.ai_addr = NULL;
-	//hints.ai_next = NULL;
-
-	const char *net_listen = config_get_network_listen();
-	const char *net_port = config_get_network_port();
-	int s = getaddrinfo(net_listen, net_port, &hints, &result);
-	if (s != 0)
-	{
-	    debug(1, "getaddrinfo: %s", gai_strerror(s));
-	    qexit(EXIT_FAILURE);
-	}
-
-	/* getaddrinfo() returns a list of address structures.
-	 Try each address until we successfully bind(2).
-	 If socket(2) (or bind(2)) fails, we (close the socket
-	 and) try the next address. */
-	for (rp = result; rp != NULL; rp = rp->ai_next)
-	{
-	    //printf("try family %d, socket type %d, protocol %d\n",rp->ai_family,rp->ai_socktype,rp->ai_protocol);
-	    serversocketfd = socket(rp->ai_family, rp->ai_socktype|SOCK_NONBLOCK|SOCK_CLOEXEC, rp->ai_protocol);
-	    if (serversocketfd == -1)
-	    {
-		//printf(" could not create socket\n");
-		logerror("ERROR: could not create socket for network data");
-		continue;
-	    }
-
-	    int value = 1;
-	    int retval = setsockopt(serversocketfd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value));
-	    if (-1 == retval)
-	    {
-		logerror("ERROR: could not set socket to SOL_SOCKET");
-	    }
-
-	    if (bind(serversocketfd, rp->ai_addr, rp->ai_addrlen) == 0)
-		break; /* Success */
-
-	    //printf(" could not bind to socket\n");
-	    logerror("ERROR: could not bind to network socket");
-	    close(serversocketfd);
-	}
-
-	if (rp == NULL)
-	{ /* No address succeeded */
-	    //debug(1, "Could not bind"); // TODO better message
-	    logerror("ERROR: could not create network socket");
-	    qexit(EXIT_FAILURE);
-	}
-
-	freeaddrinfo(result); /* No longer needed */
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	num_acceptors = (cores > 0) ? cores : 1;
     }
-
-
-    /* we are server. listen to incoming connections */
-    retval = listen(serversocketfd, SOMAXCONN);
-    if (retval)
+    struct listener_list_s listeners;
+    memset(&listeners, 0, sizeof(listeners));
+    open_listeners(&listeners, config_get_network_listen(), config_get_network_port(), config_get_listen_backlog(NULL), NULL, num_acceptors);
+    if (0 == listeners.num)
     {
-	logerror("ERROR: can not listen to socket");
+	printlog("ERROR: no address to listen to");
 	qexit(EXIT_FAILURE);
     }
+    {
+	int num = config_get_num_projects();
+	int i;
+	for (i=0; i<num; i++)
+	{
+	    const char *projname = config_get_name_project(i);
+	    const char *listenlist = config_get_project_listen(projname);
+	    if (listenlist)
+		open_listeners(&listeners, listenlist, config_get_project_port(projname), config_get_listen_backlog(projname), projname, 1);
+	}
+    }
+    connection_manager_set_listener(listeners.fds[0]);
 
 
     /* change root directory if requested */
@@ -708,6 +1009,21 @@ int main(int argc, char **argv)
 	    logerror("ERROR: can not install signal handler");
 	    qexit(EXIT_FAILURE);
 	}
+
+	/* a peer which closed its connection must not terminate the program.
+	 * Writing to it returns EPIPE instead and the relay handles it.
+	 * The child processes get the default action back before exec().
+	 */
+	struct sigaction ignore;
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&ignore.sa_mask);
+	retval = sigaction(SIGPIPE, &ignore, NULL);
+	if (retval)
+	{
+	    logerror("ERROR: can not install signal handler");
+	    qexit(EXIT_FAILURE);
+	}
     }
 
 
@@ -718,6 +1034,9 @@ int main(int argc, char **argv)
     /* start the process shutdown module */
     qgis_shutdown_init(signalpipe_wr);
 
+    /* start the connection handling */
+    connection_manager_init();
+
     /* start the child processes */
 //    project_manager_startup_projects();
     project_manager_manage_project_changes((const char **)sectionnew, (const char **)sectionchange, (const char **)sectiondelete);
@@ -727,39 +1046,47 @@ int main(int argc, char **argv)
 
 
 
+    /* accept the network connections in their own threads */
+    connection_acceptor_init(listeners.fds, (const char **)listeners.projnames, listeners.num);
+    free(listeners.fds);
+    listeners.fds = NULL;
+
+
     /* wait for signals of child processes exiting (SIGCHLD) or to terminate
-     * this program (SIGTERM, SIGINT) or clients connecting via network to
-     * this server.
+     * this program (SIGTERM, SIGINT). Clients connecting via network to this
+     * server are accepted by the acceptor threads.
      */
 
     enum {
-	serverfd_slot = 0,
-	pipefd_slot = 1,
+	pipefd_slot = 0,
 	num_poll_slots
     };
     struct pollfd pfd[num_poll_slots];
 
-    pfd[serverfd_slot].fd = serversocketfd;
     pfd[pipefd_slot].fd = signalpipe_rd;
 
     int has_finished = 0;
     int has_restored_signal = 0;
-    int is_readable_serversocket = 0;
     int is_readable_signalpipe = 0;
-    printlog("Initialization done. Waiting for network connection requests..");
+    const struct timespec idlecheck_interval = { tv_sec: IDLE_CHECK_INTERVAL/1000, tv_nsec: (IDLE_CHECK_INTERVAL%1000)*1000*1000 };
+    struct timespec idlecheck;
+    retval = qgis_timer_start(&idlecheck);
+    if (-1 == retval)
+    {
+	logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+	qexit(EXIT_FAILURE);
+    }
+    qgis_timer_add(&idlecheck, &idlecheck_interval);
+    printlog("Initialization done. Waiting for network connection requests in %d acceptors..", listeners.num);
     while ( !has_finished )
     {
-	/* wait for connections or signals */
-	if (!is_readable_serversocket)
-	    pfd[serverfd_slot].events = POLLIN;
-	else
-	    pfd[serverfd_slot].events = 0;
+	/* wait for signals */
 	if (!is_readable_signalpipe)
 	    pfd[pipefd_slot].events = POLLIN;
 	else
 	    pfd[pipefd_slot].events = 0;
 
-	retval = poll(pfd, num_poll_slots, -1);
+	retval = poll(pfd, num_poll_slots, IDLE_CHECK_INTERVAL);
 	if (-1 == retval)
 	{
 	    switch (errno)
@@ -782,11 +1109,6 @@ int main(int argc, char **argv)
 
 	if (retval > 0)
 	{
-	    if (POLLIN & pfd[serverfd_slot].revents)
-	    {
-		is_readable_serversocket = 1;
-		debug(1, "can read from network socket");
-	    }
 	    if(POLLIN & pfd[pipefd_slot].revents)
 	    {
 		is_readable_signalpipe = 1;
@@ -818,6 +1140,7 @@ int main(int argc, char **argv)
 		    }
 		    case SIGUSR1:
 			statistic_printlog();
+			service_time_printlog();
 			break;
 
 		    case SIGUSR2:
@@ -871,28 +1194,23 @@ int main(int argc, char **argv)
 
 		is_readable_signalpipe = 0;
 	    }
+	}
 
-	    if (is_readable_serversocket)
+	/* stop the processes idling longer than their idle timeout */
+	if ( !get_program_shutdown() )
+	{
+	    struct timespec now;
+	    retval = qgis_timer_start(&now);
+	    if (-1 == retval)
 	    {
-		if (!get_program_shutdown())
-		{
-		    /* connection available */
-		    struct sockaddr addr;
-		    socklen_t addrlen = sizeof(addr);
-		    retval = accept(serversocketfd, &addr, &addrlen);
-		    if (-1 == retval)
-		    {
-			logerror("ERROR: calling accept");
-			qexit(EXIT_FAILURE);
-		    }
-		    else
-		    {
-			int networkfd = retval;
-			connection_manager_handle_connection_request(networkfd, &addr, addrlen);
-		    }
-
-		    is_readable_serversocket = 0;
-		}
+		logerror("ERROR: clock_gettime(%d,..)", get_valid_clock_id());
+		qexit(EXIT_FAILURE);
+	    }
+	    if (qgis_timer_isgreaterthan(&now, &idlecheck))
+	    {
+		project_manager_stop_idle_processes();
+		idlecheck = now;
+		qgis_timer_add(&idlecheck, &idlecheck_interval);
 	    }
 	}
 
@@ -937,10 +1255,30 @@ int main(int argc, char **argv)
     }
 
 
-    debug(1, "closing network socket");
-    fflush(stderr);
-    retval = close(serversocketfd);
-    debug(1, "closed internet server socket fd %d, retval %d, errno %d", serversocketfd, retval, errno);
+    /* stop accepting and the connection handling */
+    connection_acceptor_delete();
+    connection_manager_delete();
+
+    /* remove the unix sockets. Within the chroot jail the path is not valid */
+    {
+	int i;
+	for (i=0; i<listeners.num_unixpaths; i++)
+	{
+	    if ( !config_get_chroot() )
+	    {
+		retval = unlink(listeners.unixpaths[i]);
+		if (-1 == retval)
+		    logerror("ERROR: can not remove unix socket '%s'", listeners.unixpaths[i]);
+	    }
+	    free(listeners.unixpaths[i]);
+	}
+	free(listeners.unixpaths);
+
+	/* the connections referenced the project names until now */
+	for (i=0; i<listeners.numprojnames; i++)
+	    free(listeners.projnames[i]);
+	free(listeners.projnames);
+    }
 
     /* wait for the shutdown module so it has closed all its processes
      * Then clean up the module */
@@ -953,6 +1291,8 @@ int main(int argc, char **argv)
 	    remove_pid_file(pidfile);
 	}
     }
+    admission_queue_delete();
+    service_time_delete();
     db_delete();
     config_shutdown();
 
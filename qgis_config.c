@@ -45,16 +45,26 @@
 #include <glob.h>
 #include <sys/queue.h>
 #include <libgen.h>
+#include <sys/socket.h>
 
 #include "logger.h"
 #include "qgis_shutdown_queue.h"
 #include "stringext.h"
+#include "routing_table.h"
 
 
 #define CONFIG_LISTEN_KEY		":listen"
 #define DEFAULT_CONFIG_LISTEN_VALUE	"*"
+#define CONFIG_LISTEN_MODE_KEY		":listen_mode"
+#define DEFAULT_CONFIG_LISTEN_MODE_VALUE	-1	/* keep the mode of the umask */
+#define CONFIG_LISTEN_OWNER_KEY		":listen_owner"
+#define DEFAULT_CONFIG_LISTEN_OWNER_VALUE	NULL
 #define CONFIG_PORT_KEY			":port"
 #define DEFAULT_CONFIG_PORT_VALUE	"10177"
+#define DEFAULT_CONFIG_PROJECT_LISTEN_VALUE	NULL
+#define DEFAULT_CONFIG_PROJECT_PORT_VALUE	NULL
+#define CONFIG_LISTEN_BACKLOG_KEY	":listen_backlog"
+#define DEFAULT_CONFIG_LISTEN_BACKLOG_VALUE	SOMAXCONN
 #define CONFIG_CHUSER_KEY		":chuser"
 #define DEFAULT_CONFIG_CHUSER_VALUE	NULL
 #define CONFIG_CHROOT_KEY		":chroot"
@@ -73,10 +83,28 @@
 #define DEFAULT_CONFIG_CHILD_READ_TIMEOUT	270	/* sec */
 #define CONFIG_CHILD_TERMINATION_TIMEOUT		":proc_term_timeout"
 #define DEFAULT_CONFIG_CHILD_TERMINATION_TIMEOUT	10	/* sec */
+#define CONFIG_CHILD_IDLE_TIMEOUT		":proc_idle_timeout"
+#define DEFAULT_CONFIG_CHILD_IDLE_TIMEOUT	0	/* sec, never */
+#define CONFIG_MAX_QUEUE		":max_queue"
+#define DEFAULT_CONFIG_MAX_QUEUE	100
+#define CONFIG_MAX_QUEUE_WAIT		":max_queue_wait"
+#define DEFAULT_CONFIG_MAX_QUEUE_WAIT	5000	/* msec */
+#define CONFIG_MAX_QUEUE_DELAY		":max_queue_delay"
+#define DEFAULT_CONFIG_MAX_QUEUE_DELAY	1000	/* msec */
+#define CONFIG_PROCESS_SELECT		":process_select"
+#define DEFAULT_CONFIG_PROCESS_SELECT	"mru"
+#define CONFIG_AFFINITY			":affinity"
+#define DEFAULT_CONFIG_AFFINITY		0
+#define CONFIG_CLASS_OF			":class_of"
+#define DEFAULT_CONFIG_CLASS_OF		NULL
 #define CONFIG_SCAN_PARAM		":scan_param"
 #define DEFAULT_CONFIG_SCAN_PARAM	NULL
 #define CONFIG_SCAN_REGEX		":scan_regex"
 #define DEFAULT_CONFIG_SCAN_REGEX	NULL
+#define CONFIG_ROUTE_PARAM		":route_param"
+#define DEFAULT_CONFIG_ROUTE_PARAM	NULL
+#define CONFIG_ROUTE_VALUES		":route_values"
+#define DEFAULT_CONFIG_ROUTE_VALUES	NULL
 #define CONFIG_CWD			":cwd"
 #define DEFAULT_CONFIG_CWD		"/"
 #define CONFIG_PROJ_CONFIG_PATH		":config_file"
@@ -97,6 +125,24 @@
 #define DEFAULT_CONFIG_INCLUDE		NULL
 #define CONFIG_ABORT			":abort_on_error"
 #define DEFAULT_CONFIG_ABORT		0
+#define CONFIG_CONNECTION_MODEL		":connection_model"
+#define DEFAULT_CONFIG_CONNECTION_MODEL	"event"
+#define CONFIG_CONNECTION_WORKERS	":connection_workers"
+#define DEFAULT_CONFIG_CONNECTION_WORKERS	0	/* one worker per cpu core */
+#define CONFIG_CONNECTION_RELAY		":connection_relay"
+#define DEFAULT_CONFIG_CONNECTION_RELAY	"splice"
+#define CONFIG_MAX_TRANSFER_BUFFER	":max_transfer_buffer"
+#define DEFAULT_CONFIG_MAX_TRANSFER_BUFFER	(256*1024)
+#define CONFIG_MULTIPLEX_CONNECTIONS	":multiplex_connections"
+#define DEFAULT_CONFIG_MULTIPLEX_CONNECTIONS	0
+#define CONFIG_ACCEPTORS		":acceptors"
+#define DEFAULT_CONFIG_ACCEPTORS	1
+#define CONFIG_ROUTE_CACHE_SIZE		":route_cache_size"
+#define DEFAULT_CONFIG_ROUTE_CACHE_SIZE	4096
+#define CONFIG_CATCH_ALL		":catch_all"
+#define DEFAULT_CONFIG_CATCH_ALL	NULL
+#define CONFIG_CATCH_ALL_OVERFLOW	":catch_all_overflow"
+#define DEFAULT_CONFIG_CATCH_ALL_OVERFLOW	0
 
 
 #if __WORDSIZE == 64
@@ -453,6 +499,20 @@ static int config_test_for_section_change(dictionary *oldconfig, dictionary *new
 }
 
 
+/* return 1 if the section is in the list, 0 otherwise */
+static int config_section_list_has(struct sectionlist_s *list, const char *section)
+{
+    struct sectioniterator_s *it;
+    STAILQ_FOREACH(it, &list->head, entries)
+    {
+	if ( !strcasecmp(it->section, section) )
+	    return 1;
+    }
+
+    return 0;
+}
+
+
 /* Scans the configuration (global and projects) for differences to the
  * existing configuration.
  * If global variables differ, then all projects are reloaded.
@@ -561,6 +621,34 @@ static int config_has_changed(dictionary *oldconfig, dictionary *newconfig, stru
 	}
     }
 
+    /* the request classes inherit the settings of their project.
+     * if the project changed restart its classes, too.
+     */
+    for (i=0; i<n; i++)
+    {
+	const char *secname = iniparser_getsecname(newconfig, i);
+	char *pkey = astrcat(secname, CONFIG_CLASS_OF);
+	const char *parent = iniparser_getstring(newconfig, pkey, NULL);
+	free(pkey);
+
+	if ( !parent
+		|| !config_section_list_has(sectionchanged, parent)
+		|| config_section_list_has(sectionchanged, secname)
+		|| config_section_list_has(sectionnew, secname) )
+	    continue;
+
+	debug(1, "config differ section '%s' changed with its project '%s'", secname, parent);
+	struct sectioniterator_s *element = malloc(sizeof(*element));
+	assert(element);
+	if ( !element )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	element->section = strdup(secname);
+	STAILQ_APPEND_LIST_ENTRY(sectionchanged, element, entries);
+    }
+
     return 0;
 }
 
@@ -594,7 +682,7 @@ static void config_convert_list_to_array(char ***array, struct sectionlist_s *li
     {
 	assert(i < n);
 	it = STAILQ_FIRST(&list->head);
-	(*array)[i] = it->section;
+	(*array)[i++] = it->section;
 
 	STAILQ_REMOVE_HEAD(&list->head, entries);
 	free(it);
@@ -605,6 +693,10 @@ static void config_convert_list_to_array(char ***array, struct sectionlist_s *li
 
 static void check_config(dictionary *config)
 {
+    const char *catchall = config_get_catch_all();
+    if (catchall && !iniparser_find_entry(config, catchall))
+	printlog("WARNING: catch all project '%s' not found. Requests matching no project are rejected", catchall);
+
     int n = iniparser_getnsec(config);
     int i;
     for (i=0; i<n; i++)
@@ -613,7 +705,21 @@ static void check_config(dictionary *config)
 
 	/* Test if a regular expression is given in the key value pairs */
 	const char *key = config_get_scan_parameter_key(secname);
-	if ( !key )
+	const char *values = config_get_route_values(secname);
+	const char *parent = config_get_class_of(secname);
+	const char *listen = config_get_project_listen(secname);
+	if (listen)
+	{
+	    /* the requests are routed by their listener */
+	}
+	else if (parent)
+	{
+	    if ( !iniparser_find_entry(config, parent) || config_get_class_of(parent) )
+		printlog("WARNING: project '%s' of request class '%s' not found. Can not filter requests for this class", parent, secname);
+	    else if ( !key )
+		printlog("WARNING: no regular expression found for request class '%s'. Can not filter requests for this class", secname);
+	}
+	else if ( !key && !values && !(catchall && !strcasecmp(catchall, secname)) )
 	{
 	    printlog("WARNING: no regular expression found for project '%s'. Can not filter requests for this project", secname);
 	}
@@ -677,9 +783,23 @@ static int config_get_global_config_int(const char *key,  int defaultvalue)
 }
 
 
+/* returns the project of the request class or NULL if "project" is no class.
+ * Call this with the config lock held.
+ */
+static const char *config_nolock__get_parent_project(const char *project)
+{
+    char *pkey = astrcat(project, CONFIG_CLASS_OF);
+    const char *ret = iniparser_getstring(config_opts, pkey, DEFAULT_CONFIG_CLASS_OF);
+    free (pkey);
+
+    return ret;
+}
+
+
 static const char *config_get_project_config_string(const char *project, const char *key,  char *defaultvalue)
 {
     /* if project != NULL we first test the project section, then the
+     * section of the project the request class belongs to, then the
      * global section.
      * if project == NULL we take the global section */
     const char *ret = defaultvalue;
@@ -705,6 +825,14 @@ static const char *config_get_project_config_string(const char *project, const c
 	char *pkey = astrcat(project, key);
 	ret = iniparser_getstring(config_opts, pkey, INVALID_STRING);
 	free (pkey);
+
+	const char *parent = config_nolock__get_parent_project(project);
+	if (INVALID_STRING == ret && parent)
+	{
+	    pkey = astrcat(parent, key);
+	    ret = iniparser_getstring(config_opts, pkey, INVALID_STRING);
+	    free (pkey);
+	}
     }
 
     if (INVALID_STRING == ret)
@@ -796,6 +924,19 @@ static const char *config_get_project_numbered_config_string(const char *project
 	}
 	ret = iniparser_getstring(config_opts, pkey, INVALID_STRING);
 	free (pkey);
+
+	const char *parent = config_nolock__get_parent_project(project);
+	if (INVALID_STRING == ret && parent)
+	{
+	    retval = asprintf(&pkey, "%s%s%d", parent, key, num);
+	    if (-1 == retval)
+	    {
+		logerror("ERROR: asprintf");
+		qexit(EXIT_FAILURE);
+	    }
+	    ret = iniparser_getstring(config_opts, pkey, INVALID_STRING);
+	    free (pkey);
+	}
     }
 
     if (INVALID_STRING == ret)
@@ -826,6 +967,7 @@ static const char *config_get_project_numbered_config_string(const char *project
 static int config_get_project_config_int(const char *project, const char *key, int defaultvalue)
 {
     /* if project != NULL we first test the project section, then the
+     * section of the project the request class belongs to, then the
      * global section.
      * if project == NULL we take the global section */
     int ret = INT32_MIN;
@@ -851,6 +993,14 @@ static int config_get_project_config_int(const char *project, const char *key, i
 	char *pkey = astrcat(project, key);
 	ret = iniparser_getint(config_opts, pkey, INT32_MIN);
 	free (pkey);
+
+	const char *parent = config_nolock__get_parent_project(project);
+	if (INT32_MIN == ret && parent)
+	{
+	    pkey = astrcat(parent, key);
+	    ret = iniparser_getint(config_opts, pkey, INT32_MIN);
+	    free (pkey);
+	}
     }
 
     if (INT32_MIN == ret)
@@ -988,6 +1138,9 @@ int config_load(const char *path, char ***sectionnew, char ***sectionchanged, ch
 
     config_get_abort(); /* get current value and store in static variable */
 
+    /* compile the regular expressions of the projects once */
+    routing_table_update();
+
     if (!config_opts)
 	return -1;
 
@@ -1000,6 +1153,8 @@ void config_shutdown(void)
 {
     // no assert: it's ok to call this with config_opts==NULL
 
+    routing_table_delete();
+
     int retval = pthread_mutex_lock(&config_lock);
     if (retval)
     {
@@ -1083,6 +1238,22 @@ const char *config_get_network_listen(void)
 }
 
 
+int config_get_listen_mode(void)
+{
+    int ret = config_get_global_config_int(CONFIG_LISTEN_MODE_KEY, DEFAULT_CONFIG_LISTEN_MODE_VALUE);
+
+    return ret;
+}
+
+
+const char *config_get_listen_owner(void)
+{
+    const char *ret = config_get_global_config_string(CONFIG_LISTEN_OWNER_KEY, DEFAULT_CONFIG_LISTEN_OWNER_VALUE);
+
+    return ret;
+}
+
+
 const char *config_get_network_port(void)
 {
     const char *ret = config_get_global_config_string(CONFIG_PORT_KEY, DEFAULT_CONFIG_PORT_VALUE);
@@ -1091,6 +1262,30 @@ const char *config_get_network_port(void)
 }
 
 
+int config_get_listen_backlog(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_LISTEN_BACKLOG_KEY, DEFAULT_CONFIG_LISTEN_BACKLOG_VALUE);
+
+    return ret;
+}
+
+
+const char *config_get_project_listen(const char *project)
+{
+    const char *ret = config_get_project_only_config_string(project, CONFIG_LISTEN_KEY, DEFAULT_CONFIG_PROJECT_LISTEN_VALUE);
+
+    return ret;
+}
+
+
+const char *config_get_project_port(const char *project)
+{
+    const char *ret = config_get_project_only_config_string(project, CONFIG_PORT_KEY, DEFAULT_CONFIG_PROJECT_PORT_VALUE);
+
+    return ret;
+}
+
+
 const char *config_get_chuser(void)
 {
     const char *ret = config_get_global_config_string(CONFIG_CHUSER_KEY, DEFAULT_CONFIG_CHUSER_VALUE);
@@ -1147,6 +1342,70 @@ int config_get_abort(void)
 }
 
 
+const char *config_get_connection_model(void)
+{
+    const char *ret = config_get_global_config_string(CONFIG_CONNECTION_MODEL, DEFAULT_CONFIG_CONNECTION_MODEL);
+
+    return ret;
+}
+
+
+int config_get_connection_workers(void)
+{
+    int ret = config_get_global_config_int(CONFIG_CONNECTION_WORKERS, DEFAULT_CONFIG_CONNECTION_WORKERS);
+
+    return ret;
+}
+
+
+const char *config_get_connection_relay(void)
+{
+    const char *ret = config_get_global_config_string(CONFIG_CONNECTION_RELAY, DEFAULT_CONFIG_CONNECTION_RELAY);
+
+    return ret;
+}
+
+
+int config_get_max_transfer_buffer(void)
+{
+    int ret = config_get_global_config_int(CONFIG_MAX_TRANSFER_BUFFER, DEFAULT_CONFIG_MAX_TRANSFER_BUFFER);
+
+    return ret;
+}
+
+
+int config_get_multiplex_connections(void)
+{
+    int ret = config_get_global_config_int(CONFIG_MULTIPLEX_CONNECTIONS, DEFAULT_CONFIG_MULTIPLEX_CONNECTIONS);
+
+    return ret;
+}
+
+
+int config_get_acceptors(void)
+{
+    int ret = config_get_global_config_int(CONFIG_ACCEPTORS, DEFAULT_CONFIG_ACCEPTORS);
+
+    return ret;
+}
+
+
+int config_get_route_cache_size(void)
+{
+    int ret = config_get_global_config_int(CONFIG_ROUTE_CACHE_SIZE, DEFAULT_CONFIG_ROUTE_CACHE_SIZE);
+
+    return ret;
+}
+
+
+const char *config_get_catch_all(void)
+{
+    const char *ret = config_get_global_config_string(CONFIG_CATCH_ALL, DEFAULT_CONFIG_CATCH_ALL);
+
+    return ret;
+}
+
+
 const char *config_get_process(const char *project)
 {
     const char *ret = config_get_project_config_string(project, CONFIG_PROCESS_KEY, DEFAULT_CONFIG_PROCESS_VALUE);
@@ -1195,6 +1454,70 @@ int config_get_term_timeout(void)
 }
 
 
+int config_get_idle_timeout(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_CHILD_IDLE_TIMEOUT, DEFAULT_CONFIG_CHILD_IDLE_TIMEOUT);
+
+    return ret;
+}
+
+
+int config_get_catch_all_overflow(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_CATCH_ALL_OVERFLOW, DEFAULT_CONFIG_CATCH_ALL_OVERFLOW);
+
+    return ret;
+}
+
+
+int config_get_max_queue(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_MAX_QUEUE, DEFAULT_CONFIG_MAX_QUEUE);
+
+    return ret;
+}
+
+
+int config_get_max_queue_wait(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_MAX_QUEUE_WAIT, DEFAULT_CONFIG_MAX_QUEUE_WAIT);
+
+    return ret;
+}
+
+
+int config_get_max_queue_delay(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_MAX_QUEUE_DELAY, DEFAULT_CONFIG_MAX_QUEUE_DELAY);
+
+    return ret;
+}
+
+
+const char *config_get_process_select(const char *project)
+{
+    const char *ret = config_get_project_config_string(project, CONFIG_PROCESS_SELECT, DEFAULT_CONFIG_PROCESS_SELECT);
+
+    return ret;
+}
+
+
+int config_get_affinity(const char *project)
+{
+    int ret = config_get_project_config_int(project, CONFIG_AFFINITY, DEFAULT_CONFIG_AFFINITY);
+
+    return ret;
+}
+
+
+const char *config_get_class_of(const char *project)
+{
+    const char *ret = config_get_project_only_config_string(project, CONFIG_CLASS_OF, DEFAULT_CONFIG_CLASS_OF);
+
+    return ret;
+}
+
+
 const char *config_get_scan_parameter_key(const char *project)
 {
     const char *ret = config_get_project_only_config_string(project, CONFIG_SCAN_PARAM, DEFAULT_CONFIG_SCAN_PARAM);
@@ -1211,6 +1534,22 @@ const char *config_get_scan_parameter_regex(const char *project)
 }
 
 
+const char *config_get_route_param(const char *project)
+{
+    const char *ret = config_get_project_only_config_string(project, CONFIG_ROUTE_PARAM, DEFAULT_CONFIG_ROUTE_PARAM);
+
+    return ret;
+}
+
+
+const char *config_get_route_values(const char *project)
+{
+    const char *ret = config_get_project_only_config_string(project, CONFIG_ROUTE_VALUES, DEFAULT_CONFIG_ROUTE_VALUES);
+
+    return ret;
+}
+
+
 const char *config_get_working_directory(const char *project)
 {
     const char *ret = config_get_project_config_string(project, CONFIG_CWD, DEFAULT_CONFIG_CWD);
@@ -1224,6 +1563,11 @@ const char *config_get_project_config_path(const char *project)
 {
     const char *ret = config_get_project_only_config_string(project, CONFIG_PROJ_CONFIG_PATH, DEFAULT_CONFIG_PROJ_CONFIG_PATH);
 
+    /* the request classes load the configuration of their project */
+    const char *parent = config_get_class_of(project);
+    if ( !ret && parent )
+	ret = config_get_project_only_config_string(parent, CONFIG_PROJ_CONFIG_PATH, DEFAULT_CONFIG_PROJ_CONFIG_PATH);
+
     return ret;
 }
 
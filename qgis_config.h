@@ -40,22 +40,45 @@ int config_get_num_projects(void);
 const char *config_get_name_project(int num);
 const char *config_get_network_listen(void);
 const char *config_get_network_port(void);
+int config_get_listen_backlog(const char *project);
+int config_get_listen_mode(void);
+const char *config_get_listen_owner(void);
 const char *config_get_chuser(void);
 const char *config_get_chroot(void);
 const char *config_get_pid_path(void);
 const char *config_get_logfile(void);
 int config_get_debuglevel(void);
 int config_get_abort(void);
-
-
+const char *config_get_connection_model(void);
+int config_get_connection_workers(void);
+const char *config_get_connection_relay(void);
+int config_get_max_transfer_buffer(void);
+int config_get_multiplex_connections(void);
+int config_get_acceptors(void);
+int config_get_route_cache_size(void);
+const char *config_get_catch_all(void);
+
+
+const char *config_get_project_listen(const char *project);
+const char *config_get_project_port(const char *project);
 const char *config_get_process(const char *project);
 const char *config_get_process_args(const char *project);
 int config_get_min_idle_processes(const char *project);
 int config_get_max_idle_processes(const char *project);
 int config_get_read_timeout(const char *project);
 int config_get_term_timeout(void);
+int config_get_idle_timeout(const char *project);
+int config_get_catch_all_overflow(const char *project);
+int config_get_max_queue(const char *project);
+int config_get_max_queue_wait(const char *project);
+int config_get_max_queue_delay(const char *project);
+const char *config_get_process_select(const char *project);
+int config_get_affinity(const char *project);
+const char *config_get_class_of(const char *project);
 const char *config_get_scan_parameter_key(const char *project);
 const char *config_get_scan_parameter_regex(const char *project);
+const char *config_get_route_param(const char *project);
+const char *config_get_route_values(const char *project);
 const char *config_get_working_directory(const char *project);
 const char *config_get_project_config_path(const char *project);
 const char *config_get_init_key(const char *project, int num);
@@ -0,0 +1,1150 @@
+/*
+ * regex_matcher.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Match many POSIX extended regular expressions in one pass over a string.
+
+    All patterns are compiled into one nondeterministic automaton (NFA), the
+    final state of each pattern is tagged with the pattern id. The
+    deterministic automaton (DFA) is built from it lazily while matching:
+    each DFA state is the set of NFA states active after the bytes read so
+    far, a transition is computed the first time it is needed and then
+    reused. Bytes which no pattern can tell apart share one transition.
+    The string is read once, the result is the smallest id of all patterns
+    matching anywhere in the string, like regexec() would find by testing
+    the patterns in order of their id.
+
+    The parser understands the syntax of POSIX extended regular expressions
+    as regcomp() does in the "C" locale. Patterns using GNU extensions like
+    back references, "\w" or "\b", or collating elements are rejected, the
+    caller has to use regexec() for them.
+    The DFA is shared by all threads. Following a known transition needs no
+    lock, a new transition is computed with the matcher locked. If the DFA
+    grows too large no more states are added, and the caller has to use
+    regexec() for the strings which need new states.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "regex_matcher.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "logger.h"
+#include "qgis_shutdown_queue.h"
+
+
+#define MAX_PATTERN_NFA_STATES	10000	/* larger patterns are rejected */
+#define MAX_REPEAT		255	/* RE_DUP_MAX */
+#define MAX_DFA_MEMORY		(16*1024*1024)	/* bytes of the DFA states of one matcher */
+#define NUM_BYTES		256
+
+
+enum nfa_type_e
+{
+    NFA_CHAR,		// read a byte of the set
+    NFA_SPLIT,		// continue with out and out1
+    NFA_BOL,		// continue with out at the begin of the string
+    NFA_EOL,		// continue with out at the end of the string
+    NFA_MATCH		// pattern id has matched
+};
+
+
+struct nfa_state_s
+{
+    enum nfa_type_e type;
+    int out;
+    int out1;
+    int set;		// index of the byte set of NFA_CHAR
+    int id;		// pattern id of NFA_MATCH
+};
+
+
+struct byte_set_s
+{
+    uint8_t bit[NUM_BYTES/8];
+};
+
+
+struct dfa_state_s
+{
+    struct dfa_state_s *hash_next;	// chain of the hash bucket
+    struct dfa_state_s *list_next;	// list of all states
+    uint32_t hash;
+    int match;			// smallest id matching after this byte, -1 none
+    int match_eol;		// smallest id matching if the string ends here
+    int num_nfa;
+    int *nfa;			// sorted set of the NFA states
+    struct dfa_state_s **next;	// transition for each byte class, NULL if not known yet
+};
+
+
+struct regex_matcher_s
+{
+    pthread_mutex_t lock;
+
+    struct nfa_state_s *nfa;
+    int num_nfa;
+    int size_nfa;
+    struct byte_set_s *set;
+    int num_set;
+    int size_set;
+    int *start;			// start state of each pattern
+    int num_start;
+    int size_start;
+    int min_id;
+
+    /* after compile */
+    uint8_t byteclass[NUM_BYTES];
+    uint8_t classbyte[NUM_BYTES];	// a byte of each class
+    int num_class;
+    struct dfa_state_s *initial;
+    struct dfa_state_s **bucket;
+    uint32_t num_bucket;
+    int num_dfa;
+    size_t dfa_memory;
+    int is_full;
+    struct dfa_state_s *dfa_list;
+
+    /* work buffers of the DFA construction */
+    int *mark;
+    int generation;
+    int *stack;
+    int *work;
+};
+
+
+enum regex_node_type_e
+{
+    NODE_EMPTY,
+    NODE_SET,
+    NODE_BOL,
+    NODE_EOL,
+    NODE_CONCAT,
+    NODE_ALT,
+    NODE_REPEAT
+};
+
+
+struct regex_node_s
+{
+    enum regex_node_type_e type;
+    int left;
+    int right;
+    int set;
+    int min;
+    int max;		// -1 is unlimited
+};
+
+
+struct regex_parser_s
+{
+    struct regex_matcher_s *matcher;
+    const char *p;
+    int depth;
+    int is_unsupported;
+    struct regex_node_s *node;
+    int num_node;
+    int size_node;
+};
+
+
+static void *regex_matcher_alloc(void *ptr, size_t size)
+{
+    void *ret = realloc(ptr, size);
+    assert(ret);
+    if ( !ret )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    return ret;
+}
+
+
+static void regex_matcher_lock(struct regex_matcher_s *matcher)
+{
+    int retval = pthread_mutex_lock(&matcher->lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void regex_matcher_unlock(struct regex_matcher_s *matcher)
+{
+    int retval = pthread_mutex_unlock(&matcher->lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static inline int byte_set_has(const struct byte_set_s *set, int c)
+{
+    return set->bit[c >> 3] & (1 << (c & 7));
+}
+
+
+static inline void byte_set_add(struct byte_set_s *set, int c)
+{
+    set->bit[c >> 3] |= (1 << (c & 7));
+}
+
+
+static int regex_matcher_new_set(struct regex_matcher_s *matcher)
+{
+    if (matcher->num_set >= matcher->size_set)
+    {
+	matcher->size_set = matcher->size_set ? 2*matcher->size_set : 64;
+	matcher->set = regex_matcher_alloc(matcher->set, matcher->size_set * sizeof(*matcher->set));
+    }
+    memset(&matcher->set[matcher->num_set], 0, sizeof(*matcher->set));
+
+    return matcher->num_set++;
+}
+
+
+static int regex_matcher_new_nfa(struct regex_matcher_s *matcher, enum nfa_type_e type, int out, int out1)
+{
+    if (matcher->num_nfa >= matcher->size_nfa)
+    {
+	matcher->size_nfa = matcher->size_nfa ? 2*matcher->size_nfa : 256;
+	matcher->nfa = regex_matcher_alloc(matcher->nfa, matcher->size_nfa * sizeof(*matcher->nfa));
+    }
+    struct nfa_state_s *state = &matcher->nfa[matcher->num_nfa];
+    state->type = type;
+    state->out = out;
+    state->out1 = out1;
+    state->set = -1;
+    state->id = -1;
+
+    return matcher->num_nfa++;
+}
+
+
+/*
+ * parser of the regular expression into a syntax tree
+ */
+
+static int regex_parser_new_node(struct regex_parser_s *ps, enum regex_node_type_e type, int left, int right)
+{
+    if (ps->num_node >= ps->size_node)
+    {
+	ps->size_node = ps->size_node ? 2*ps->size_node : 64;
+	ps->node = regex_matcher_alloc(ps->node, ps->size_node * sizeof(*ps->node));
+    }
+    struct regex_node_s *node = &ps->node[ps->num_node];
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->set = -1;
+    node->min = node->max = 0;
+
+    return ps->num_node++;
+}
+
+
+static int regex_parser_new_set_node(struct regex_parser_s *ps)
+{
+    int node = regex_parser_new_node(ps, NODE_SET, -1, -1);
+    ps->node[node].set = regex_matcher_new_set(ps->matcher);
+
+    return node;
+}
+
+
+/* add the bytes of the character class "[:name:]" to the set.
+ * returns 0 on success, -1 if the name is unknown
+ */
+static int regex_parser_add_class(struct byte_set_s *set, const char *name, int len)
+{
+    static const struct
+    {
+	const char *name;
+	int (*is)(int);
+    } classes[] =
+    {
+	{ "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+	{ "upper", isupper }, { "lower", islower }, { "space", isspace },
+	{ "blank", isblank }, { "punct", ispunct }, { "print", isprint },
+	{ "graph", isgraph }, { "cntrl", iscntrl }, { "xdigit", isxdigit },
+    };
+
+    unsigned int i;
+    for (i=0; i<sizeof(classes)/sizeof(classes[0]); i++)
+    {
+	if ((int)strlen(classes[i].name) == len && 0 == strncmp(classes[i].name, name, len))
+	{
+	    int c;
+	    for (c=1; c<NUM_BYTES; c++)
+		if (classes[i].is(c))
+		    byte_set_add(set, c);
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
+
+/* parse the bracket expression after '[' */
+static int regex_parser_bracket(struct regex_parser_s *ps)
+{
+    int node = regex_parser_new_set_node(ps);
+    struct byte_set_s set;
+    memset(&set, 0, sizeof(set));
+
+    int is_negated = 0;
+    if ('^' == *ps->p)
+    {
+	is_negated = 1;
+	ps->p++;
+    }
+
+    int is_first = 1;
+    while (is_first || ']' != *ps->p)
+    {
+	is_first = 0;
+	int c = (unsigned char)*ps->p;
+	if ( !c )
+	{
+	    ps->is_unsupported = 1;
+	    return node;
+	}
+
+	if ('[' == c && ':' == ps->p[1])
+	{
+	    const char *name = ps->p + 2;
+	    const char *end = strstr(name, ":]");
+	    if ( !end || regex_parser_add_class(&set, name, end - name) )
+	    {
+		ps->is_unsupported = 1;
+		return node;
+	    }
+	    ps->p = end + 2;
+	    continue;
+	}
+	if ('[' == c && ('.' == ps->p[1] || '=' == ps->p[1]))
+	{
+	    /* collating elements and equivalence classes */
+	    ps->is_unsupported = 1;
+	    return node;
+	}
+
+	ps->p++;
+	int last = c;
+	if ('-' == ps->p[0] && ']' != ps->p[1] && '\0' != ps->p[1])
+	{
+	    last = (unsigned char)ps->p[1];
+	    if ('[' == last || last < c)
+	    {
+		ps->is_unsupported = 1;
+		return node;
+	    }
+	    ps->p += 2;
+	}
+	for (; c<=last; c++)
+	    byte_set_add(&set, c);
+    }
+    ps->p++;	// ']'
+
+    struct byte_set_s *nodeset = &ps->matcher->set[ps->node[node].set];
+    int c;
+    for (c=1; c<NUM_BYTES; c++)
+	if ( is_negated ? !byte_set_has(&set, c) : byte_set_has(&set, c) )
+	    byte_set_add(nodeset, c);
+
+    return node;
+}
+
+
+static int regex_parser_regex(struct regex_parser_s *ps);
+
+
+static int regex_parser_atom(struct regex_parser_s *ps)
+{
+    int node;
+    int c = (unsigned char)*ps->p++;
+    switch (c)
+    {
+    case '(':
+	ps->depth++;
+	if (')' == *ps->p)
+	    node = regex_parser_new_node(ps, NODE_EMPTY, -1, -1);
+	else
+	    node = regex_parser_regex(ps);
+	if (')' != *ps->p)
+	{
+	    ps->is_unsupported = 1;
+	    return node;
+	}
+	ps->p++;
+	ps->depth--;
+	break;
+
+    case '.':
+	node = regex_parser_new_set_node(ps);
+	for (c=1; c<NUM_BYTES; c++)
+	    byte_set_add(&ps->matcher->set[ps->node[node].set], c);
+	break;
+
+    case '^':
+	node = regex_parser_new_node(ps, NODE_BOL, -1, -1);
+	break;
+
+    case '$':
+	node = regex_parser_new_node(ps, NODE_EOL, -1, -1);
+	break;
+
+    case '[':
+	node = regex_parser_bracket(ps);
+	break;
+
+    case '\\':
+	c = (unsigned char)*ps->p++;
+	/* GNU extensions and back references */
+	if ( !c || isalnum(c) || strchr("<>`'", c) )
+	{
+	    ps->is_unsupported = 1;
+	    return -1;
+	}
+	node = regex_parser_new_set_node(ps);
+	byte_set_add(&ps->matcher->set[ps->node[node].set], c);
+	break;
+
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+	/* repetition of nothing, regcomp() handles this in its own way */
+	ps->is_unsupported = 1;
+	return -1;
+
+    default:
+	node = regex_parser_new_set_node(ps);
+	byte_set_add(&ps->matcher->set[ps->node[node].set], c);
+	break;
+    }
+
+    return node;
+}
+
+
+/* parse the number of a bound "{m,n}".
+ * returns the number or -1 if there is none
+ */
+static int regex_parser_number(struct regex_parser_s *ps)
+{
+    if ( !isdigit((unsigned char)*ps->p) )
+	return -1;
+
+    int num = 0;
+    while (isdigit((unsigned char)*ps->p))
+    {
+	num = 10*num + (*ps->p++ - '0');
+	if (num > MAX_REPEAT)
+	    return MAX_REPEAT+1;
+    }
+
+    return num;
+}
+
+
+static int regex_parser_piece(struct regex_parser_s *ps)
+{
+    int node = regex_parser_atom(ps);
+    if (ps->is_unsupported)
+	return node;
+
+    for (;;)
+    {
+	int min, max;
+	switch (*ps->p)
+	{
+	case '*':
+	    min = 0;
+	    max = -1;
+	    ps->p++;
+	    break;
+
+	case '+':
+	    min = 1;
+	    max = -1;
+	    ps->p++;
+	    break;
+
+	case '?':
+	    min = 0;
+	    max = 1;
+	    ps->p++;
+	    break;
+
+	case '{':
+	    ps->p++;
+	    min = regex_parser_number(ps);
+	    if (-1 == min)
+		min = 0;
+	    max = min;
+	    if (',' == *ps->p)
+	    {
+		ps->p++;
+		max = regex_parser_number(ps);
+	    }
+	    if ('}' != *ps->p || min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && max < min))
+	    {
+		ps->is_unsupported = 1;
+		return node;
+	    }
+	    ps->p++;
+	    break;
+
+	default:
+	    return node;
+	}
+
+	enum regex_node_type_e type = ps->node[node].type;
+	if (NODE_BOL == type || NODE_EOL == type)
+	{
+	    ps->is_unsupported = 1;
+	    return node;
+	}
+
+	int repeat = regex_parser_new_node(ps, NODE_REPEAT, node, -1);
+	ps->node[repeat].min = min;
+	ps->node[repeat].max = max;
+	node = repeat;
+    }
+}
+
+
+static int regex_parser_branch(struct regex_parser_s *ps)
+{
+    int node = regex_parser_new_node(ps, NODE_EMPTY, -1, -1);
+    while (*ps->p && '|' != *ps->p && !ps->is_unsupported)
+    {
+	if (')' == *ps->p)
+	{
+	    /* end of group, or a single ')' regcomp() takes literally */
+	    if (0 == ps->depth)
+		ps->is_unsupported = 1;
+	    break;
+	}
+
+	int piece = regex_parser_piece(ps);
+	if (ps->is_unsupported)
+	    break;
+	if (NODE_EMPTY == ps->node[node].type)
+	    node = piece;
+	else
+	    node = regex_parser_new_node(ps, NODE_CONCAT, node, piece);
+    }
+
+    return node;
+}
+
+
+static int regex_parser_regex(struct regex_parser_s *ps)
+{
+    int node = regex_parser_branch(ps);
+    while ('|' == *ps->p && !ps->is_unsupported)
+    {
+	ps->p++;
+	int right = regex_parser_branch(ps);
+	node = regex_parser_new_node(ps, NODE_ALT, node, right);
+    }
+
+    return node;
+}
+
+
+/*
+ * construction of the NFA from the syntax tree, back to front
+ */
+
+/* returns the first NFA state of the node, which continues with next */
+static int regex_matcher_compile_node(struct regex_matcher_s *matcher, const struct regex_parser_s *ps, int num, int next, int maxstates)
+{
+    if (matcher->num_nfa > maxstates)
+	return next;
+
+    const struct regex_node_s *node = &ps->node[num];
+    int state;
+    int i;
+    switch (node->type)
+    {
+    case NODE_EMPTY:
+	return next;
+
+    case NODE_SET:
+	state = regex_matcher_new_nfa(matcher, NFA_CHAR, next, -1);
+	matcher->nfa[state].set = node->set;
+	return state;
+
+    case NODE_BOL:
+	return regex_matcher_new_nfa(matcher, NFA_BOL, next, -1);
+
+    case NODE_EOL:
+	return regex_matcher_new_nfa(matcher, NFA_EOL, next, -1);
+
+    case NODE_CONCAT:
+	next = regex_matcher_compile_node(matcher, ps, node->right, next, maxstates);
+	return regex_matcher_compile_node(matcher, ps, node->left, next, maxstates);
+
+    case NODE_ALT:
+    {
+	int left = regex_matcher_compile_node(matcher, ps, node->left, next, maxstates);
+	int right = regex_matcher_compile_node(matcher, ps, node->right, next, maxstates);
+	return regex_matcher_new_nfa(matcher, NFA_SPLIT, left, right);
+    }
+
+    case NODE_REPEAT:
+	if (0 > node->max)
+	{
+	    /* a{m,} is m times a followed by a* */
+	    state = regex_matcher_new_nfa(matcher, NFA_SPLIT, -1, next);
+	    int body = regex_matcher_compile_node(matcher, ps, node->left, state, maxstates);
+	    matcher->nfa[state].out = body;
+	    next = state;
+	}
+	else
+	{
+	    /* a{m,n} is m times a followed by (a(a(..)?)?)? */
+	    int optional = next;
+	    for (i=node->min; i<node->max; i++)
+	    {
+		int body = regex_matcher_compile_node(matcher, ps, node->left, optional, maxstates);
+		optional = regex_matcher_new_nfa(matcher, NFA_SPLIT, body, next);
+	    }
+	    next = optional;
+	}
+	for (i=0; i<node->min; i++)
+	    next = regex_matcher_compile_node(matcher, ps, node->left, next, maxstates);
+	return next;
+    }
+
+    assert(0);
+    return next;
+}
+
+
+struct regex_matcher_s *regex_matcher_new(void)
+{
+    struct regex_matcher_s *matcher = calloc(1, sizeof(*matcher));
+    assert(matcher);
+    if ( !matcher )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    int retval = pthread_mutex_init(&matcher->lock, NULL);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: init mutex");
+	qexit(EXIT_FAILURE);
+    }
+    matcher->min_id = -1;
+
+    return matcher;
+}
+
+
+void regex_matcher_delete(struct regex_matcher_s *matcher)
+{
+    if ( !matcher )
+	return;
+
+    struct dfa_state_s *dfa = matcher->initial;
+    if (dfa)
+    {
+	free(dfa->next);
+	free(dfa->nfa);
+	free(dfa);
+    }
+    while ((dfa = matcher->dfa_list) != NULL)
+    {
+	matcher->dfa_list = dfa->list_next;
+	free(dfa->next);
+	free(dfa->nfa);
+	free(dfa);
+    }
+
+    pthread_mutex_destroy(&matcher->lock);
+    free(matcher->bucket);
+    free(matcher->mark);
+    free(matcher->stack);
+    free(matcher->work);
+    free(matcher->start);
+    free(matcher->set);
+    free(matcher->nfa);
+    free(matcher);
+}
+
+
+/* add the pattern with its id to the matcher. The pattern must have been
+ * accepted by regcomp() with REG_EXTENDED.
+ * returns 0 on success, -1 if the pattern can not be handled by the matcher
+ */
+int regex_matcher_add(struct regex_matcher_s *matcher, const char *pattern, int id)
+{
+    assert(matcher);
+    assert(pattern);
+    assert(id >= 0);
+    assert( !matcher->initial );
+
+    const int num_nfa = matcher->num_nfa;
+    const int num_set = matcher->num_set;
+
+    struct regex_parser_s ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.matcher = matcher;
+    ps.p = pattern;
+
+    int root = regex_parser_regex(&ps);
+    if ('\0' != *ps.p)
+	ps.is_unsupported = 1;
+
+    if ( !ps.is_unsupported )
+    {
+	int match = regex_matcher_new_nfa(matcher, NFA_MATCH, -1, -1);
+	matcher->nfa[match].id = id;
+	int maxstates = num_nfa + MAX_PATTERN_NFA_STATES;
+	int start = regex_matcher_compile_node(matcher, &ps, root, match, maxstates);
+	if (matcher->num_nfa > maxstates)
+	{
+	    ps.is_unsupported = 1;
+	}
+	else
+	{
+	    if (matcher->num_start >= matcher->size_start)
+	    {
+		matcher->size_start = matcher->size_start ? 2*matcher->size_start : 16;
+		matcher->start = regex_matcher_alloc(matcher->start, matcher->size_start * sizeof(*matcher->start));
+	    }
+	    matcher->start[matcher->num_start++] = start;
+	    if (0 > matcher->min_id || id < matcher->min_id)
+		matcher->min_id = id;
+	}
+    }
+
+    free(ps.node);
+
+    if (ps.is_unsupported)
+    {
+	/* forget the states of this pattern */
+	matcher->num_nfa = num_nfa;
+	matcher->num_set = num_set;
+	return -1;
+    }
+
+    return 0;
+}
+
+
+int regex_matcher_get_num_patterns(const struct regex_matcher_s *matcher)
+{
+    return matcher->num_start;
+}
+
+
+/*
+ * construction of the DFA
+ */
+
+static int regex_matcher_compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+
+/* collect the NFA states reachable from the seeds without reading a byte.
+ * Split states are followed, begin of line states only if is_bol is set.
+ * The states reading a byte, the end of line and the match states are
+ * stored sorted in matcher->work.
+ * returns the number of states
+ */
+static int regex_matcher_closure(struct regex_matcher_s *matcher, const int *seed, int num_seed, int is_bol)
+{
+    int num = 0;
+    int top = 0;
+    int i;
+
+    matcher->generation++;
+    for (i=0; i<num_seed; i++)
+	matcher->stack[top++] = seed[i];
+
+    while (top > 0)
+    {
+	int s = matcher->stack[--top];
+	if (0 > s || matcher->mark[s] == matcher->generation)
+	    continue;
+	matcher->mark[s] = matcher->generation;
+
+	const struct nfa_state_s *state = &matcher->nfa[s];
+	switch (state->type)
+	{
+	case NFA_CHAR:
+	case NFA_EOL:
+	case NFA_MATCH:
+	    matcher->work[num++] = s;
+	    break;
+
+	case NFA_SPLIT:
+	    matcher->stack[top++] = state->out1;
+	    matcher->stack[top++] = state->out;
+	    break;
+
+	case NFA_BOL:
+	    if (is_bol)
+		matcher->stack[top++] = state->out;
+	    break;
+	}
+    }
+
+    qsort(matcher->work, num, sizeof(*matcher->work), regex_matcher_compare_int);
+
+    return num;
+}
+
+
+/* returns the smallest pattern id of the match states in the set.
+ * With is_eol the end of line states are followed as well.
+ */
+static int regex_matcher_find_match(struct regex_matcher_s *matcher, const int *set, int num, int is_eol, int is_bol)
+{
+    int ret = -1;
+    int top = 0;
+    int i;
+
+    matcher->generation++;
+    for (i=0; i<num; i++)
+	matcher->stack[top++] = set[i];
+
+    while (top > 0)
+    {
+	int s = matcher->stack[--top];
+	if (0 > s || matcher->mark[s] == matcher->generation)
+	    continue;
+	matcher->mark[s] = matcher->generation;
+
+	const struct nfa_state_s *state = &matcher->nfa[s];
+	switch (state->type)
+	{
+	case NFA_MATCH:
+	    if (0 > ret || state->id < ret)
+		ret = state->id;
+	    break;
+
+	case NFA_EOL:
+	    if (is_eol)
+		matcher->stack[top++] = state->out;
+	    break;
+
+	case NFA_SPLIT:
+	    matcher->stack[top++] = state->out1;
+	    matcher->stack[top++] = state->out;
+	    break;
+
+	case NFA_BOL:
+	    if (is_bol)
+		matcher->stack[top++] = state->out;
+	    break;
+
+	case NFA_CHAR:
+	    break;
+	}
+    }
+
+    return ret;
+}
+
+
+static uint32_t regex_matcher_hash_set(const int *set, int num)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+    for (i=0; i<num; i++)
+    {
+	hash ^= (uint32_t)set[i];
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+static struct dfa_state_s *regex_matcher_new_dfa(struct regex_matcher_s *matcher, const int *set, int num, uint32_t hash, int is_bol)
+{
+    struct dfa_state_s *dfa = calloc(1, sizeof(*dfa));
+    assert(dfa);
+    if ( !dfa )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    dfa->hash = hash;
+    dfa->num_nfa = num;
+    dfa->nfa = regex_matcher_alloc(NULL, max(num, 1) * sizeof(*dfa->nfa));
+    memcpy(dfa->nfa, set, num * sizeof(*set));
+    dfa->next = calloc(matcher->num_class, sizeof(*dfa->next));
+    assert(dfa->next);
+    if ( !dfa->next )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    dfa->match = regex_matcher_find_match(matcher, set, num, 0, is_bol);
+    dfa->match_eol = regex_matcher_find_match(matcher, set, num, 1, is_bol);
+
+    matcher->dfa_memory += sizeof(*dfa) + num * sizeof(*set) + matcher->num_class * sizeof(*dfa->next);
+
+    return dfa;
+}
+
+
+/* find the DFA state of the set or add a new one.
+ * returns the state or NULL if the DFA is full
+ */
+static struct dfa_state_s *regex_matcher_intern_dfa(struct regex_matcher_s *matcher, const int *set, int num)
+{
+    uint32_t hash = regex_matcher_hash_set(set, num);
+    struct dfa_state_s *dfa;
+    for (dfa = matcher->bucket[hash & (matcher->num_bucket-1)]; dfa; dfa = dfa->hash_next)
+    {
+	if (dfa->hash == hash && dfa->num_nfa == num && 0 == memcmp(dfa->nfa, set, num * sizeof(*set)))
+	    return dfa;
+    }
+
+    if (matcher->dfa_memory > MAX_DFA_MEMORY)
+    {
+	if ( !matcher->is_full )
+	{
+	    printlog("WARNING: regular expression automaton with %d patterns reached its maximum of %d states. Unknown strings are matched one pattern after the other", matcher->num_start, matcher->num_dfa);
+	    matcher->is_full = 1;
+	}
+	return NULL;
+    }
+
+    /* grow the hash table */
+    if ((uint32_t)matcher->num_dfa >= matcher->num_bucket)
+    {
+	uint32_t size = 2*matcher->num_bucket;
+	struct dfa_state_s **bucket = calloc(size, sizeof(*bucket));
+	assert(bucket);
+	if ( !bucket )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	uint32_t i;
+	for (i=0; i<matcher->num_bucket; i++)
+	{
+	    while ((dfa = matcher->bucket[i]) != NULL)
+	    {
+		matcher->bucket[i] = dfa->hash_next;
+		dfa->hash_next = bucket[dfa->hash & (size-1)];
+		bucket[dfa->hash & (size-1)] = dfa;
+	    }
+	}
+	free(matcher->bucket);
+	matcher->bucket = bucket;
+	matcher->num_bucket = size;
+    }
+
+    dfa = regex_matcher_new_dfa(matcher, set, num, hash, 0);
+    dfa->hash_next = matcher->bucket[hash & (matcher->num_bucket-1)];
+    matcher->bucket[hash & (matcher->num_bucket-1)] = dfa;
+    dfa->list_next = matcher->dfa_list;
+    matcher->dfa_list = dfa;
+    matcher->num_dfa++;
+
+    return dfa;
+}
+
+
+/* compute the transition of the state with the byte class.
+ * returns the next state or NULL if the DFA is full
+ */
+static struct dfa_state_s *regex_matcher_step(struct regex_matcher_s *matcher, struct dfa_state_s *dfa, int class)
+{
+    regex_matcher_lock(matcher);
+
+    /* some other thread may have been faster */
+    struct dfa_state_s *next = __atomic_load_n(&dfa->next[class], __ATOMIC_ACQUIRE);
+    if ( !next && !matcher->is_full )
+    {
+	/* the states after reading the byte, and the start states of all
+	 * patterns because they match anywhere in the string */
+	int c = matcher->classbyte[class];
+	int *seed = regex_matcher_alloc(NULL, (dfa->num_nfa + matcher->num_start) * sizeof(*seed));
+	int num_seed = 0;
+	int i;
+	for (i=0; i<dfa->num_nfa; i++)
+	{
+	    const struct nfa_state_s *state = &matcher->nfa[dfa->nfa[i]];
+	    if (NFA_CHAR == state->type && byte_set_has(&matcher->set[state->set], c))
+		seed[num_seed++] = state->out;
+	}
+	memcpy(seed + num_seed, matcher->start, matcher->num_start * sizeof(*seed));
+	num_seed += matcher->num_start;
+
+	int num = regex_matcher_closure(matcher, seed, num_seed, 0);
+	free(seed);
+
+	next = regex_matcher_intern_dfa(matcher, matcher->work, num);
+	if (next)
+	    __atomic_store_n(&dfa->next[class], next, __ATOMIC_RELEASE);
+    }
+
+    regex_matcher_unlock(matcher);
+
+    return next;
+}
+
+
+/* finish the matcher after all patterns have been added. The byte classes
+ * and the initial state are computed.
+ */
+void regex_matcher_compile(struct regex_matcher_s *matcher)
+{
+    assert(matcher);
+    assert( !matcher->initial );
+
+    /* refine the byte classes with each set of the patterns. Bytes of one
+     * class are in the same sets */
+    int count_in[NUM_BYTES];
+    int count_all[NUM_BYTES];
+    int newclass[NUM_BYTES];
+    memset(matcher->byteclass, 0, sizeof(matcher->byteclass));
+    matcher->num_class = 1;
+    int i, c;
+    for (i=0; i<matcher->num_set; i++)
+    {
+	const struct byte_set_s *set = &matcher->set[i];
+	memset(count_in, 0, sizeof(count_in));
+	memset(count_all, 0, sizeof(count_all));
+	for (c=0; c<NUM_BYTES; c++)
+	{
+	    count_all[matcher->byteclass[c]]++;
+	    if (byte_set_has(set, c))
+		count_in[matcher->byteclass[c]]++;
+	}
+	for (c=0; c<matcher->num_class; c++)
+	    newclass[c] = -1;
+	for (c=0; c<NUM_BYTES; c++)
+	{
+	    int class = matcher->byteclass[c];
+	    if (byte_set_has(set, c) && count_in[class] < count_all[class])
+	    {
+		if (0 > newclass[class])
+		    newclass[class] = matcher->num_class++;
+		matcher->byteclass[c] = newclass[class];
+	    }
+	}
+    }
+    for (c=NUM_BYTES-1; c>=0; c--)
+	matcher->classbyte[matcher->byteclass[c]] = c;
+
+    matcher->mark = calloc(max(matcher->num_nfa, 1), sizeof(*matcher->mark));
+    matcher->stack = regex_matcher_alloc(NULL, (2*matcher->num_nfa + matcher->num_start + 1) * sizeof(*matcher->stack));
+    matcher->work = regex_matcher_alloc(NULL, (matcher->num_nfa + 1) * sizeof(*matcher->work));
+    assert(matcher->mark);
+    if ( !matcher->mark )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    matcher->num_bucket = 64;
+    matcher->bucket = calloc(matcher->num_bucket, sizeof(*matcher->bucket));
+    assert(matcher->bucket);
+    if ( !matcher->bucket )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    /* the initial state is the only one at the begin of the string. It is
+     * not shared with the other states */
+    int num = regex_matcher_closure(matcher, matcher->start, matcher->num_start, 1);
+    matcher->initial = regex_matcher_new_dfa(matcher, matcher->work, num, 0, 1);
+
+    debug(1, "regular expression automaton with %d patterns, %d NFA states, %d byte classes", matcher->num_start, matcher->num_nfa, matcher->num_class);
+}
+
+
+/* match all patterns against the string.
+ * returns the smallest id of the patterns matching, REGEX_MATCHER_NOMATCH if
+ * none matches or REGEX_MATCHER_FULL if the automaton grew too large to
+ * match this string.
+ */
+int regex_matcher_match(struct regex_matcher_s *matcher, const char *string)
+{
+    assert(matcher);
+    assert(matcher->initial);
+    assert(string);
+
+    struct dfa_state_s *dfa = matcher->initial;
+    int ret = dfa->match;
+    const unsigned char *p;
+    for (p = (const unsigned char *)string; *p; p++)
+    {
+	/* no pattern can do better */
+	if (ret == matcher->min_id)
+	    return ret;
+
+	int class = matcher->byteclass[*p];
+	struct dfa_state_s *next = __atomic_load_n(&dfa->next[class], __ATOMIC_ACQUIRE);
+	if ( !next )
+	{
+	    next = regex_matcher_step(matcher, dfa, class);
+	    if ( !next )
+		return REGEX_MATCHER_FULL;
+	}
+	dfa = next;
+
+	if (0 <= dfa->match && (0 > ret || dfa->match < ret))
+	    ret = dfa->match;
+    }
+
+    if (0 <= dfa->match_eol && (0 > ret || dfa->match_eol < ret))
+	ret = dfa->match_eol;
+
+    return (0 <= ret) ? ret : REGEX_MATCHER_NOMATCH;
+}
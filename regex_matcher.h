@@ -0,0 +1,50 @@
+/*
+ * regex_matcher.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Match many POSIX extended regular expressions in one pass over a string.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef REGEX_MATCHER_H_
+#define REGEX_MATCHER_H_
+
+
+/* return values of regex_matcher_match() besides a pattern id */
+#define REGEX_MATCHER_NOMATCH	(-1)	// no pattern matches
+#define REGEX_MATCHER_FULL	(-2)	// the automaton is too large, use regexec()
+
+struct regex_matcher_s;
+
+
+struct regex_matcher_s *regex_matcher_new(void);
+void regex_matcher_delete(struct regex_matcher_s *matcher);
+int regex_matcher_add(struct regex_matcher_s *matcher, const char *pattern, int id);
+void regex_matcher_compile(struct regex_matcher_s *matcher);
+int regex_matcher_match(struct regex_matcher_s *matcher, const char *string);
+int regex_matcher_get_num_patterns(const struct regex_matcher_s *matcher);
+
+
+#endif /* REGEX_MATCHER_H_ */
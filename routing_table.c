@@ -0,0 +1,1175 @@
+/*
+ * routing_table.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Routing of the requests to their projects.
+    The table holds the request parameter key and the compiled regular
+    expression of each project in the order of the configuration.
+    Projects recognised by the exact value of a query parameter are found
+    with a hash table over the parameter name and value. A request is
+    scanned once for all of them, only the regular expressions of projects
+    further up in the configuration are tested in addition.
+    The regular expressions of all projects scanning the same request
+    parameter are combined into one automaton, which finds the first
+    matching project in one pass over the parameter value. Expressions the
+    automaton does not understand are tested with regexec() one by one.
+    The table knows the request parameters it looks at. A request can be
+    routed as soon as they have arrived, before the rest of the parameters.
+    The decisions are kept in a cache over the values of these parameters.
+    It is replaced with the table.
+    The table is built after each load of the configuration and never
+    changed afterwards, besides its cache.
+    The routing of a request holds the read lock of the table and compiles
+    nothing. A new table replaces the current one under the write lock, the
+    replaced table is freed as soon as no request is routed with it.
+    The project names given to the requests are kept in a pool of their own
+    until the program ends. A request may use its name after its table has
+    been freed.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#define _GNU_SOURCE
+
+#include "routing_table.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <regex.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "logger.h"
+#include "fcgi_state.h"
+#include "qgis_config.h"
+#include "qgis_shutdown_queue.h"
+#include "regex_matcher.h"
+#include "statistic.h"
+
+
+#define ROUTE_QUERY_STRING	"QUERY_STRING"	/* the fcgi parameter with the route parameters */
+#define MAX_ROUTE_NAME_LEN	64	/* longer parameter names never match */
+#define MAX_ROUTE_VALUE_LEN	1024	/* longer parameter values never match */
+#define MAX_ROUTE_CACHE_SHARDS	16	/* parts of the route cache with their own lock */
+#define MAX_ROUTE_CACHE_KEY_LEN	4096	/* requests with longer parameters are not cached */
+
+
+struct routing_entry_s
+{
+    const char *projname;	// from the name pool
+    char *key;		// request parameter to match, NULL if routed by hash
+    regex_t regex;
+    int group;		// index of the matcher group, -1 if matched by regexec() or hash
+    int first_class;	// index of the first request class of the project
+    int num_class;
+};
+
+
+/* request class of a project with its own processes */
+struct routing_class_s
+{
+    const char *projname;	// from the name pool
+    char *key;		// request parameter to match
+    regex_t regex;
+};
+
+
+/* regular expressions of all projects scanning the same request parameter */
+struct routing_group_s
+{
+    const char *key;	// owned by the first project entry of the group
+    int first;		// index of the first project entry of the group
+    struct regex_matcher_s *matcher;
+};
+
+
+/* slot of the hash table with open addressing */
+struct routing_hash_slot_s
+{
+    uint32_t hash;
+    int entry;		// index of the project entry, -1 if the slot is empty
+    char *name;		// lower case parameter name
+    char *value;
+};
+
+
+/* route decision kept in the cache */
+struct routing_cache_slot_s
+{
+    uint32_t hash;
+    int next;		// next slot of the hash chain, -1 at the end
+    int entry;		// index of the project entry, -1 if no project matches
+    int is_referenced;	// used since the clock hand passed by
+    int keylen;
+    char *key;		// parameter values, NULL if the slot is empty
+};
+
+
+/* part of the route cache. The slots are replaced in the order of a clock
+ * hand, slots used since the last pass are skipped once.
+ */
+struct routing_cache_shard_s
+{
+    pthread_mutex_t lock;
+    struct routing_cache_slot_s *slot;
+    int *bucket;	// first slot of each hash chain
+    int size;		// number of slots and hash chains
+    int hand;
+};
+
+
+struct routing_table_s
+{
+    struct routing_hash_slot_s *slot;
+    uint32_t hashmask;			// number of slots - 1
+    int num_hashed;			// number of used slots
+    int num_regex;			// number of projects routed by regex
+    int num_regexec;			// number of projects routed by regexec() only
+    struct routing_group_s *group;
+    int num_group;
+    const char **param;			// request parameters looked at, owned by the entries
+    int num_param;
+    int num_route_param;		// the first parameters find the project, the others the class
+    struct routing_class_s *class;
+    int num_class;
+    const char *catch_all;		// project of the requests matching no project, or NULL
+    struct routing_cache_shard_s *cache;	// NULL if the cache is disabled
+    int num_shard;
+    int num;
+    struct routing_entry_s entry[];
+};
+
+
+/* a project name given to the requests */
+struct routing_name_s
+{
+    struct routing_name_s *next;
+    char name[];
+};
+
+
+static struct routing_table_s *current_table = NULL;
+/* held for reading while a request is routed. Writers go first, a steady
+ * stream of requests does not hold off the next table */
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+static struct routing_name_s *names = NULL;	// only changed by the thread loading the configuration
+
+
+static char *routing_table_strdup(const char *str)
+{
+    char *ret = strdup(str);
+    assert(ret);
+    if ( !ret )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    return ret;
+}
+
+
+/* returns the copy of the project name in the name pool. Each name is
+ * stored once.
+ */
+static const char *routing_table_get_pool_name(const char *projname)
+{
+    struct routing_name_s *name;
+    for (name=names; name; name=name->next)
+	if (0 == strcmp(name->name, projname))
+	    return name->name;
+
+    int len = strlen(projname);
+    name = malloc(sizeof(*name) + len + 1);
+    assert(name);
+    if ( !name )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    memcpy(name->name, projname, len + 1);
+    name->next = names;
+    names = name;
+
+    return name->name;
+}
+
+
+static void routing_table_free(struct routing_table_s *table)
+{
+    int i;
+    for (i=0; i<table->num; i++)
+    {
+	struct routing_entry_s *entry = &table->entry[i];
+	if (entry->key)
+	{
+	    free(entry->key);
+	    regfree(&entry->regex);
+	}
+    }
+    if (table->slot)
+    {
+	uint32_t j;
+	for (j=0; j<=table->hashmask; j++)
+	{
+	    free(table->slot[j].name);
+	    free(table->slot[j].value);
+	}
+	free(table->slot);
+    }
+    for (i=0; i<table->num_class; i++)
+    {
+	free(table->class[i].key);
+	regfree(&table->class[i].regex);
+    }
+    free(table->class);
+    for (i=0; i<table->num_group; i++)
+	regex_matcher_delete(table->group[i].matcher);
+    free(table->group);
+    free(table->param);
+    for (i=0; i<table->num_shard; i++)
+    {
+	struct routing_cache_shard_s *shard = &table->cache[i];
+	int j;
+	for (j=0; j<shard->size; j++)
+	    free(shard->slot[j].key);
+	free(shard->slot);
+	free(shard->bucket);
+	pthread_mutex_destroy(&shard->lock);
+    }
+    free(table->cache);
+    free(table);
+}
+
+
+/* FNV-1a hash of the lower case parameter name and the value */
+static uint32_t routing_table_hash(const char *name, int namelen, const char *value, int valuelen)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+    for (i=0; i<namelen; i++)
+    {
+	hash ^= (unsigned char)tolower((unsigned char)name[i]);
+	hash *= 16777619u;
+    }
+    hash ^= '=';
+    hash *= 16777619u;
+    for (i=0; i<valuelen; i++)
+    {
+	hash ^= (unsigned char)value[i];
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/* returns the slot of the parameter name and value, or the empty slot where
+ * it belongs to */
+static struct routing_hash_slot_s *routing_table_find_slot(const struct routing_table_s *table, uint32_t hash, const char *name, int namelen, const char *value, int valuelen)
+{
+    uint32_t i = hash & table->hashmask;
+    for (;;)
+    {
+	struct routing_hash_slot_s *slot = &table->slot[i];
+	if (0 > slot->entry)
+	    return slot;
+	if (slot->hash == hash
+		&& 0 == strncasecmp(slot->name, name, namelen) && '\0' == slot->name[namelen]
+		&& 0 == strncmp(slot->value, value, valuelen) && '\0' == slot->value[valuelen])
+	    return slot;
+	i = (i + 1) & table->hashmask;
+    }
+}
+
+
+/* count the comma separated values */
+static int routing_table_count_values(const char *values)
+{
+    int num = 1;
+    for (; *values; values++)
+	if (',' == *values)
+	    num++;
+
+    return num;
+}
+
+
+/* add the comma separated values of the route parameter to the hash table */
+static void routing_table_add_values(struct routing_table_s *table, int entry, const char *name, const char *values)
+{
+    char *lowername = routing_table_strdup(name);
+    char *p;
+    for (p=lowername; *p; p++)
+	*p = tolower((unsigned char)*p);
+    int namelen = strlen(lowername);
+
+    const char *value = values;
+    while (value)
+    {
+	const char *end = strchr(value, ',');
+	int valuelen = end ? end - value : (int)strlen(value);
+	if (valuelen > 0)
+	{
+	    uint32_t hash = routing_table_hash(lowername, namelen, value, valuelen);
+	    struct routing_hash_slot_s *slot = routing_table_find_slot(table, hash, lowername, namelen, value, valuelen);
+	    if (0 <= slot->entry)
+	    {
+		printlog("WARNING: route %s=%.*s of project '%s' is used by project '%s' already", lowername, valuelen, value, table->entry[entry].projname, table->entry[slot->entry].projname);
+	    }
+	    else
+	    {
+		slot->hash = hash;
+		slot->entry = entry;
+		slot->name = routing_table_strdup(lowername);
+		slot->value = strndup(value, valuelen);
+		assert(slot->value);
+		if ( !slot->value )
+		{
+		    logerror("ERROR: could not allocate memory");
+		    qexit(EXIT_FAILURE);
+		}
+		table->num_hashed++;
+	    }
+	}
+	value = end ? end + 1 : NULL;
+    }
+
+    free(lowername);
+}
+
+
+/* add the regular expression of the project entry to the automaton of the
+ * entries scanning the same request parameter.
+ * returns the index of the group or -1 if the expression has to be tested
+ * with regexec()
+ */
+static int routing_table_add_to_group(struct routing_table_s *table, int num, const char *scanregex)
+{
+    const char *key = table->entry[num].key;
+    int i;
+    for (i=0; i<table->num_group; i++)
+	if (0 == strcmp(table->group[i].key, key))
+	    break;
+
+    struct routing_group_s *group = &table->group[i];
+    if (i == table->num_group)
+    {
+	group->key = key;
+	group->first = num;
+	group->matcher = regex_matcher_new();
+	table->num_group++;
+    }
+
+    int retval = regex_matcher_add(group->matcher, scanregex, num);
+    if (retval)
+    {
+	if (i == table->num_group - 1 && 0 == regex_matcher_get_num_patterns(group->matcher))
+	{
+	    /* no empty groups */
+	    regex_matcher_delete(group->matcher);
+	    table->num_group--;
+	}
+	return -1;
+    }
+
+    return i;
+}
+
+
+static void routing_table_cache_init(struct routing_table_s *table, int size)
+{
+    table->num_shard = min(size, MAX_ROUTE_CACHE_SHARDS);
+    table->cache = calloc(table->num_shard, sizeof(*table->cache));
+    assert(table->cache);
+    if ( !table->cache )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    int i;
+    for (i=0; i<table->num_shard; i++)
+    {
+	struct routing_cache_shard_s *shard = &table->cache[i];
+	int retval = pthread_mutex_init(&shard->lock, NULL);
+	if (retval)
+	{
+	    errno = retval;
+	    logerror("ERROR: init mutex");
+	    qexit(EXIT_FAILURE);
+	}
+	shard->size = (size + table->num_shard - 1) / table->num_shard;
+	shard->slot = calloc(shard->size, sizeof(*shard->slot));
+	shard->bucket = malloc(shard->size * sizeof(*shard->bucket));
+	assert(shard->slot);
+	assert(shard->bucket);
+	if ( !shard->slot || !shard->bucket )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	int j;
+	for (j=0; j<shard->size; j++)
+	    shard->bucket[j] = -1;
+    }
+
+    debug(1, "route cache with %d entries in %d parts", size, table->num_shard);
+}
+
+
+/* add the request classes of the project entry in order of the
+ * configuration. A class with a bad regular expression is left out, its
+ * requests go to the project.
+ */
+static void routing_table_add_classes(struct routing_table_s *table, int num, int num_proj)
+{
+    struct routing_entry_s *entry = &table->entry[num];
+    entry->first_class = table->num_class;
+
+    int i;
+    for (i=0; i<num_proj; i++)
+    {
+	const char *class_name = config_get_name_project(i);
+	if ( !class_name )
+	    continue;
+	const char *parent = config_get_class_of(class_name);
+	if ( !parent || strcasecmp(parent, entry->projname) )
+	    continue;
+
+	const char *key = config_get_scan_parameter_key(class_name);
+	const char *scanregex = config_get_scan_parameter_regex(class_name);
+	if ( !key || !scanregex )
+	    continue;
+
+	struct routing_class_s *class = &table->class[table->num_class];
+	int retval = regcomp(&class->regex, scanregex, REG_EXTENDED|REG_NOSUB);
+	if (retval)
+	{
+	    char buffer[256];
+	    (void) regerror(retval, &class->regex, buffer, sizeof(buffer));
+	    printlog("ERROR: could not compile regular expression '%s' of request class '%s': %s. Class gets no requests", scanregex, class_name, buffer);
+	    continue;
+	}
+	debug(1, "route requests of project '%s' with %s matching '%s' to request class '%s'", entry->projname, key, scanregex, class_name);
+
+	class->projname = routing_table_get_pool_name(class_name);
+	class->key = routing_table_strdup(key);
+	table->num_class++;
+    }
+
+    entry->num_class = table->num_class - entry->first_class;
+}
+
+
+/* build the routing table from the current configuration.
+ * A project with a bad regular expression is left out, it gets no requests.
+ */
+static struct routing_table_s *routing_table_new(void)
+{
+    int num_proj = config_get_num_projects();
+    struct routing_table_s *table = calloc(1, sizeof(*table) + num_proj * sizeof(table->entry[0]));
+    assert(table);
+    if ( !table )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    table->group = calloc(max(num_proj, 1), sizeof(*table->group));
+    table->param = calloc(num_proj + 1, sizeof(*table->param));
+    table->class = calloc(max(num_proj, 1), sizeof(*table->class));
+    assert(table->group);
+    assert(table->param);
+    assert(table->class);
+    if ( !table->group || !table->param || !table->class )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+
+    /* size the hash table for at most half filled slots */
+    int num_values = 0;
+    int i;
+    for (i=0; i<num_proj; i++)
+    {
+	const char *proj_name = config_get_name_project(i);
+	if (proj_name && config_get_route_param(proj_name))
+	{
+	    const char *values = config_get_route_values(proj_name);
+	    if (values)
+		num_values += routing_table_count_values(values);
+	}
+    }
+    if (num_values)
+    {
+	uint32_t size = 16;
+	while (size < 2 * (uint32_t)num_values)
+	    size <<= 1;
+	table->slot = calloc(size, sizeof(*table->slot));
+	assert(table->slot);
+	if ( !table->slot )
+	{
+	    logerror("ERROR: could not allocate memory");
+	    qexit(EXIT_FAILURE);
+	}
+	uint32_t j;
+	for (j=0; j<size; j++)
+	    table->slot[j].entry = -1;
+	table->hashmask = size - 1;
+    }
+
+    for (i=0; i<num_proj; i++)
+    {
+	const char *proj_name = config_get_name_project(i);
+	if ( !proj_name )
+	{
+	    debug(1, "ERROR: no name for project number %d in configuration found", i);
+	    continue;
+	}
+
+	/* request classes are tested after their project has been found */
+	if (config_get_class_of(proj_name))
+	    continue;
+
+	const char *route_param = config_get_route_param(proj_name);
+	const char *route_values = config_get_route_values(proj_name);
+	if (route_param && route_values)
+	{
+	    struct routing_entry_s *entry = &table->entry[table->num];
+	    entry->group = -1;
+	    entry->projname = routing_table_get_pool_name(proj_name);
+	    routing_table_add_values(table, table->num, route_param, route_values);
+	    debug(1, "route requests with %s=%s to project '%s'", route_param, route_values, proj_name);
+	    table->num++;
+	    continue;
+	}
+
+	const char *key = config_get_scan_parameter_key(proj_name);
+	const char *scanregex = config_get_scan_parameter_regex(proj_name);
+	if ( !key || !scanregex )
+	    continue;
+
+	struct routing_entry_s *entry = &table->entry[table->num];
+	int retval = regcomp(&entry->regex, scanregex, REG_EXTENDED|REG_NOSUB);
+	if (retval)
+	{
+	    char buffer[256];
+	    (void) regerror(retval, &entry->regex, buffer, sizeof(buffer));
+	    printlog("ERROR: could not compile regular expression '%s' of project '%s': %s. Project gets no requests", scanregex, proj_name, buffer);
+	    continue;
+	}
+	debug(1, "route requests with %s matching '%s' to project '%s'", key, scanregex, proj_name);
+
+	entry->projname = routing_table_get_pool_name(proj_name);
+	entry->key = routing_table_strdup(key);
+	entry->group = routing_table_add_to_group(table, table->num, scanregex);
+	if (0 > entry->group)
+	{
+	    debug(1, "regular expression '%s' of project '%s' is tested on its own", scanregex, proj_name);
+	    table->num_regexec++;
+	}
+	table->num_regex++;
+	table->num++;
+    }
+
+    for (i=0; i<table->num_group; i++)
+	regex_matcher_compile(table->group[i].matcher);
+
+    for (i=0; i<table->num; i++)
+	routing_table_add_classes(table, i, num_proj);
+
+    const char *catchall = config_get_catch_all();
+    for (i=0; catchall && i<num_proj; i++)
+    {
+	const char *proj_name = config_get_name_project(i);
+	if (proj_name && !strcasecmp(proj_name, catchall))
+	{
+	    table->catch_all = routing_table_get_pool_name(proj_name);
+	    debug(1, "route requests matching no project to project '%s'", proj_name);
+	    break;
+	}
+    }
+
+    /* the parameters needed to route a request */
+    if (table->num_hashed)
+	table->param[table->num_param++] = ROUTE_QUERY_STRING;
+    for (i=0; i<table->num; i++)
+    {
+	const char *key = table->entry[i].key;
+	if ( !key )
+	    continue;
+
+	int j;
+	for (j=0; j<table->num_param; j++)
+	    if (0 == strcmp(table->param[j], key))
+		break;
+	if (j == table->num_param)
+	    table->param[table->num_param++] = key;
+    }
+    table->num_route_param = table->num_param;
+    for (i=0; i<table->num_class; i++)
+    {
+	const char *key = table->class[i].key;
+	int j;
+	for (j=0; j<table->num_param; j++)
+	    if (0 == strcmp(table->param[j], key))
+		break;
+	if (j == table->num_param)
+	    table->param[table->num_param++] = key;
+    }
+
+    /* the hash table alone is fast enough */
+    int cache_size = config_get_route_cache_size();
+    if (table->num_regex && 0 < cache_size)
+	routing_table_cache_init(table, cache_size);
+
+    debug(1, "routing table with %d projects, %d routes in hash table, %d regular expressions in %d automatons, %d regular expressions tested on their own, %d request classes", table->num, table->num_hashed, table->num_regex - table->num_regexec, table->num_group, table->num_regexec, table->num_class);
+
+    return table;
+}
+
+
+/* lock the routing table in use for reading and return it */
+static struct routing_table_s *routing_table_rdlock(void)
+{
+    int retval = pthread_rwlock_rdlock(&table_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock routing table");
+	qexit(EXIT_FAILURE);
+    }
+
+    return current_table;
+}
+
+
+static void routing_table_unlock(void)
+{
+    int retval = pthread_rwlock_unlock(&table_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock routing table");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* replace the routing table in use. Returns the replaced table, no request
+ * is routed with it any more.
+ */
+static struct routing_table_s *routing_table_replace(struct routing_table_s *table)
+{
+    int retval = pthread_rwlock_wrlock(&table_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock routing table");
+	qexit(EXIT_FAILURE);
+    }
+
+    struct routing_table_s *oldtable = current_table;
+    current_table = table;
+
+    routing_table_unlock();
+
+    return oldtable;
+}
+
+
+/* compile the routing table of the current configuration and replace the
+ * routing table in use. Call this after each load of the configuration.
+ */
+void routing_table_update(void)
+{
+    struct routing_table_s *table = routing_table_new();
+
+    struct routing_table_s *oldtable = routing_table_replace(table);
+    if (oldtable)
+	routing_table_free(oldtable);
+}
+
+
+void routing_table_delete(void)
+{
+    struct routing_table_s *table = routing_table_replace(NULL);
+    if (table)
+	routing_table_free(table);
+
+    while (names)
+    {
+	struct routing_name_s *name = names;
+	names = name->next;
+	free(name);
+    }
+}
+
+
+/* decode the url encoded value into buffer.
+ * returns the length of the decoded value
+ */
+static int routing_table_decode_value(char *buffer, const char *value, int valuelen)
+{
+    int len = 0;
+    int i;
+    for (i=0; i<valuelen; i++)
+    {
+	char c = value[i];
+	if ('+' == c)
+	{
+	    c = ' ';
+	}
+	else if ('%' == c && i+2 < valuelen && isxdigit((unsigned char)value[i+1]) && isxdigit((unsigned char)value[i+2]))
+	{
+	    char hex[3] = { value[i+1], value[i+2], '\0' };
+	    c = (char)strtol(hex, NULL, 16);
+	    i += 2;
+	}
+	buffer[len++] = c;
+    }
+    buffer[len] = '\0';
+
+    return len;
+}
+
+
+/* scan the query string once for all parameters in the hash table.
+ * returns the lowest index of the matching projects or -1
+ */
+static int routing_table_find_hashed(const struct routing_table_s *table, const char *query)
+{
+    int ret = -1;
+
+    while (query && *query)
+    {
+	const char *end = strchr(query, '&');
+	int len = end ? end - query : (int)strlen(query);
+	const char *eq = memchr(query, '=', len);
+	if (eq)
+	{
+	    int namelen = eq - query;
+	    int valuelen = len - namelen - 1;
+	    if (namelen <= MAX_ROUTE_NAME_LEN && valuelen <= MAX_ROUTE_VALUE_LEN)
+	    {
+		char value[valuelen+1];
+		valuelen = routing_table_decode_value(value, eq + 1, valuelen);
+		uint32_t hash = routing_table_hash(query, namelen, value, valuelen);
+		const struct routing_hash_slot_s *slot = routing_table_find_slot(table, hash, query, namelen, value, valuelen);
+		if (0 <= slot->entry && (0 > ret || slot->entry < ret))
+		    ret = slot->entry;
+	    }
+	}
+	query = end ? end + 1 : NULL;
+    }
+
+    return ret;
+}
+
+
+/* returns 1 if the fcgi session has all request parameters the routing
+ * looks at, 0 otherwise. The project found for the session does not change
+ * with parameters arriving later on.
+ */
+int routing_table_has_params(const struct fcgi_session_s *fcgi_session)
+{
+    int ret = 0;
+    const struct routing_table_s *table = routing_table_rdlock();
+    if (table && table->num_param)
+    {
+	ret = 1;
+	int i;
+	for (i=0; i<table->num_param; i++)
+	{
+	    if ( !fcgi_session_get_param(fcgi_session, table->param[i]) )
+	    {
+		ret = 0;
+		break;
+	    }
+	}
+    }
+    routing_table_unlock();
+
+    return ret;
+}
+
+
+/* write the values of the request parameters the project is found with into
+ * the buffer. Each value is preceded by 'v' and terminated by '\0', a missing
+ * parameter is written as '-'. The request classes are not cached.
+ * returns the length of the key or -1 if the buffer is too small
+ */
+static int routing_table_cache_key(const struct routing_table_s *table, const struct fcgi_session_s *fcgi_session, char *buffer, int len)
+{
+    int keylen = 0;
+    int i;
+    for (i=0; i<table->num_route_param; i++)
+    {
+	const char *value = fcgi_session_get_param(fcgi_session, table->param[i]);
+	if (value)
+	{
+	    int valuelen = strlen(value);
+	    if (keylen + valuelen + 2 > len)
+		return -1;
+	    buffer[keylen++] = 'v';
+	    memcpy(buffer + keylen, value, valuelen);
+	    keylen += valuelen;
+	}
+	else
+	{
+	    if (keylen + 2 > len)
+		return -1;
+	    buffer[keylen++] = '-';
+	}
+	buffer[keylen++] = '\0';
+    }
+
+    return keylen;
+}
+
+
+static struct routing_cache_shard_s *routing_table_cache_lock(struct routing_table_s *table, uint32_t hash)
+{
+    struct routing_cache_shard_s *shard = &table->cache[(hash >> 16) % table->num_shard];
+    int retval = pthread_mutex_lock(&shard->lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    return shard;
+}
+
+
+static void routing_table_cache_unlock(struct routing_cache_shard_s *shard)
+{
+    int retval = pthread_mutex_unlock(&shard->lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* look up the route decision of the key in the cache.
+ * returns 0 and sets *entry if found, -1 otherwise
+ */
+static int routing_table_cache_find(struct routing_table_s *table, uint32_t hash, const char *key, int keylen, int *entry)
+{
+    int ret = -1;
+    struct routing_cache_shard_s *shard = routing_table_cache_lock(table, hash);
+
+    int i;
+    for (i = shard->bucket[hash % shard->size]; 0 <= i; i = shard->slot[i].next)
+    {
+	struct routing_cache_slot_s *slot = &shard->slot[i];
+	if (slot->hash == hash && slot->keylen == keylen && 0 == memcmp(slot->key, key, keylen))
+	{
+	    slot->is_referenced = 1;
+	    *entry = slot->entry;
+	    ret = 0;
+	    break;
+	}
+    }
+
+    routing_table_cache_unlock(shard);
+
+    return ret;
+}
+
+
+/* store the route decision of the key in the cache.
+ * returns 1 if an older decision has been removed for it, 0 otherwise
+ */
+static int routing_table_cache_add(struct routing_table_s *table, uint32_t hash, const char *key, int keylen, int entry)
+{
+    char *newkey = malloc(keylen);
+    assert(newkey);
+    if ( !newkey )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    memcpy(newkey, key, keylen);
+
+    int ret = 0;
+    struct routing_cache_shard_s *shard = routing_table_cache_lock(table, hash);
+
+    /* another thread may have added the key in the meantime */
+    int i;
+    for (i = shard->bucket[hash % shard->size]; 0 <= i; i = shard->slot[i].next)
+    {
+	const struct routing_cache_slot_s *slot = &shard->slot[i];
+	if (slot->hash == hash && slot->keylen == keylen && 0 == memcmp(slot->key, key, keylen))
+	{
+	    routing_table_cache_unlock(shard);
+	    free(newkey);
+	    return 0;
+	}
+    }
+
+    /* find the next slot not used since the last pass of the hand */
+    struct routing_cache_slot_s *slot;
+    for (;;)
+    {
+	slot = &shard->slot[shard->hand];
+	if ( !slot->key || !slot->is_referenced )
+	    break;
+	slot->is_referenced = 0;
+	shard->hand = (shard->hand + 1) % shard->size;
+    }
+    int num = shard->hand;
+    shard->hand = (shard->hand + 1) % shard->size;
+
+    if (slot->key)
+    {
+	/* remove the old decision from its hash chain */
+	int *prev = &shard->bucket[slot->hash % shard->size];
+	while (*prev != num)
+	    prev = &shard->slot[*prev].next;
+	*prev = slot->next;
+	free(slot->key);
+	ret = 1;
+    }
+
+    slot->hash = hash;
+    slot->entry = entry;
+    slot->is_referenced = 0;
+    slot->keylen = keylen;
+    slot->key = newkey;
+    slot->next = shard->bucket[hash % shard->size];
+    shard->bucket[hash % shard->size] = num;
+
+    routing_table_cache_unlock(shard);
+
+    return ret;
+}
+
+
+/* find the project entry for the request parameters of this fcgi session.
+ * The projects are tested in order of the configuration.
+ * returns the index of the first project whose regular expression or route
+ * value matches or -1. *has_error is set if a regular expression could not be
+ * tested.
+ */
+static int routing_table_find_entry(const struct routing_table_s *table, const struct fcgi_session_s *fcgi_session, int *has_error)
+{
+    /* the project found by hash is taken, unless a regular expression of a
+     * project further up in the configuration matches */
+    int last = table->num;
+    if (table->num_hashed)
+    {
+	const char *query = fcgi_session_get_param(fcgi_session, ROUTE_QUERY_STRING);
+	int found = routing_table_find_hashed(table, query);
+	if (0 <= found)
+	    last = found;
+    }
+
+    /* the first project of each automaton */
+    int i, j;
+    for (i=0; i<table->num_group; i++)
+    {
+	const struct routing_group_s *group = &table->group[i];
+	if (group->first >= last)
+	    continue;
+
+	const char *param = fcgi_session_get_param(fcgi_session, group->key);
+	if ( !param )
+	    continue;
+
+	int found = regex_matcher_match(group->matcher, param);
+	if (REGEX_MATCHER_FULL == found)
+	{
+	    /* test the expressions of the group one by one */
+	    for (j=group->first; j<last; j++)
+	    {
+		const struct routing_entry_s *entry = &table->entry[j];
+		if (entry->group == i && 0 == regexec(&entry->regex, param, 0, NULL, 0))
+		{
+		    found = j;
+		    break;
+		}
+	    }
+	}
+	if (0 <= found && found < last)
+	    last = found;
+    }
+
+    for (i=0; table->num_regexec && i<last; i++)
+    {
+	const struct routing_entry_s *entry = &table->entry[i];
+	if ( !entry->key || 0 <= entry->group )
+	    continue;
+
+	const char *param = fcgi_session_get_param(fcgi_session, entry->key);
+	if (param)
+	{
+	    int retval = regexec(&entry->regex, param, 0, NULL, 0);
+	    if ( !retval )
+	    {
+		// Match
+		return i;
+	    }
+	    else if (REG_NOMATCH != retval)
+	    {
+		char buffer[256];
+		(void) regerror(retval, &entry->regex, buffer, sizeof(buffer));
+		debug(1, "Could not match regular expression of project '%s': %s", entry->projname, buffer);
+		*has_error = 1;
+	    }
+	}
+    }
+
+    if (last < table->num)
+	return last;
+
+    return -1;
+}
+
+
+/* returns the name of the first request class of the project entry whose
+ * regular expression matches, or the name of the project itself.
+ */
+static const char *routing_table_find_class(const struct routing_table_s *table, int found, const struct fcgi_session_s *fcgi_session)
+{
+    const struct routing_entry_s *entry = &table->entry[found];
+    int i;
+    for (i=entry->first_class; i<entry->first_class+entry->num_class; i++)
+    {
+	const struct routing_class_s *class = &table->class[i];
+	const char *param = fcgi_session_get_param(fcgi_session, class->key);
+	if (param)
+	{
+	    int retval = regexec(&class->regex, param, 0, NULL, 0);
+	    if ( !retval )
+	    {
+		// Match
+		return class->projname;
+	    }
+	    else if (REG_NOMATCH != retval)
+	    {
+		char buffer[256];
+		(void) regerror(retval, &class->regex, buffer, sizeof(buffer));
+		debug(1, "Could not match regular expression of request class '%s': %s", class->projname, buffer);
+	    }
+	}
+    }
+
+    return entry->projname;
+}
+
+
+/* returns the name of the project or request class of the found project
+ * entry. If no project has been found the request goes to the catch all
+ * project, if there is one.
+ */
+static const char *routing_table_get_name(const struct routing_table_s *table, int found, const struct fcgi_session_s *fcgi_session)
+{
+    if (0 <= found)
+	return routing_table_find_class(table, found, fcgi_session);
+
+    if (table->catch_all)
+	statistic_add_catch_all(0);
+
+    return table->catch_all;
+}
+
+
+static const char *routing_table_nolock__get_project(struct routing_table_s *table, const struct fcgi_session_s *fcgi_session)
+{
+    int has_error = 0;
+    int found;
+    if (table->cache)
+    {
+	char key[MAX_ROUTE_CACHE_KEY_LEN];
+	int keylen = routing_table_cache_key(table, fcgi_session, key, sizeof(key));
+	if (0 <= keylen)
+	{
+	    uint32_t hash = routing_table_hash(NULL, 0, key, keylen);
+	    if ( !routing_table_cache_find(table, hash, key, keylen, &found) )
+	    {
+		statistic_add_route_cache(1, 0);
+	    }
+	    else
+	    {
+		found = routing_table_find_entry(table, fcgi_session, &has_error);
+		int has_evicted = 0;
+		if ( !has_error )
+		    has_evicted = routing_table_cache_add(table, hash, key, keylen, found);
+		statistic_add_route_cache(0, has_evicted);
+	    }
+	    return routing_table_get_name(table, found, fcgi_session);
+	}
+    }
+
+    found = routing_table_find_entry(table, fcgi_session, &has_error);
+
+    return routing_table_get_name(table, found, fcgi_session);
+}
+
+
+/* find the project name for the request parameters of this fcgi session.
+ * The projects are tested in order of the configuration. Returns the name of
+ * the first project whose regular expression or route value matches, else
+ * the name of the catch all project or NULL.
+ * If the project has request classes the name of the first matching class is
+ * returned instead.
+ * The project is kept in the route cache for the next request with the same
+ * parameter values.
+ */
+const char *routing_table_get_project(const struct fcgi_session_s *fcgi_session)
+{
+    const char *ret = NULL;
+    struct routing_table_s *table = routing_table_rdlock();
+    if (table)
+	ret = routing_table_nolock__get_project(table, fcgi_session);
+    routing_table_unlock();
+
+    return ret;
+}
+
+
+/* returns the name of the catch all project or NULL. The configured name is
+ * resolved to the section of the project when the configuration is loaded.
+ * The name stays valid after a reload.
+ */
+const char *routing_table_get_catch_all(void)
+{
+    const char *ret = NULL;
+    struct routing_table_s *table = routing_table_rdlock();
+    if (table)
+	ret = table->catch_all;
+    routing_table_unlock();
+
+    return ret;
+}
@@ -0,0 +1,47 @@
+/*
+ * routing_table.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Routing of the requests to their projects.
+    The regular expressions of all projects are compiled once after the
+    configuration has been loaded. A request is routed as soon as the
+    parameters the projects look at have arrived.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef ROUTING_TABLE_H_
+#define ROUTING_TABLE_H_
+
+struct fcgi_session_s;
+
+
+void routing_table_update(void);
+void routing_table_delete(void);
+int routing_table_has_params(const struct fcgi_session_s *fcgi_session);
+const char *routing_table_get_project(const struct fcgi_session_s *fcgi_session);
+const char *routing_table_get_catch_all(void);
+
+
+#endif /* ROUTING_TABLE_H_ */
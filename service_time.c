@@ -0,0 +1,424 @@
+/*
+ * service_time.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Learned service time of the requests.
+    The time a process needs for a request is measured in the relay and
+    kept per project and request signature as an exponentially weighted
+    moving average. The signature is the REQUEST type of the query string
+    and the power of two of the image size WIDTH*HEIGHT, so small tiles and
+    large exports of the same project are told apart. Each project has an
+    estimate over all its requests in addition, it is used for signatures
+    not yet seen.
+    The number of signatures of a project is limited, the values come from
+    the web clients. If it is reached the least recently used signature of
+    the project is dropped, the estimates of other projects are kept. The
+    estimates of a project are dropped when it is removed from the
+    configuration.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "service_time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "common.h"
+#include "logger.h"
+#include "qgis_shutdown_queue.h"
+#include "fcgi_state.h"
+
+
+#define SERVICE_TIME_QUERY_STRING	"QUERY_STRING"
+#define SERVICE_TIME_BUCKETS		256
+#define SERVICE_TIME_MAX_SIGNATURES	256	/* per project */
+#define SERVICE_TIME_WEIGHT		8	/* a new measurement counts 1/8 */
+#define SERVICE_TIME_MAX_REQUEST_LEN	20	/* characters of the request type kept */
+
+
+struct service_time_estimate_s
+{
+    long long int usec;
+    long long int count;
+};
+
+
+/* the estimate over all requests of a project and the list of its
+ * signatures. There are only a few projects, they are kept in a list.
+ */
+struct service_time_project_s
+{
+    LIST_ENTRY(service_time_project_s) entries;
+    char *projname;
+    struct service_time_estimate_s estimate;
+    TAILQ_HEAD(service_time_lru_s, service_time_entry_s) signatures;	/* most recently used first */
+    int num_signatures;
+};
+
+
+/* the estimate of a signature of a project */
+struct service_time_entry_s
+{
+    LIST_ENTRY(service_time_entry_s) entries;	/* of the hash bucket */
+    TAILQ_ENTRY(service_time_entry_s) lru;	/* of the signatures of the project */
+    struct service_time_project_s *project;
+    char signature[SERVICE_TIME_SIGNATURE_LEN];
+    struct service_time_estimate_s estimate;
+};
+
+
+static LIST_HEAD(service_time_project_list_s, service_time_project_s) projectlist = LIST_HEAD_INITIALIZER(projectlist);
+static LIST_HEAD(service_time_list_s, service_time_entry_s) buckets[SERVICE_TIME_BUCKETS];
+static int num_entries = 0;
+static pthread_mutex_t service_time_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void service_time_lock_table(void)
+{
+    int retval = pthread_mutex_lock(&service_time_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void service_time_unlock_table(void)
+{
+    int retval = pthread_mutex_unlock(&service_time_lock);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void service_time_nolock__remove_entry(struct service_time_entry_s *entry)
+{
+    LIST_REMOVE(entry, entries);
+    TAILQ_REMOVE(&entry->project->signatures, entry, lru);
+    entry->project->num_signatures--;
+    num_entries--;
+    free(entry);
+}
+
+
+static void service_time_nolock__remove_project(struct service_time_project_s *project)
+{
+    struct service_time_entry_s *entry;
+    while ((entry = TAILQ_FIRST(&project->signatures)) != NULL)
+	service_time_nolock__remove_entry(entry);
+
+    LIST_REMOVE(project, entries);
+    free(project->projname);
+    free(project);
+}
+
+
+void service_time_delete(void)
+{
+    service_time_lock_table();
+
+    struct service_time_project_s *project;
+    while ((project = LIST_FIRST(&projectlist)) != NULL)
+	service_time_nolock__remove_project(project);
+    assert(0 == num_entries);
+
+    service_time_unlock_table();
+}
+
+
+static uint32_t service_time_hash(const char *projname, const char *signature)
+{
+    uint32_t hash = 2166136261u;
+    const char *c;
+    for (c=projname; *c; c++)
+    {
+	hash ^= (unsigned char)*c;
+	hash *= 16777619u;
+    }
+    hash ^= ':';
+    hash *= 16777619u;
+    for (c=signature; *c; c++)
+    {
+	hash ^= (unsigned char)*c;
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/* returns the estimates of the project. If they do not exist they are
+ * created if is_create is set, else NULL is returned.
+ */
+static struct service_time_project_s *service_time_nolock__get_project(const char *projname, int is_create)
+{
+    struct service_time_project_s *project;
+    LIST_FOREACH(project, &projectlist, entries)
+    {
+	if (0 == strcmp(project->projname, projname))
+	    return project;
+    }
+
+    if ( !is_create )
+	return NULL;
+
+    project = calloc(1, sizeof(*project));
+    assert(project);
+    if ( !project )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    project->projname = strdup(projname);
+    assert(project->projname);
+    if ( !project->projname )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    TAILQ_INIT(&project->signatures);
+    LIST_INSERT_HEAD(&projectlist, project, entries);
+
+    return project;
+}
+
+
+/* returns the entry of the signature in the project and marks it as the
+ * most recently used one. If it does not exist it is created if is_create is
+ * set, else NULL is returned. If the project has the maximum number of
+ * signatures the least recently used one is dropped for the new one.
+ */
+static struct service_time_entry_s *service_time_nolock__find(struct service_time_project_s *project, const char *signature, int is_create)
+{
+    struct service_time_list_s *bucket = &buckets[service_time_hash(project->projname, signature) % SERVICE_TIME_BUCKETS];
+    struct service_time_entry_s *entry;
+    LIST_FOREACH(entry, bucket, entries)
+    {
+	if (entry->project == project && 0 == strcmp(entry->signature, signature))
+	{
+	    TAILQ_REMOVE(&project->signatures, entry, lru);
+	    TAILQ_INSERT_HEAD(&project->signatures, entry, lru);
+	    return entry;
+	}
+    }
+
+    if ( !is_create )
+	return NULL;
+
+    if (project->num_signatures >= SERVICE_TIME_MAX_SIGNATURES)
+    {
+	entry = TAILQ_LAST(&project->signatures, service_time_lru_s);
+	debug(1, "project '%s' drops estimate of request '%s'", project->projname, entry->signature);
+	service_time_nolock__remove_entry(entry);
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    assert(entry);
+    if ( !entry )
+    {
+	logerror("ERROR: could not allocate memory");
+	qexit(EXIT_FAILURE);
+    }
+    entry->project = project;
+    snprintf(entry->signature, sizeof(entry->signature), "%s", signature);
+    LIST_INSERT_HEAD(bucket, entry, entries);
+    TAILQ_INSERT_HEAD(&project->signatures, entry, lru);
+    project->num_signatures++;
+    num_entries++;
+
+    return entry;
+}
+
+
+/* drop the estimates of the project, it has been removed from the
+ * configuration.
+ */
+void service_time_delete_project(const char *projname)
+{
+    assert(projname);
+
+    service_time_lock_table();
+
+    struct service_time_project_s *project = service_time_nolock__get_project(projname, 0);
+    if (project)
+	service_time_nolock__remove_project(project);
+
+    service_time_unlock_table();
+}
+
+
+/* write the signature of the request into the buffer: the lower case
+ * REQUEST type of the query string and the power of two of WIDTH*HEIGHT if
+ * given, i.e. "getmap:18". The signature is empty if the request type is not
+ * known (yet).
+ */
+void service_time_get_signature(const struct fcgi_session_s *fcgi_session, char *signature, int len)
+{
+    assert(signature);
+    assert(len > 0);
+
+    char request[SERVICE_TIME_MAX_REQUEST_LEN+1] = "";
+    long long int width = 0;
+    long long int height = 0;
+
+    const char *query = fcgi_session ? fcgi_session_get_param(fcgi_session, SERVICE_TIME_QUERY_STRING) : NULL;
+    while (query && *query)
+    {
+	const char *end = strchr(query, '&');
+	int querylen = end ? end - query : (int)strlen(query);
+	const char *eq = memchr(query, '=', querylen);
+	if (eq)
+	{
+	    int namelen = eq - query;
+	    const char *value = eq + 1;
+	    int valuelen = querylen - namelen - 1;
+	    if (7 == namelen && 0 == strncasecmp(query, "REQUEST", namelen))
+	    {
+		int i;
+		for (i=0; i<valuelen && i<SERVICE_TIME_MAX_REQUEST_LEN && isalnum((unsigned char)value[i]); i++)
+		    request[i] = tolower((unsigned char)value[i]);
+		request[i] = '\0';
+	    }
+	    else if (5 == namelen && 0 == strncasecmp(query, "WIDTH", namelen))
+		width = atoll(value);
+	    else if (6 == namelen && 0 == strncasecmp(query, "HEIGHT", namelen))
+		height = atoll(value);
+	}
+	query = end ? end + 1 : NULL;
+    }
+
+    if ( !*request )
+	*signature = '\0';
+    else if (0 < width && 0 < height && width < INT32_MAX && height < INT32_MAX)
+    {
+	long long int pixels = width * height;
+	int bucket = 0;
+	while (pixels >>= 1)
+	    bucket++;
+	snprintf(signature, len, "%s:%d", request, bucket);
+    }
+    else
+	snprintf(signature, len, "%s", request);
+}
+
+
+/* returns the expected service time in usec of a request with the signature
+ * in the project. Unknown signatures get the estimate of the project, 0 if the
+ * project did not answer a request yet.
+ */
+long long int service_time_get_estimate(const char *projname, const char *signature)
+{
+    assert(projname);
+    assert(signature);
+
+    service_time_lock_table();
+
+    long long int ret = 0;
+    struct service_time_project_s *project = service_time_nolock__get_project(projname, 0);
+    if (project)
+    {
+	struct service_time_entry_s *entry = NULL;
+	if (*signature)
+	    entry = service_time_nolock__find(project, signature, 0);
+	ret = entry ? entry->estimate.usec : project->estimate.usec;
+    }
+
+    service_time_unlock_table();
+
+    return ret;
+}
+
+
+static void service_time_update(struct service_time_estimate_s *estimate, long long int usec)
+{
+    if (0 == estimate->count)
+	estimate->usec = usec;
+    else
+	estimate->usec += (usec - estimate->usec) / SERVICE_TIME_WEIGHT;
+    estimate->count++;
+}
+
+
+/* add the measured service time of a request to the estimates of its
+ * signature and its project.
+ */
+void service_time_add(const char *projname, const char *signature, long long int usec)
+{
+    assert(projname);
+    assert(signature);
+
+    service_time_lock_table();
+
+    struct service_time_project_s *project = service_time_nolock__get_project(projname, 1);
+    service_time_update(&project->estimate, usec);
+    if (*signature)
+    {
+	struct service_time_entry_s *entry = service_time_nolock__find(project, signature, 1);
+	service_time_update(&entry->estimate, usec);
+    }
+
+    service_time_unlock_table();
+}
+
+
+void service_time_printlog(void)
+{
+    service_time_lock_table();
+
+    printlog("Service time statistics:\n"
+	    "known signatures: %d, at most %d per project",
+	    num_entries, SERVICE_TIME_MAX_SIGNATURES
+    );
+
+    const struct service_time_project_s *project;
+    LIST_FOREACH(project, &projectlist, entries)
+    {
+	printlog("project '%s' request '*': %lld usec estimated from %lld requests",
+		project->projname, project->estimate.usec, project->estimate.count);
+
+	const struct service_time_entry_s *entry;
+	TAILQ_FOREACH(entry, &project->signatures, lru)
+	{
+	    printlog("project '%s' request '%s': %lld usec estimated from %lld requests",
+		    project->projname, entry->signature, entry->estimate.usec, entry->estimate.count);
+	}
+    }
+
+    service_time_unlock_table();
+}
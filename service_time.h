@@ -0,0 +1,47 @@
+/*
+ * service_time.h
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Learned service time of the requests.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef SERVICE_TIME_H_
+#define SERVICE_TIME_H_
+
+#define SERVICE_TIME_SIGNATURE_LEN	32	/* size of the signature buffer */
+
+struct fcgi_session_s;
+
+
+void service_time_delete(void);
+void service_time_delete_project(const char *projname);
+void service_time_get_signature(const struct fcgi_session_s *fcgi_session, char *signature, int len);
+long long int service_time_get_estimate(const char *projname, const char *signature);
+void service_time_add(const char *projname, const char *signature, long long int usec);
+void service_time_printlog(void);
+
+
+#endif /* SERVICE_TIME_H_ */
@@ -9,21 +9,68 @@
 #include "statistic.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <errno.h>
 #include <assert.h>
+#include <sys/resource.h>
 
+#include "common.h"
 #include "timer.h"
 #include "logger.h"
 #include "qgis_shutdown_queue.h"
 
 
+#define HISTOGRAM_BUCKETS	40
+
+/* counts the values in buckets of powers of two. Bucket 0 holds the value 0,
+ * bucket n the values from 2^(n-1) to 2^n-1. A percentile is reported as
+ * the upper bound of its bucket, at most the maximum value. So it is
+ * accurate within a factor of two.
+ */
+struct statistic_histogram_s
+{
+    long long int count;
+    long long int max;
+    long long int bucket[HISTOGRAM_BUCKETS];
+};
+
+
 static struct timespec uptime = {0,0};
 static struct timespec connectiontime = {0,0};
 static long long int connections = 0;
 //static long long int process_crashed = 0;
 static long long int process_shutdown = 0;
 static long long int process_started = 0;
+static long long int relay_copied_bytes = 0;
+static long long int relay_spliced_bytes = 0;
+static long long int relay_syscalls = 0;
+static long long int admission_count[STATISTIC_ADMISSION_TIMEOUT+1];
+static struct statistic_histogram_s admission_wait;	// usec
+static struct statistic_histogram_s admission_queue_len;
+static long long int child_connects = 0;
+static long long int child_connect_retries = 0;
+static long long int child_connect_failovers = 0;
+static struct statistic_histogram_s child_connect_time;	// usec
+static struct statistic_histogram_s accept_batch;	// connections accepted per wakeup
+static long long int routes = 0;
+static long long int routes_early = 0;	// routed before the end of the parameters
+static long long int route_cache_hits = 0;	// atomic, counted without the mutex
+static long long int route_cache_misses = 0;
+static long long int route_cache_evictions = 0;
+static long long int routes_listener = 0;	// atomic, routed by the listener of the project
+static long long int cold_starts = 0;	// requests waiting for the first process of a project
+static long long int cold_start_failures = 0;
+static struct statistic_histogram_s cold_start_wait;	// usec
+static long long int idle_shutdowns = 0;	// processes stopped after the idle timeout
+static long long int dispatch_overtaking = 0;	// atomic, served before earlier requests
+static long long int dispatch_aged = 0;	// atomic, served first after the maximum delay
+static long long int catch_all_requests = 0;	// atomic, requests matching no project
+static long long int catch_all_borrowed = 0;	// atomic, processes lent to other projects
+static long long int affinity_hit_usec = 0;	// service time of the requests getting the process of their key
+static long long int affinity_miss_usec = 0;
+static struct statistic_histogram_s affinity_hit_time;	// usec
+static struct statistic_histogram_s affinity_miss_time;	// usec
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
@@ -126,6 +173,493 @@ void statistic_add_process_start(int num)
 }
 
 
+void statistic_add_relay(long long int copied, long long int spliced, long long int syscalls)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    relay_copied_bytes += copied;
+    relay_spliced_bytes += spliced;
+    relay_syscalls += syscalls;
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+static void statistic_histogram_add(struct statistic_histogram_s *histogram, long long int value)
+{
+    int n = 0;
+    while (n < HISTOGRAM_BUCKETS-1 && value >= (1LL << n))
+	n++;
+
+    histogram->bucket[n]++;
+    histogram->count++;
+    if (value > histogram->max)
+	histogram->max = value;
+}
+
+
+/* returns the upper bound of the bucket holding the percentile */
+static long long int statistic_histogram_percentile(const struct statistic_histogram_s *histogram, int percent)
+{
+    if ( !histogram->count )
+	return 0;
+
+    long long int rank = (histogram->count * percent + 99) / 100;
+    long long int sum = 0;
+    int n;
+    for (n=0; n<HISTOGRAM_BUCKETS-1; n++)
+    {
+	sum += histogram->bucket[n];
+	if (sum >= rank)
+	    break;
+    }
+
+    return min((1LL << n) - 1, histogram->max);
+}
+
+
+void statistic_add_admission(enum statistic_admission_e result, long long int wait_usec, int queue_len)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    admission_count[result]++;
+    if (STATISTIC_ADMISSION_FULL != result)
+	statistic_histogram_add(&admission_wait, wait_usec);
+    statistic_histogram_add(&admission_queue_len, queue_len);
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+void statistic_add_child_connect(long long int connect_usec, int retries, int failovers)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    child_connects++;
+    child_connect_retries += retries;
+    child_connect_failovers += failovers;
+    statistic_histogram_add(&child_connect_time, connect_usec);
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+void statistic_add_accept(int accepted)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    statistic_histogram_add(&accept_batch, accepted);
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+void statistic_add_route(int is_early)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    routes++;
+    if (is_early)
+	routes_early++;
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* count the requests which found no process of their project and had to wait
+ * for a new process to start and initialize.
+ */
+void statistic_add_cold_start(int is_admitted, long long int wait_usec)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    if (is_admitted)
+    {
+	cold_starts++;
+	statistic_histogram_add(&cold_start_wait, wait_usec);
+    }
+    else
+    {
+	cold_start_failures++;
+    }
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+void statistic_add_idle_shutdown(int num)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    idle_shutdowns += num;
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* count the lookups of the route cache. This is called for each request,
+ * the counters are changed atomically without the mutex.
+ */
+void statistic_add_route_cache(int is_hit, int has_evicted)
+{
+    if (is_hit)
+	__atomic_fetch_add(&route_cache_hits, 1, __ATOMIC_RELAXED);
+    else
+	__atomic_fetch_add(&route_cache_misses, 1, __ATOMIC_RELAXED);
+    if (has_evicted)
+	__atomic_fetch_add(&route_cache_evictions, 1, __ATOMIC_RELAXED);
+}
+
+
+/* count the requests routed by the listener they arrived on, without
+ * looking at the parameters. Changed atomically without the mutex.
+ */
+void statistic_add_route_listener(void)
+{
+    __atomic_fetch_add(&routes_listener, 1, __ATOMIC_RELAXED);
+}
+
+
+/* count the queued requests served before requests which arrived earlier
+ * because they are expected to be shorter, and the requests served first
+ * after waiting the maximum delay although shorter ones are waiting.
+ * Changed atomically without the mutex.
+ */
+void statistic_add_dispatch(int is_overtaking, int is_aged)
+{
+    if (is_overtaking)
+	__atomic_fetch_add(&dispatch_overtaking, 1, __ATOMIC_RELAXED);
+    if (is_aged)
+	__atomic_fetch_add(&dispatch_aged, 1, __ATOMIC_RELAXED);
+}
+
+
+static void statistic_printlog_dispatch(void)
+{
+    printlog("Dispatch statistics:\n"
+	    "requests served before earlier requests: %lld\n"
+	    "requests served after the maximum delay: %lld",
+	    __atomic_load_n(&dispatch_overtaking, __ATOMIC_RELAXED),
+	    __atomic_load_n(&dispatch_aged, __ATOMIC_RELAXED)
+    );
+}
+
+
+/* count the requests going to the catch all project because they match no
+ * project, and the processes of the catch all project taken by requests of
+ * other projects. Changed atomically without the mutex.
+ */
+void statistic_add_catch_all(int is_borrowed)
+{
+    if (is_borrowed)
+	__atomic_fetch_add(&catch_all_borrowed, 1, __ATOMIC_RELAXED);
+    else
+	__atomic_fetch_add(&catch_all_requests, 1, __ATOMIC_RELAXED);
+}
+
+
+/* count the requests with an affinity key which got the process of their
+ * key (hit) or another process (miss), with their service time.
+ */
+void statistic_add_affinity(int is_hit, long long int service_usec)
+{
+    int retval = pthread_mutex_lock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: lock mutex");
+	qexit(EXIT_FAILURE);
+    }
+
+    if (is_hit)
+    {
+	affinity_hit_usec += service_usec;
+	statistic_histogram_add(&affinity_hit_time, service_usec);
+    }
+    else
+    {
+	affinity_miss_usec += service_usec;
+	statistic_histogram_add(&affinity_miss_time, service_usec);
+    }
+
+    retval = pthread_mutex_unlock(&mutex);
+    if (retval)
+    {
+	errno = retval;
+	logerror("ERROR: unlock mutex");
+	qexit(EXIT_FAILURE);
+    }
+}
+
+
+/* print the hit ratio of the affinity keys and the service times of hits
+ * and misses.
+ */
+static void statistic_printlog_affinity(long long int hit_usec, long long int miss_usec, const struct statistic_histogram_s *hit_time, const struct statistic_histogram_s *miss_time)
+{
+    long long int hits = hit_time->count;
+    long long int misses = miss_time->count;
+    long long int hit_percent = 0;
+    if (0 < hits + misses)
+	hit_percent = (100 * hits) / (hits + misses);
+    long long int hit_avg = hits ? hit_usec / hits : 0;
+    long long int miss_avg = misses ? miss_usec / misses : 0;
+
+    printlog("Affinity statistics:\n"
+	    "requests with affinity key: %lld hits, %lld misses (%lld%% hits)\n"
+	    "service time of hits: avg %lld, p50 %lld, p90 %lld, p99 %lld usec\n"
+	    "service time of misses: avg %lld, p50 %lld, p90 %lld, p99 %lld usec\n"
+	    "avg service time of misses minus hits: %lld usec",
+	    hits, misses, hit_percent,
+	    hit_avg,
+	    statistic_histogram_percentile(hit_time, 50),
+	    statistic_histogram_percentile(hit_time, 90),
+	    statistic_histogram_percentile(hit_time, 99),
+	    miss_avg,
+	    statistic_histogram_percentile(miss_time, 50),
+	    statistic_histogram_percentile(miss_time, 90),
+	    statistic_histogram_percentile(miss_time, 99),
+	    (hits && misses) ? miss_avg - hit_avg : 0
+    );
+}
+
+
+static void statistic_printlog_catch_all(void)
+{
+    printlog("Catch all statistics:\n"
+	    "requests matching no project: %lld\n"
+	    "processes lent to other projects: %lld",
+	    __atomic_load_n(&catch_all_requests, __ATOMIC_RELAXED),
+	    __atomic_load_n(&catch_all_borrowed, __ATOMIC_RELAXED)
+    );
+}
+
+
+/* print how many requests have been routed before all of their parameters
+ * arrived or by their listener, and how often the route cache knew the
+ * project.
+ */
+static void statistic_printlog_route(long long int num, long long int early)
+{
+    long long int hits = __atomic_load_n(&route_cache_hits, __ATOMIC_RELAXED);
+    long long int misses = __atomic_load_n(&route_cache_misses, __ATOMIC_RELAXED);
+    long long int evictions = __atomic_load_n(&route_cache_evictions, __ATOMIC_RELAXED);
+    long long int hit_percent = 0;
+    if (0 < hits + misses)
+	hit_percent = (100 * hits) / (hits + misses);
+
+    printlog("Routing statistics:\n"
+	    "routed requests: %lld, %lld before the end of the parameters\n"
+	    "routed by the listener of the project: %lld\n"
+	    "route cache: %lld hits, %lld misses (%lld%% hits), %lld replaced",
+	    num, early,
+	    __atomic_load_n(&routes_listener, __ATOMIC_RELAXED),
+	    hits, misses, hit_percent, evictions
+    );
+}
+
+
+/* print how many connections the acceptors took from the backlog on each
+ * wakeup.
+ */
+static void statistic_printlog_accept(const struct statistic_histogram_s *batch)
+{
+    printlog("Accept statistics:\n"
+	    "wakeups: %lld\n"
+	    "connections per wakeup: p50 %lld, p90 %lld, p99 %lld, max %lld",
+	    batch->count,
+	    statistic_histogram_percentile(batch, 50),
+	    statistic_histogram_percentile(batch, 90),
+	    statistic_histogram_percentile(batch, 99),
+	    batch->max
+    );
+}
+
+
+/* print the time the requests waited for a process of a project without any
+ * process, and how many processes have been stopped after idling too long.
+ */
+static void statistic_printlog_cold_start(long long int num, long long int failures, const struct statistic_histogram_s *wait, long long int shutdowns)
+{
+    printlog("Cold start statistics:\n"
+	    "cold starts: %lld, %lld rejected\n"
+	    "cold start wait time: p50 %lld, p90 %lld, p99 %lld, max %lld usec\n"
+	    "processes stopped after idle timeout: %lld",
+	    num, failures,
+	    statistic_histogram_percentile(wait, 50),
+	    statistic_histogram_percentile(wait, 90),
+	    statistic_histogram_percentile(wait, 99),
+	    wait->max,
+	    shutdowns
+    );
+}
+
+
+/* print the time needed to connect to the child processes, including the
+ * retries if the process did not accept at once.
+ */
+static void statistic_printlog_child_connect(long long int connects, long long int retries, long long int failovers, const struct statistic_histogram_s *connect_time)
+{
+    printlog("Child connect statistics:\n"
+	    "connects: %lld, %lld retries, %lld moved to the next process\n"
+	    "connect time: p50 %lld, p90 %lld, p99 %lld, max %lld usec",
+	    connects, retries, failovers,
+	    statistic_histogram_percentile(connect_time, 50),
+	    statistic_histogram_percentile(connect_time, 90),
+	    statistic_histogram_percentile(connect_time, 99),
+	    connect_time->max
+    );
+}
+
+
+/* print how the requests got their processes, the percentiles of the time
+ * they waited and of the queue length they found at arrival.
+ */
+static void statistic_printlog_admission(const long long int *count, const struct statistic_histogram_s *wait, const struct statistic_histogram_s *queue_len)
+{
+    printlog("Admission statistics:\n"
+	    "admitted: %lld immediately, %lld after waiting\n"
+	    "rejected: %lld queue full, %lld timed out\n"
+	    "wait time: p50 %lld, p90 %lld, p99 %lld, max %lld usec\n"
+	    "queue length at arrival: p50 %lld, p90 %lld, p99 %lld, max %lld",
+	    count[STATISTIC_ADMISSION_IMMEDIATE], count[STATISTIC_ADMISSION_QUEUED],
+	    count[STATISTIC_ADMISSION_FULL], count[STATISTIC_ADMISSION_TIMEOUT],
+	    statistic_histogram_percentile(wait, 50),
+	    statistic_histogram_percentile(wait, 90),
+	    statistic_histogram_percentile(wait, 99),
+	    wait->max,
+	    statistic_histogram_percentile(queue_len, 50),
+	    statistic_histogram_percentile(queue_len, 90),
+	    statistic_histogram_percentile(queue_len, 99),
+	    queue_len->max
+    );
+}
+
+
+/* print the amount of relayed data and the cpu time needed for it.
+ * The cpu time includes all other work of the scheduler.
+ */
+static void statistic_printlog_relay(long long int copied, long long int spliced, long long int syscalls)
+{
+    struct rusage usage;
+    int retval = getrusage(RUSAGE_SELF, &usage);
+    if (-1 == retval)
+    {
+	logerror("ERROR: getrusage()");
+	return;
+    }
+
+    long long int cpu_msec = (long long int)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+	    + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+    long long int relayed_mb = (copied + spliced) / (1024*1024);
+    long long int cpu_msec_per_gb = 0;
+    long long int syscalls_per_mb = 0;
+    if (0 < relayed_mb)
+    {
+	cpu_msec_per_gb = (cpu_msec * 1024) / relayed_mb;
+	syscalls_per_mb = syscalls / relayed_mb;
+    }
+
+    printlog("Relay statistics:\n"
+	    "copied: %lld kB\n"
+	    "spliced: %lld kB\n"
+	    "cpu time: %ld.%03ld user, %ld.%03ld system seconds\n"
+	    "cpu time per GB relayed: %lld msec\n"
+	    "relay system calls: %lld, %lld per MB",
+	    copied/1024,
+	    spliced/1024,
+	    usage.ru_utime.tv_sec, usage.ru_utime.tv_usec/1000,
+	    usage.ru_stime.tv_sec, usage.ru_stime.tv_usec/1000,
+	    cpu_msec_per_gb,
+	    syscalls, syscalls_per_mb
+    );
+}
+
+
 void statistic_printlog(void)
 {
     int retval = pthread_mutex_lock(&mutex);
@@ -138,6 +672,28 @@ void statistic_printlog(void)
 
     struct timespec myconntime = connectiontime;
     long long int myconnections = connections;
+    long long int mycopied = relay_copied_bytes;
+    long long int myspliced = relay_spliced_bytes;
+    long long int mysyscalls = relay_syscalls;
+    long long int myadmission_count[STATISTIC_ADMISSION_TIMEOUT+1];
+    memcpy(myadmission_count, admission_count, sizeof(myadmission_count));
+    struct statistic_histogram_s myadmission_wait = admission_wait;
+    struct statistic_histogram_s myadmission_queue_len = admission_queue_len;
+    long long int mychild_connects = child_connects;
+    long long int mychild_connect_retries = child_connect_retries;
+    long long int mychild_connect_failovers = child_connect_failovers;
+    struct statistic_histogram_s mychild_connect_time = child_connect_time;
+    struct statistic_histogram_s myaccept_batch = accept_batch;
+    long long int myroutes = routes;
+    long long int myroutes_early = routes_early;
+    long long int mycold_starts = cold_starts;
+    long long int mycold_start_failures = cold_start_failures;
+    struct statistic_histogram_s mycold_start_wait = cold_start_wait;
+    long long int myidle_shutdowns = idle_shutdowns;
+    long long int myaffinity_hit_usec = affinity_hit_usec;
+    long long int myaffinity_miss_usec = affinity_miss_usec;
+    struct statistic_histogram_s myaffinity_hit_time = affinity_hit_time;
+    struct statistic_histogram_s myaffinity_miss_time = affinity_miss_time;
 
     retval = pthread_mutex_unlock(&mutex);
     if (retval)
@@ -205,4 +761,13 @@ void statistic_printlog(void)
 
     }
 
+    statistic_printlog_accept(&myaccept_batch);
+    statistic_printlog_route(myroutes, myroutes_early);
+    statistic_printlog_relay(mycopied, myspliced, mysyscalls);
+    statistic_printlog_admission(myadmission_count, &myadmission_wait, &myadmission_queue_len);
+    statistic_printlog_dispatch();
+    statistic_printlog_child_connect(mychild_connects, mychild_connect_retries, mychild_connect_failovers, &mychild_connect_time);
+    statistic_printlog_cold_start(mycold_starts, mycold_start_failures, &mycold_start_wait, myidle_shutdowns);
+    statistic_printlog_catch_all();
+    statistic_printlog_affinity(myaffinity_hit_usec, myaffinity_miss_usec, &myaffinity_hit_time, &myaffinity_miss_time);
 }
@@ -10,12 +10,33 @@
 
 struct timespec;
 
+/* how a request got its process */
+enum statistic_admission_e
+{
+    STATISTIC_ADMISSION_IMMEDIATE,	// a process was idle, the queue empty
+    STATISTIC_ADMISSION_QUEUED,		// got a process after waiting in the queue
+    STATISTIC_ADMISSION_FULL,		// rejected, the queue was full
+    STATISTIC_ADMISSION_TIMEOUT		// rejected after waiting too long
+};
+
 void statistic_init(void);
 
 void statistic_add_connection(const struct timespec *timeradd);
 void statistic_add_process_crash(int num);
 void statistic_add_process_shutdown(int num);
 void statistic_add_process_start(int num);
+void statistic_add_relay(long long int copied, long long int spliced, long long int syscalls);
+void statistic_add_admission(enum statistic_admission_e result, long long int wait_usec, int queue_len);
+void statistic_add_child_connect(long long int connect_usec, int retries, int failovers);
+void statistic_add_accept(int accepted);
+void statistic_add_route(int is_early);
+void statistic_add_route_cache(int is_hit, int has_evicted);
+void statistic_add_route_listener(void);
+void statistic_add_dispatch(int is_overtaking, int is_aged);
+void statistic_add_catch_all(int is_borrowed);
+void statistic_add_affinity(int is_hit, long long int service_usec);
+void statistic_add_cold_start(int is_admitted, long long int wait_usec);
+void statistic_add_idle_shutdown(int num);
 
 void statistic_printlog(void);
 
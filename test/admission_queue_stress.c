@@ -0,0 +1,265 @@
+/*
+ * admission_queue_stress.c
+ *
+ *  Created on: 16.10.2026
+ *      Author: jh
+ */
+
+/*
+    Stress test of the admission queue for lost wakeups.
+    Many projects run at full load with more requests than processes per
+    project. Half of the requests wait blocking, the other half are notified
+    like the connection workers, some of them cancel while they wait. Each
+    request holds its process for a short time and sets it idle again.
+    A lost wakeup shows as a request timing out, a process handed to two
+    waiters as a double handoff. At the end all processes have to be idle.
+
+    Usage: admission_queue_stress [projects [processes [threads [requests]]]]
+    processes and threads are per project, requests per thread.
+    Returns 0 if all requests have been served.
+
+    Copyright (C) 2015,2016  Jörg Habenicht (jh@mwerk.net)
+
+    This file is part of qgis-server-scheduler
+
+    qgis-server-scheduler is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    qgis-server-scheduler is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "admission_queue.h"
+#include "database.h"
+#include "qgis_config.h"
+#include "statistic.h"
+
+
+#define MAX_QUEUE_WAIT		3000	/* msec, a lost wakeup times out */
+#define HOLD_USEC		50	/* time a request holds its process */
+#define FIRST_PID		100
+#define PROJECT_NAME_LEN	16
+
+
+static int num_projects = 64;
+static int num_processes = 2;
+static int num_threads = 8;
+static int num_requests = 200;
+
+static char (*projects)[PROJECT_NAME_LEN];
+static int *owner;	/* number of requests holding the process */
+static long long int served, cancelled, timeouts, fulls, doubles;
+
+
+static void notify(void *arg)
+{
+    sem_t *sem = arg;
+    sem_post(sem);
+}
+
+
+static void use_process(pid_t pid)
+{
+    if (__sync_lock_test_and_set(&owner[pid - FIRST_PID], 1))
+	__sync_fetch_and_add(&doubles, 1);
+    usleep(HOLD_USEC);
+    __sync_lock_release(&owner[pid - FIRST_PID]);
+    db_process_set_state_idle(pid);
+    __sync_fetch_and_add(&served, 1);
+}
+
+
+/* wait like a connection worker: try, then wait for the notification and
+ * try again. Every 16th request cancels while it waits.
+ * returns the process, or 0 if the request has been cancelled.
+ */
+static pid_t acquire_notified(const char *projname, sem_t *sem, unsigned int *seed)
+{
+    struct admission_waiter_s waiter;
+    memset(&waiter, 0, sizeof(waiter));
+    waiter.expected_usec = rand_r(seed) % 1000;
+    waiter.notify = notify;
+    waiter.arg = sem;
+
+    while (0 == sem_trywait(sem))
+	;
+
+    pid_t pid = admission_queue_try_acquire(&waiter, projname);
+    if (ADMISSION_QUEUE_WAIT == pid && 0 == rand_r(seed) % 16)
+    {
+	/* the process may be handed to the waiter in the meantime */
+	if (rand_r(seed) % 2)
+	    usleep(100);
+	admission_queue_cancel(&waiter);
+	__sync_fetch_and_add(&cancelled, 1);
+	return 0;
+    }
+
+    while (ADMISSION_QUEUE_WAIT == pid)
+    {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 2*MAX_QUEUE_WAIT/1000;
+	sem_timedwait(sem, &ts);
+	pid = admission_queue_try_acquire(&waiter, projname);
+    }
+
+    return pid;
+}
+
+
+static void *run_requests(void *arg)
+{
+    long n = (long)arg;
+    const char *projname = projects[n % num_projects];
+    unsigned int seed = n;
+    int is_blocking = (n / num_projects) % 2;
+
+    sem_t sem;
+    sem_init(&sem, 0, 0);
+
+    int i;
+    for (i=0; i<num_requests; i++)
+    {
+	pid_t pid;
+	if (is_blocking)
+	    pid = admission_queue_acquire(projname, 0, rand_r(&seed) % 1000, 0, NULL);
+	else
+	    pid = acquire_notified(projname, &sem, &seed);
+
+	if (0 < pid)
+	    use_process(pid);
+	else if (ADMISSION_QUEUE_TIMEOUT == pid)
+	    __sync_fetch_and_add(&timeouts, 1);
+	else if (ADMISSION_QUEUE_FULL == pid)
+	    __sync_fetch_and_add(&fulls, 1);
+    }
+
+    sem_destroy(&sem);
+
+    return NULL;
+}
+
+
+/* write the configuration of the projects into a temporary file and load it */
+static void load_config(void)
+{
+    char path[] = "/tmp/admission_queue_stress.XXXXXX";
+    int fd = mkstemp(path);
+    FILE *file = (-1 == fd) ? NULL : fdopen(fd, "w");
+    if ( !file )
+    {
+	perror("can not create configuration");
+	exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "process=/bin/true\nmax_queue=%d\nmax_queue_wait=%d\n", num_threads, MAX_QUEUE_WAIT);
+    int i;
+    for (i=0; i<num_projects; i++)
+	fprintf(file, "[%s]\nscan_param=QUERY_STRING\nscan_regex=map=%s\n", projects[i], projects[i]);
+    fclose(file);
+
+    char **sectionnew, **sectionchanged, **sectiondelete;
+    int retval = config_load(path, &sectionnew, &sectionchanged, &sectiondelete);
+    unlink(path);
+    if (retval)
+    {
+	fprintf(stderr, "can not load configuration\n");
+	exit(EXIT_FAILURE);
+    }
+    config_delete_section_change_list(sectionnew);
+    config_delete_section_change_list(sectionchanged);
+    config_delete_section_change_list(sectiondelete);
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+	num_projects = atoi(argv[1]);
+    if (argc > 2)
+	num_processes = atoi(argv[2]);
+    if (argc > 3)
+	num_threads = atoi(argv[3]);
+    if (argc > 4)
+	num_requests = atoi(argv[4]);
+    if (0 >= num_projects || 0 >= num_processes || 0 >= num_threads || 0 >= num_requests)
+    {
+	fprintf(stderr, "usage: %s [projects [processes [threads [requests]]]]\n", argv[0]);
+	return EXIT_FAILURE;
+    }
+
+    projects = calloc(num_projects, sizeof(*projects));
+    owner = calloc(num_projects * num_processes, sizeof(*owner));
+    int num = num_projects * num_threads;
+    pthread_t *threads = calloc(num, sizeof(*threads));
+    if ( !projects || !owner || !threads )
+    {
+	perror("calloc");
+	return EXIT_FAILURE;
+    }
+
+    int i, j;
+    for (i=0; i<num_projects; i++)
+	snprintf(projects[i], sizeof(projects[i]), "p%d", i);
+
+    load_config();
+    statistic_init();
+    db_init();
+    admission_queue_init();
+
+    pid_t pid = FIRST_PID;
+    for (i=0; i<num_projects; i++)
+    {
+	db_add_project(projects[i]);
+	for (j=0; j<num_processes; j++, pid++)
+	{
+	    db_add_process(projects[i], pid, pid);	/* socket is not used */
+	    db_process_set_state_idle(pid);
+	}
+	db_move_all_idle_process_from_init_to_active_list(projects[i]);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<num; i++)
+	pthread_create(&threads[i], NULL, run_requests, (void *)(long)i);
+    for (i=0; i<num; i++)
+	pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* each process has been set idle again */
+    int not_idle = 0;
+    for (i=0; i<num_projects; i++)
+	for (j=0; j<num_processes; j++)
+	    if (0 >= db_try_get_next_idle_process_for_busy_work(projects[i]))
+		not_idle++;
+
+    printf("%d projects, %d processes, %d threads: served %lld, cancelled %lld, timeouts %lld, full %lld, double handoffs %lld, processes not idle %d, %.2f sec\n",
+	    num_projects, num_projects * num_processes, num, served, cancelled, timeouts, fulls, doubles, not_idle,
+	    (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    if (timeouts || fulls || doubles || not_idle)
+	return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}